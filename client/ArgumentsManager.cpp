@@ -46,10 +46,12 @@ ArgumentsManager::ArgumentsManager(int argc, char **argv) : //pre-initialize all
         _dirSet(false),
         _macSet(false),
         _allSet(false),
+        _verifySet(false),
         _startSet(false),
         _ipSet(false),
         _portSet(false),
-        _persistSet(false){
+        _persistSet(false),
+        _keepAliveSet(false){
 
     //if the number of arguments is wrong throw exception
     if(argc == 1)
@@ -64,18 +66,20 @@ ArgumentsManager::ArgumentsManager(int argc, char **argv) : //pre-initialize all
                 {"dir",         required_argument,  nullptr,  'd' },
                 {"mac",         required_argument,  nullptr,  'm' },
                 {"all",         no_argument,        nullptr,  'a' },
+                {"verify",      no_argument,        nullptr,  'v' },
                 {"start",       no_argument,        nullptr,  's' },
                 {"ip",          required_argument,  nullptr,  'i' },
                 {"port",        required_argument,  nullptr,  'p' },
                 {"username",    required_argument,  nullptr,  'u' },
                 {"password",    required_argument,  nullptr,  'w' },
                 {"persist",     no_argument,        nullptr,  't' },
+                {"keep-alive",  no_argument,        nullptr,  'k' },
                 {"help",        no_argument,        nullptr,  'h'},
                 {nullptr,0,                 nullptr,  0 }
         };
 
         //define short (+long) options and get next option from the arguments from main
-        int c = getopt_long(argc, argv, "rd:m:asi:p:u:w:th", long_options, &option_index);
+        int c = getopt_long(argc, argv, "rd:m:avsi:p:u:w:tkh", long_options, &option_index);
 
         //if no more options were found then exit loop
         if (c == -1)
@@ -127,6 +131,10 @@ ArgumentsManager::ArgumentsManager(int argc, char **argv) : //pre-initialize all
                 _allSet = true;
                 break;
 
+            case 'v':   //verify option
+                _verifySet = true;
+                break;
+
             case 's':   //start client option
                 _startSet = true;
                 break;
@@ -179,6 +187,10 @@ ArgumentsManager::ArgumentsManager(int argc, char **argv) : //pre-initialize all
                 _persistSet = true;
                 break;
 
+            case 'k':   //keep alive option
+                _keepAliveSet = true;
+                break;
+
             case 'h':   //display help option
                 _displayHelp(argv[0]);
                 throw ArgumentsManagerException("", ArgumentsManagerError::help);
@@ -208,9 +220,9 @@ ArgumentsManager::ArgumentsManager(int argc, char **argv) : //pre-initialize all
 
     //perform some checks on the options
 
-    //the mac, all and dir options need the retrieve option to be set
-    if(!_retrSet && (_macSet || _allSet || _dirSet))
-        throw ArgumentsManagerException("--mac, --all and --dir options require --retrieve."
+    //the mac, all, verify and dir options need the retrieve option to be set
+    if(!_retrSet && (_macSet || _allSet || _verifySet || _dirSet))
+        throw ArgumentsManagerException("--mac, --all, --verify and --dir options require --retrieve."
                                         " Use -h (or --help) for help.",
                                         ArgumentsManagerError::optArgument);
 
@@ -243,8 +255,9 @@ void ArgumentsManager::_displayHelp(const std::string &programName){
     std::cout << "\nNAME" << std::endl << "\t";
     std::cout << "PDS_BACKUP client\n" << std::endl;
     std::cout << "SYNOPSIS" << std::endl << "\t";
-    std::cout  << programName << " [--help]\n\t\t[--retrieve destFolder] [--mac macAddress] [--all] [--start]"
-                                 "\n\t\t[--ip server_ipaddress] [--port server_port] [--user username] [--pass password]\n" << std::endl;
+    std::cout  << programName << " [--help]\n\t\t[--retrieve destFolder] [--mac macAddress] [--all] [--verify] [--start]"
+                                 "\n\t\t[--ip server_ipaddress] [--port server_port] [--user username] [--pass password]"
+                                 "\n\t\t[--persist] [--keep-alive]\n" << std::endl;
     std::cout << "OPTIONS" << std::endl << "\t";
     std::cout << "--help (abbr -h)" << std::endl << "\t\t";
     std::cout << "Print out a usage message\n" << std::endl << "\t";
@@ -252,6 +265,7 @@ void ArgumentsManager::_displayHelp(const std::string &programName){
     std::cout << "Requests the server (after authentication) to send to the client the copy of the folders and files of\n\t\t"
                  "the specified user. The data will be put in the specified [destDir]. If no other commands are specified\n\t\t"
                  "(no --mac, no --all) then only the files and directories for the current mac address will be retrieved.\n\t\t"
+                 "The files already in [destDir] with the same size and last write time are not retrieved again.\n\t\t"
                  "This command requires the presence of the following other commands: [--ip] [--port] [--user] [--pass] [--dir]\n" << std::endl << "\t";
     std::cout << "--dir (abbr -d) destDir" << std::endl << "\t\t";
     std::cout << "Sets the [destDir] of the user's data to retrieve.\n\t\t"
@@ -262,6 +276,10 @@ void ArgumentsManager::_displayHelp(const std::string &programName){
     std::cout << "--all (abbr -a)" << std::endl << "\t\t";
     std::cout << "Specifies to retrieve all user's data,\n\t\t"
                  "To be used with --retrieve.\n" << std::endl << "\t";
+    std::cout << "--verify (abbr -v)" << std::endl << "\t\t";
+    std::cout << "Specifies to check also the content (hash) of the files already in [destDir] to decide which ones\n\t\t"
+                 "need to be retrieved again (slower, it reads all of them).\n\t\t"
+                 "To be used with --retrieve.\n" << std::endl << "\t";
     std::cout << "--start (abbr -s)" << std::endl << "\t\t";
     std::cout << "Start the server (if not present the server will stop after having created/loaded the Config file).\n\t\t"
                  "This command requires the presence of the following other commands: [--ip] [--port] [--user] [--pass]\n" << std::endl << "\t";
@@ -278,7 +296,10 @@ void ArgumentsManager::_displayHelp(const std::string &programName){
     std::cout << "Sets the [password] to use to authenticate to the server.\n\t\t"
                  "Needed by --start and --retrieve.\n" << std::endl << "\t";
     std::cout << "--persist (abbr -t)" << std::endl << "\t\t";
-    std::cout << "If connection is lost, keep trying indefinitely." << std::endl;
+    std::cout << "If connection is lost, keep trying indefinitely.\n" << std::endl << "\t";
+    std::cout << "--keep-alive (abbr -k)" << std::endl << "\t\t";
+    std::cout << "Keep the connection open when there are no changes (sending heartbeats),\n\t\t"
+                 "instead of closing it after the timeout and connecting again on the next change." << std::endl;
 }
 
 /**
@@ -456,3 +477,21 @@ bool ArgumentsManager::isPortSet() const {
 bool ArgumentsManager::isPersistSet() const {
     return _persistSet;
 }
+
+/**
+ * ArgumentsManager isKeepAliveSet option getter.
+ *
+ * @return whether the keep alive option was set
+ */
+bool ArgumentsManager::isKeepAliveSet() const {
+    return _keepAliveSet;
+}
+
+/**
+ * ArgumentsManager isVerifySet option getter.
+ *
+ * @return whether the verify option was set
+ */
+bool ArgumentsManager::isVerifySet() const {
+    return _verifySet;
+}
@@ -73,12 +73,14 @@ namespace client {
         bool isDirSet() const;      //is Dir option set method
         bool isMacSet() const;      //is Mac option set method
         bool isAllSet() const;      //is All option set method
+        bool isVerifySet() const;   //is Verify option set method
 
         bool isStartSet() const;    //is Start option set method
         bool isIpSet() const;       //is ip option set method
         bool isPortSet() const;     //is port option set method
 
         bool isPersistSet() const;  //is persist option set method
+        bool isKeepAliveSet() const;    //is keep alive option set method
 
     private:
         std::string _username;      //username optional argument
@@ -97,12 +99,14 @@ namespace client {
         bool _dirSet;       //if the destination dir option was set
         bool _macSet;       //if mac option was set
         bool _allSet;       //if all option was set
+        bool _verifySet;    //if verify option was set
 
         bool _startSet;     //if start option was set
         bool _ipSet;        //if the server ip address option was set
         bool _portSet;      //if the server port option was set
 
         bool _persistSet;   //if persist option was set
+        bool _keepAliveSet; //if keep alive option was set
 
         static void _displayHelp(const std::string &programName);  //display help method
     };
@@ -40,6 +40,34 @@
 //So, keeping in mind that there are also other fields in the message, KEEP IT BELOW (or equal) 15KB.
 #define MAX_DATA_CHUNK_SIZE 15360   //now set to 15KB
 
+//Maximum size (in bytes) of a received message (frame); bigger frames are refused and the connection is closed.
+//KEEP IT ABOVE max_data_chunk_size (the DATA messages also carry the other fields and the file path).
+#define MAX_FRAME_SIZE 1048576     //now set to 1MB
+
+//Number of file blocks (of max_data_chunk_size bytes) read ahead while sending a file, so that reading the file
+//and sending it overlap.
+#define READ_AHEAD_BUFFERS 8        //now set to 8 blocks
+
+//Number of DATA messages sent in a row (for the file being sent) before going back to read the server responses and
+//to send the other messages, so that big files do not stall the communication.
+#define DATA_CHUNKS_PER_SLICE 4     //now set to 4 chunks
+
+//Number of files sent at the same time (their DATA messages are interleaved, a slice of each file at a time), so that
+//a big file does not delay the smaller ones too much.
+#define PARALLEL_UPLOADS 4          //now set to 4 files
+
+//Minimum (and initial) number of messages waiting for a server response; the window of messages waiting for a
+//response then adapts (between this and max_response_waiting) to the measured round trip time and throughput.
+#define MIN_RESPONSE_WAITING 8      //now set to 8 messages
+
+//Seconds between 2 subsequent prints of the window of messages waiting for a response, of the round trip time and of
+//the throughput (while connected).
+#define STATS_SECONDS 60            //now set to 60 seconds
+
+//Seconds without changes after which a heartbeat (NOOP message) is sent to the server, when the connection is kept
+//alive (--keep-alive); KEEP IT BELOW the server timeout_seconds, otherwise the server closes the idle connection.
+#define HEARTBEAT_SECONDS 20        //now set to 20 seconds
+
 
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
@@ -234,7 +262,29 @@ void client::Config::_load() {
                                             " it is 1GB,\n"
                                             "# and for a TLS socket it is 16KB.\n"
                                             "# So, keeping in mind that there are also other fields in the message,\n"
-                                            "# KEEP IT BELOW (or equal) 15KB."}};
+                                            "# KEEP IT BELOW (or equal) 15KB."},
+
+                                        {"max_frame_size",                  std::to_string(MAX_FRAME_SIZE),
+                                            "# Maximum size (in bytes) of a received message (frame): bigger frames are refused\n"
+                                            "# KEEP IT ABOVE max_data_chunk_size (plus the size of a path)."},
+
+                                        {"read_ahead_buffers",              std::to_string(READ_AHEAD_BUFFERS),
+                                            "# Number of file blocks (of max_data_chunk_size bytes) read ahead while sending a file"},
+
+                                        {"data_chunks_per_slice",           std::to_string(DATA_CHUNKS_PER_SLICE),
+                                            "# Number of DATA messages sent in a row before going back to read the server responses"},
+
+                                        {"parallel_uploads",                std::to_string(PARALLEL_UPLOADS),
+                                            "# Number of files sent at the same time (their DATA messages are interleaved)"},
+
+                                        {"min_response_waiting",            std::to_string(MIN_RESPONSE_WAITING),
+                                            "# Minimum (and initial) number of messages waiting for a server response (the window adapts up to max_response_waiting)"},
+
+                                        {"stats_seconds",                   std::to_string(STATS_SECONDS),
+                                            "# Seconds between 2 subsequent prints of the window size, round trip time and throughput"},
+
+                                        {"heartbeat_seconds",               std::to_string(HEARTBEAT_SECONDS),
+                                            "# Seconds without changes after which a heartbeat is sent to the server (with --keep-alive)"}};
 
 
         //comments on top of the file
@@ -340,6 +390,20 @@ void client::Config::_load() {
                         _tmp_file_name_size = static_cast<unsigned int>(stoul(value));
                     else if (key == "max_data_chunk_size")
                         _max_data_chunk_size = static_cast<unsigned int>(stoul(value));
+                    else if (key == "max_frame_size")
+                        _max_frame_size = static_cast<unsigned int>(stoul(value));
+                    else if (key == "read_ahead_buffers")
+                        _read_ahead_buffers = static_cast<unsigned int>(stoul(value));
+                    else if (key == "data_chunks_per_slice")
+                        _data_chunks_per_slice = static_cast<unsigned int>(stoul(value));
+                    else if (key == "parallel_uploads")
+                        _parallel_uploads = static_cast<unsigned int>(stoul(value));
+                    else if (key == "min_response_waiting")
+                        _min_response_waiting = static_cast<unsigned int>(stoul(value));
+                    else if (key == "stats_seconds")
+                        _stats_seconds = static_cast<unsigned int>(stoul(value));
+                    else if (key == "heartbeat_seconds")
+                        _heartbeat_seconds = static_cast<unsigned int>(stoul(value));
                 }
             }
         }
@@ -535,4 +599,88 @@ unsigned int client::Config::getMaxDataChunkSize() {
         _max_data_chunk_size = MAX_DATA_CHUNK_SIZE;   //set to default
 
     return _max_data_chunk_size;
+}
+
+/**
+ * max frame size getter (if no value was provided in the config file use a default one)
+ *
+ * @return max frame size
+ */
+unsigned int client::Config::getMaxFrameSize() {
+    if(_max_frame_size == 0)
+        _max_frame_size = MAX_FRAME_SIZE;   //set to default
+
+    return _max_frame_size;
+}
+
+/**
+ * read ahead buffers getter (if no value was provided in the config file use a default one)
+ *
+ * @return read ahead buffers
+ */
+unsigned int client::Config::getReadAheadBuffers() {
+    if(_read_ahead_buffers == 0)
+        _read_ahead_buffers = READ_AHEAD_BUFFERS;   //set to default
+
+    return _read_ahead_buffers;
+}
+
+/**
+ * data chunks per slice getter (if no value was provided in the config file use a default one)
+ *
+ * @return data chunks per slice
+ */
+unsigned int client::Config::getDataChunksPerSlice() {
+    if(_data_chunks_per_slice == 0)
+        _data_chunks_per_slice = DATA_CHUNKS_PER_SLICE;   //set to default
+
+    return _data_chunks_per_slice;
+}
+
+/**
+ * parallel uploads getter (if no value was provided in the config file use a default one)
+ *
+ * @return parallel uploads
+ */
+unsigned int client::Config::getParallelUploads() {
+    if(_parallel_uploads == 0)
+        _parallel_uploads = PARALLEL_UPLOADS;   //set to default
+
+    return _parallel_uploads;
+}
+
+/**
+ * min response waiting getter (if no value was provided in the config file use a default one)
+ *
+ * @return min response waiting
+ */
+unsigned int client::Config::getMinResponseWaiting() {
+    if(_min_response_waiting == 0)
+        _min_response_waiting = MIN_RESPONSE_WAITING;   //set to default
+
+    return _min_response_waiting;
+}
+
+/**
+ * stats seconds getter (if no value was provided in the config file use a default one)
+ *
+ * @return stats seconds
+ */
+unsigned int client::Config::getStatsSeconds() {
+    if(_stats_seconds == 0)
+        _stats_seconds = STATS_SECONDS;   //set to default
+
+    return _stats_seconds;
+}
+
+/**
+ * heartbeat seconds getter (if no value was provided in the config file use a default one)
+ *
+ * @return heartbeat seconds
+ */
+unsigned int client::Config::getHeartbeatSeconds() {
+    if(_heartbeat_seconds == 0)
+        _heartbeat_seconds = HEARTBEAT_SECONDS;   //set to default
+
+    return _heartbeat_seconds;
 }
\ No newline at end of file
@@ -76,6 +76,13 @@ namespace client {
         unsigned int getMaxResponseWaiting();
         unsigned int getTmpFileNameSize();
         unsigned int getMaxDataChunkSize();
+        unsigned int getMaxFrameSize();
+        unsigned int getReadAheadBuffers();
+        unsigned int getDataChunksPerSlice();
+        unsigned int getParallelUploads();
+        unsigned int getMinResponseWaiting();
+        unsigned int getStatsSeconds();
+        unsigned int getHeartbeatSeconds();
 
     protected:
         //protected constructor
@@ -108,6 +115,13 @@ namespace client {
         unsigned int _max_response_waiting{};
         unsigned int _tmp_file_name_size{};
         unsigned int _max_data_chunk_size{};
+        unsigned int _max_frame_size{};
+        unsigned int _read_ahead_buffers{};
+        unsigned int _data_chunks_per_slice{};
+        unsigned int _parallel_uploads{};
+        unsigned int _min_response_waiting{};
+        unsigned int _stats_seconds{};
+        unsigned int _heartbeat_seconds{};
 
         //config file load function
         void _load();
@@ -7,14 +7,20 @@
 #include "ProtocolManager.h"
 
 #include <fstream>
+#include <sys/stat.h>
 
+#include "../myLibraries/FileReader.h"
 #include "../myLibraries/Message.h"
-#include "../myLibraries/RandomNumberGenerator.h"
 #include "../myLibraries/Validator.h"
 #include "Config.h"
 #include <cmath>
+#include <algorithm>
 
 #define TEMP_RELATIVE_PATH "/temp"
+#define RETR_PRESENT_BATCH 65536    //maximum number of present digests in a RETR message (8 bytes each)
+
+#define WINDOW_ALPHA 2  //the window grows while less than these messages are queued beyond the bandwidth-delay product
+#define WINDOW_BETA 6   //the window shrinks when more than these messages are queued beyond the bandwidth-delay product
 
 
 /*
@@ -30,26 +36,48 @@
  *
  * @author Michele Crepaldi s269551
  */
-client::ProtocolManager::ProtocolManager(Socket &socket, Circular_vector<Event> &waitingForResponse, int ver) :
+client::ProtocolManager::ProtocolManager(Socket &socket, std::map<uint64_t, Event> &waitingForResponse, int ver) :
         _s(socket), //set socket
         _waitingForResponse(waitingForResponse),    //set waitingForResponse object
-        _protocolVersion(ver) { //set protocol version
+        _stream(0), //AUTH and RETR messages do not belong to any operation
+        _protocolVersion(ver),  //set protocol version
+        _slowStart(true),       //the window doubles until queueing is detected
+        _windowLimited(false),  //the window did not limit the sends yet
+        _heartbeatWaiting(false),   //no heartbeat sent yet
+        _srtt(0),               //no round trip time measured yet
+        _minRtt(0),
+        _roundRtt(0),
+        _throughput(0),         //no throughput measured yet
+        _roundResponses(0),
+        _roundStart(std::chrono::steady_clock::now()) { //the first round trip starts now
+
+    //the streams of the messages still waiting for a response (from a previous connection) are kept
+    _nextStream = _waitingForResponse.empty() ? 1 : _waitingForResponse.rbegin()->first + 1;
 
     auto config = Config::getInstance();    //config object instance
     _path_to_watch = config->getPathToWatch();  //get path to watch
-    _tempNameSize = config->getTmpFileNameSize();       //get temporary file name size
     _maxDataChunkSize = config->getMaxDataChunkSize();  //get max data chunk size
+    _readAheadBuffers = config->getReadAheadBuffers();  //get number of read ahead buffers
+    _dataChunksPerSlice = config->getDataChunksPerSlice();  //get number of DATA messages sent in a row
+    _minResponseWaiting = config->getMinResponseWaiting();  //get min number of messages waiting for a response
+    _maxResponseWaiting = std::max(config->getMaxResponseWaiting(), _minResponseWaiting);   //get max one
+    _parallelUploads = config->getParallelUploads();        //get number of files sent at the same time
 
     _db = Database::getInstance();              //get database instance
+
+    _window = _minResponseWaiting;  //start from the minimum window
 }
 
 /**
  * ProtocolManager authenticate method.
- *  It is used to authenticate the client to the server.
+ *  It is used to authenticate the client to the server; the session token got in a previous connection (if any) is
+ *  presented too, so that the server can skip the password check (and find the client's data still loaded), and the
+ *  new session token got from the server is kept for the next connection.
  *
  * @param username username of the user
  * @param password password of the user
  * @param macAddress macAddress of this user's machine
+ * @param token session token (kept between connections)
  *
  * @throws ProtocolManagerException:
  *  <b>version</b> if the server message uses a different version
@@ -65,13 +93,13 @@ client::ProtocolManager::ProtocolManager(Socket &socket, Circular_vector<Event>
  * @author Michele Crepaldi s269551
  */
 void client::ProtocolManager::authenticate(const std::string& username, const std::string& password,
-                                           const std::string& macAddress) {
+                                           const std::string& macAddress, std::string &token) {
 
     //send authentication message to server
-    _send_AUTH(username, macAddress, password);
+    _send_AUTH(username, macAddress, password, token);
 
-    std::string response = _s.recvString();     //server response
-    _serverMessage.ParseFromString(response);   //get serverMessage protobuf parsing the server response
+    _s.recvString(_messageBuffer);                  //server response
+    _serverMessage.ParseFromString(_messageBuffer); //get serverMessage protobuf parsing the server response
 
     //check serverMessage version
     if(_serverMessage.version() != _protocolVersion) {
@@ -85,6 +113,7 @@ void client::ProtocolManager::authenticate(const std::string& username, const st
     switch (_serverMessage.type()) {
         case messages::ServerMessage_Type_OK: {
             int okCode = _serverMessage.code();   //ok code
+            std::string newToken = _serverMessage.token();  //new session token
 
             //it is more efficient to clear the serverMessage protobuf than creating a new one
             _serverMessage.Clear();
@@ -92,6 +121,9 @@ void client::ProtocolManager::authenticate(const std::string& username, const st
             //handle ok code based on its value
             switch (static_cast<client::OkCode>(okCode)) {
                 case OkCode::authenticated:
+                    //keep the new session token for the next connection
+                    token = std::move(newToken);
+
                     Message::print(std::cout, "AUTH", "Authenticated");
                     return;
 
@@ -101,6 +133,7 @@ void client::ProtocolManager::authenticate(const std::string& username, const st
                 case OkCode::notThere:
                 case OkCode::removed:
                 case OkCode::retrieved:
+                case OkCode::canceled:
                 default:
                     throw ProtocolManagerException("Unexpected ok code",
                                                    ProtocolManagerError::unexpectedCode);
@@ -166,13 +199,24 @@ void client::ProtocolManager::authenticate(const std::string& username, const st
 /**
  * ProtocolManager canSend method.
  *  Used to know if the protocol manager can send a message, namely if the sent messages queue is not full
+ *  (it holds at most window messages)
  *
  * @return true if there is space for another message to be sent, no otherwise
  *
  * @author Michele Crepaldi s269951
  */
 bool client::ProtocolManager::canSend() const {
-    return !_waitingForResponse.full();
+    return _waitingForResponse.size() < _window;
+}
+
+/**
+ * ProtocolManager isSending method.
+ *  Used to know if the protocol manager has file data to send (with sendData)
+ *
+ * @return true if there are files to send, false otherwise
+ */
+bool client::ProtocolManager::isSending() const {
+    return !_uploads.empty();
 }
 
 /**
@@ -200,41 +244,62 @@ int client::ProtocolManager::nWaiting() const{
     return _waitingForResponse.size();
 }
 
+/**
+ * ProtocolManager getWindow method.
+ *  Used to get the current window (the maximum number of messages waiting for a server response)
+ *
+ * @return current window
+ */
+unsigned int client::ProtocolManager::getWindow() const{
+    return _window;
+}
+
+/**
+ * ProtocolManager getRtt method.
+ *  Used to get the smoothed round trip time of the event messages
+ *
+ * @return round trip time (in milliseconds), 0 if it was not measured yet
+ */
+double client::ProtocolManager::getRtt() const{
+    return _srtt * 1000;
+}
+
+/**
+ * ProtocolManager getThroughput method.
+ *  Used to get the number of server responses received per second (measured in the last round trip)
+ *
+ * @return throughput (responses per second), 0 if it was not measured yet
+ */
+double client::ProtocolManager::getThroughput() const{
+    return _throughput;
+}
+
 /**
  * ProtocolManager recoverFromError method.
  *  Used to recover from errors or exceptions -> it re-sends all already sent messages for which we did not have a
- *  server response
+ *  server response (interrupted file transfers are probed again, so that the server can tell from where to resume them)
  *
  * @author Michele Crepaldi s269551
  */
 void client::ProtocolManager::recoverFromError() {
-    int start = _waitingForResponse.start();    //waiting messages queue start index
-    int end = _waitingForResponse.end();        //waiting messages queue end index
-    int capacity = _waitingForResponse.capacity();      //waiting messages queue size
-
-    //iterate over all messages in the waiting queue
-    for(int i = start; i != end; i = (i+1)%capacity){
-        Event event = _waitingForResponse[i];    //current element from the queue
+    //iterate over all messages in the waiting queue (in the order they were sent, the same as their streams)
+    for(auto &waiting : _waitingForResponse){
+        Event &event = waiting.second;  //current element from the queue
 
         //if the event is of type storeSent
         if(event.getType() == FileSystemStatus::storeSent){
             std::string ap = event.getElement().getAbsolutePath();  //current element's absolute path
 
-            //if the file to transfer is not present anymore in the filesystem or its hash is different from the one of
-            //the file present in the filesystem then it means that the file was deleted or modified
+            //if the file to transfer is not present anymore in the filesystem then it means that the file was deleted
             //--> I don't send it anymore
-            if(!std::filesystem::exists(ap) ||
-                    Directory_entry(_path_to_watch, ap).getHash() != event.getElement().getHash())
+            //(if it was modified _sendFile will notice it while sending it, and it will cancel the transfer)
+            if(!std::filesystem::exists(ap))
                 continue;
         }
 
-        //compose message based on event
+        //compose message based on event (on the same stream)
+        _stream = waiting.first;
         _composeMessage(event);
-
-        //again, if the event is of type storeSent
-        if(event.getType() == FileSystemStatus::storeSent){
-            _sendFile(event.getElement()); //send file
-        }
     }
 }
 
@@ -251,7 +316,7 @@ void client::ProtocolManager::recoverFromError() {
  */
 bool client::ProtocolManager::send(Event &event) {
 
-    if(_waitingForResponse.full())
+    if(!canSend())
         return false;
 
     //if the element is not a file nor a directory then return (it is not of a supported type)
@@ -261,15 +326,77 @@ bool client::ProtocolManager::send(Event &event) {
         return true;
     }
 
-    //compose the message based on the event (and send it)
+    //compose the message based on the event (and send it on a new stream)
+    _stream = _nextStream++;
     _composeMessage(event);
 
     //save a copy of the event in the message waiting queue
-    _waitingForResponse.push(event);
+    _waitingForResponse.emplace(_stream, event);
+
+    //time the message (to measure the round trip time)
+    _sentTimes.emplace(_stream, std::chrono::steady_clock::now());
 
     return true;
 }
 
+/**
+ * ProtocolManager sendData method.
+ *  It is used to send the next slice (at most data_chunks_per_slice DATA messages) of one of the files being sent
+ *  (the first parallel_uploads files of the queue, in turn), so that the caller can read the server responses and
+ *  send the other messages in between; when a file is done the next one in the queue is started
+ */
+void client::ProtocolManager::sendData() {
+    if(_uploads.empty())
+        return;
+
+    auto upload = std::move(_uploads.front());  //file to send a slice of
+    _uploads.pop_front();
+
+    _stream = upload->stream;   //all the messages of the file transfer belong to its stream
+
+    //if a newer version of the file was queued this transfer is useless (and it would use the same partial file on
+    //the server), so cancel it
+    if(upload->stale) {
+        Message::print(std::cerr, "WARNING", "File changed while sending it, transfer canceled",
+                       upload->element.getRelativePath());
+
+        if(upload->file != nullptr)
+            _send_CANCEL(); //cancel the transfer (in place of the remaining data blocks)
+        else
+            _waitingForResponse.erase(upload->stream);  //the transfer was not even started (no response will come)
+        return;
+    }
+
+    //if the file transfer is not started yet start it now (if it cannot even start it is already done)
+    bool done = upload->file == nullptr ? !_startFile(*upload) : false;
+
+    //send the next slice of the file
+    if(!done)
+        done = _sendSlice(*upload);
+
+    //if the file transfer is not done put it back, after the other files being sent (if any)
+    if(!done) {
+        auto active = std::min<size_t>(std::max(_parallelUploads, 1u) - 1, _uploads.size());
+        _uploads.insert(_uploads.begin() + active, std::move(upload));
+    }
+}
+
+/**
+ * ProtocolManager heartbeat method.
+ *  It is used to keep an idle connection alive, sending a NOOP message to the server (which answers with a NOOP
+ *  message); if the previous heartbeat was not answered the connection is considered lost
+ *
+ * @throws SocketException:
+ *  <b>closed</b> if the previous heartbeat was not answered
+ */
+void client::ProtocolManager::heartbeat() {
+    if(_heartbeatWaiting)
+        throw SocketException("Heartbeat not answered", SocketError::closed);
+
+    _send_NOOP();
+    _heartbeatWaiting = true;
+}
+
 /**
  * ProtocolManager receive method.
  *  Used to receive and process messages from the server
@@ -293,12 +420,8 @@ bool client::ProtocolManager::send(Event &event) {
 void client::ProtocolManager::receive() {
     //get server response
 
-    std::string server_temp = _s.recvString();      //server response message
-    _serverMessage.ParseFromString(server_temp);    //get serverMessage protobuf parsing the response message
-
-    //get the first event on the waiting list -> this is the message we received a response for
-
-    Event event = _waitingForResponse.front();  //current event (the head of the waiting queue)
+    _s.recvString(_messageBuffer);                  //server response message
+    _serverMessage.ParseFromString(_messageBuffer); //get serverMessage protobuf parsing the response message
 
     //check serverMessage version
     if(_protocolVersion != _serverMessage.version()) {
@@ -309,18 +432,49 @@ void client::ProtocolManager::receive() {
                                        client::ProtocolManagerError::version);
     }
 
+    //heartbeat response (it does not belong to any operation)
+    if(_serverMessage.type() == messages::ServerMessage_Type_NOOP) {
+        //it is more efficient to clear the serverMessage protobuf than creating a new one
+        _serverMessage.Clear();
+
+        _heartbeatWaiting = false;
+        return;
+    }
+
+    //get the event on the waiting list with the same stream -> this is the message we received a response for
+
+    auto waiting = _waitingForResponse.find(_serverMessage.stream());   //current event (by stream)
+    if(waiting == _waitingForResponse.end()) {
+        //it is more efficient to clear the serverMessage protobuf than creating a new one
+        _serverMessage.Clear();
+
+        throw ProtocolManagerException("Error in the server message", ProtocolManagerError::serverMessage);
+    }
+
+    Event event = waiting->second;  //current event
+
+    //measure the round trip time (and adapt the window)
+    _measure(waiting->first);
+
     //switch on server message type
     switch (_serverMessage.type()) {
         case messages::ServerMessage_Type_SEND:
             //check that the event's element is actually a file and that the event type is "created" or "modified"
             //(otherwise I don't have to send it)
+            //(or "storeSent" if the file transfer was interrupted and it is being probed again)
             if(event.getElement().is_regular_file() && (event.getType() == FileSystemStatus::created ||
-                    event.getType() == FileSystemStatus::modified)){
+                    event.getType() == FileSystemStatus::modified || event.getType() == FileSystemStatus::storeSent)){
 
                 //send file
 
                 std::string path = _serverMessage.path();   //path got from serverMessage
                 Hash h = Hash(_serverMessage.hash());   //hash got from serverMessage
+                uintmax_t offset = _serverMessage.offset(); //offset from which to send the file
+
+                //the server cannot have more than the whole file
+                if(offset > event.getElement().getSize())
+                    throw ProtocolManagerException("Error in the server message",
+                                                   ProtocolManagerError::serverMessage);
 
                 //it is more efficient to clear the serverMessage protobuf than creating a new one
                 _serverMessage.Clear();
@@ -331,27 +485,29 @@ void client::ProtocolManager::receive() {
                                                    ProtocolManagerError::serverMessage);
 
                 //remove message (PROB) event from queue (it was successful)
-                _waitingForResponse.pop();
-
-                //if the file to transfer is not present anymore in the filesystem or its hash is different from the one of
-                //the file present in the filesystem then it means that the file was deleted or modified
-                //--> I don't send it anymore
-                if(!std::filesystem::exists(event.getElement().getAbsolutePath()) ||
-                   Directory_entry(_path_to_watch, event.getElement().getAbsolutePath()).getHash()
-                   != event.getElement().getHash())
+                _waitingForResponse.erase(waiting);
+
+                //if the file to transfer is not present anymore in the filesystem then it means that the file was
+                //deleted --> I don't send it anymore
+                //(if it was modified _sendFile will notice it while sending it, and it will cancel the transfer)
+                if(!std::filesystem::exists(event.getElement().getAbsolutePath()))
                     break;
 
                 //(file created/modified) -> the store message was sent to server event
+                //(the STOR message is sent by sendData, on a new stream, before the file data)
                 Event newEvent = Event(event.getElement(), FileSystemStatus::storeSent);
+                uint64_t stream = _nextStream++;    //stream of the file transfer
 
-                //compose the message based on the event (and send it)
-                _composeMessage(newEvent);
+                //the previous versions of the file still queued (if any) do not have to be sent anymore
+                for(auto &upload : _uploads)
+                    if(upload->element.getRelativePath() == path)
+                        upload->stale = true;
 
-                //save a copy of the event in the message waiting queue
-                _waitingForResponse.push(std::move(newEvent));
+                //queue the file to be sent (from offset) by sendData, a slice at a time
+                _uploads.push_back(std::make_unique<Upload>(event.getElement(), offset, stream));
 
-                //send the file
-                _sendFile(event.getElement());
+                //save a copy of the event in the message waiting queue
+                _waitingForResponse.emplace(stream, std::move(newEvent));
                 break;
             }
             //if I am here then I got a send message but the element is not a file so this is a error
@@ -383,6 +539,14 @@ void client::ProtocolManager::receive() {
                     Message::print(std::cout, "SUCCESS", "DELE/RMD", event.getElement().getRelativePath());
                     break;
 
+                case OkCode::canceled:
+                    //the file was modified while sending it, the new version will be sent with a new event
+                    Message::print(std::cout, "CANCELED", "STOR", event.getElement().getRelativePath());
+
+                    //remove message event from queue (nothing to save in the db)
+                    _waitingForResponse.erase(waiting);
+                    return;
+
                 //next codes are not expected
                 case OkCode::authenticated:
                 case OkCode::retrieved:
@@ -406,7 +570,7 @@ void client::ProtocolManager::receive() {
                 _db->remove(event.getElement().getRelativePath()); //delete element from db
 
             //remove message event from queue (it was successful)
-            _waitingForResponse.pop();
+            _waitingForResponse.erase(waiting);
 
             break;
         }
@@ -427,7 +591,7 @@ void client::ProtocolManager::receive() {
                 case ErrCode::notADir:
                 case ErrCode::unexpected:
                     //skip the event message that caused the error and go on
-                    _waitingForResponse.pop();
+                    _waitingForResponse.erase(waiting);
 
                     Message::print(std::cerr, "WARNING", "Server reported an error in one sent message",
                                    "It will be skipped");
@@ -449,7 +613,7 @@ void client::ProtocolManager::receive() {
         case messages::ServerMessage_Type_VER:
             throw ProtocolManagerException("Version not supported", ProtocolManagerError::version);
 
-        case messages::ServerMessage_Type_NOOP:
+        case messages::ServerMessage_Type_NOOP: //(heartbeat responses are handled above)
         case messages::ServerMessage_Type_MKD:
         case messages::ServerMessage_Type_STOR:
         case messages::ServerMessage_Type_DATA:
@@ -460,13 +624,78 @@ void client::ProtocolManager::receive() {
     }
 }
 
+/**
+ * ProtocolManager measure method.
+ *  Used to measure the round trip time of a message when its response arrives, and to adapt the window once per
+ *  round trip: the messages queued beyond the bandwidth-delay product are estimated as the messages in flight times
+ *  (1 - minimum rtt / current rtt); the window grows (doubling at the start of the connection, then by 1) if the
+ *  queued messages are few and the window limited the sends, and shrinks if they are too many (the first time
+ *  straight to the measured bandwidth-delay product)
+ *
+ * @param stream stream of the message the response is for
+ */
+void client::ProtocolManager::_measure(uint64_t stream) {
+    auto now = std::chrono::steady_clock::now();    //time of the response
+
+    //if the window is full it limited the sends in this round trip
+    if(_waitingForResponse.size() >= _window)
+        _windowLimited = true;
+
+    _roundResponses++;
+
+    //if the message was timed update the round trip times
+    auto sent = _sentTimes.find(stream);
+    if(sent != _sentTimes.end()) {
+        double rtt = std::chrono::duration<double>(now - sent->second).count(); //round trip time of the message
+        _sentTimes.erase(sent);
+
+        _srtt = _srtt == 0 ? rtt : 0.875 * _srtt + 0.125 * rtt;
+        _minRtt = _minRtt == 0 ? rtt : std::min(_minRtt, rtt);
+        _roundRtt = _roundRtt == 0 ? rtt : std::min(_roundRtt, rtt);
+    }
+
+    double elapsed = std::chrono::duration<double>(now - _roundStart).count();  //duration of the round trip
+
+    //adapt the window once per round trip (if at least a message was timed)
+    if(_roundRtt == 0 || elapsed < _srtt)
+        return;
+
+    _throughput = _roundResponses / elapsed;
+
+    //messages queued beyond the bandwidth-delay product
+    double queued = static_cast<double>(_waitingForResponse.size()) * (1 - _minRtt / _roundRtt);
+
+    if(queued > WINDOW_BETA) {
+        if(_slowStart) {
+            //the window overshot: go back to the bandwidth-delay product (plus some margin)
+            _window = static_cast<unsigned int>(std::ceil(_throughput * _minRtt)) + WINDOW_ALPHA;
+            _slowStart = false;
+        }
+        else
+            _window--;
+    }
+    else if(queued < WINDOW_ALPHA && _windowLimited)
+        _window = _slowStart ? _window * 2 : _window + 1;
+
+    _window = std::max(_minResponseWaiting, std::min(_window, _maxResponseWaiting));
+
+    //start the next round trip
+    _roundStart = now;
+    _roundRtt = 0;
+    _roundResponses = 0;
+    _windowLimited = false;
+}
+
 /**
  * ProtocolManager retrieveFiles method.
- *  Used to ask the server to send all the user's requested files to this client
+ *  Used to ask the server to send all the user's requested files to this client; the files already present in the
+ *  destination folder (with the same path, size and last write time, and hash if verify is set) are not sent again,
+ *  so a retrieve interrupted (or done before) only has to get the files it is missing
  *
  * @param macAddress optional user's mac address to retrieve data about
  * @param all boolean indicating if to retrieve all user's data or just data related to the optionally provided mac
  * @param destFolder destination folder where to put the user's files
+ * @param verify boolean indicating if to check also the hash of the files already present in the destination folder
  *
  * @throws ProtocolManagerException:
  *  <b>version</b> if the server is using a different protocol version
@@ -481,18 +710,25 @@ void client::ProtocolManager::receive() {
  *
  * @author Michele Crepaldi s269551
  */
-void client::ProtocolManager::retrieveFiles(const std::string &macAddress, bool all, const std::string &destFolder){
-    //send RETR message to the server
-    _send_RETR(macAddress, all);
-
+void client::ProtocolManager::retrieveFiles(const std::string &macAddress, bool all, const std::string &destFolder,
+                                            bool verify){
     std::string tempDir = destFolder  + TEMP_RELATIVE_PATH; //temporary folder path (where to put temporary files)
 
+    //files partially received in a previous (interrupted) RETR
+    std::vector<PartialFile> partials = PartialFile::list(tempDir);
+
+    //digests of the files already present in the destination folder (the server will not send them again)
+    std::vector<uint64_t> present = _present(destFolder, tempDir, verify);
+
+    //send RETR message to the server (the server will resume the partial files and skip the present ones)
+    _send_RETR(macAddress, all, partials, present, verify);
+
     //loop until server indicates the end of the data transfer
     while(true) {
         //get server response
 
-        std::string server_temp = _s.recvString();      //server response message
-        _serverMessage.ParseFromString(server_temp);    //get serverMessage protobuf parsing the response message
+        _s.recvString(_messageBuffer);                  //server response message
+        _serverMessage.ParseFromString(_messageBuffer); //get serverMessage protobuf parsing the response message
 
         //check server message version
         if (_protocolVersion != _serverMessage.version())
@@ -520,6 +756,10 @@ void client::ProtocolManager::retrieveFiles(const std::string &macAddress, bool
                 //handle ok code based on its value
                 switch (static_cast<client::OkCode>(okCode)) {
                     case OkCode::retrieved:
+                        //remove the partial files the server did not resume (they are not needed anymore)
+                        for(auto &partial : PartialFile::list(tempDir))
+                            partial.remove();
+
                         Message::print(std::cout, "SUCCESS", "RETR",
                                        "Saved all your data to " + destFolder);
                         return;
@@ -529,6 +769,7 @@ void client::ProtocolManager::retrieveFiles(const std::string &macAddress, bool
                     case OkCode::notThere:
                     case OkCode::removed:
                     case OkCode::authenticated:
+                    case OkCode::canceled:
                     default:
                         throw ProtocolManagerException("Unexpected OK code",
                                                        ProtocolManagerError::unexpectedCode);
@@ -586,11 +827,14 @@ void client::ProtocolManager::retrieveFiles(const std::string &macAddress, bool
  * @author Michele Crepaldi s269551
  */
 void client::ProtocolManager::_send_clientMessage(){
-    //string representation of the clientMessage protobuf
-    std::string tmp = _clientMessage.SerializeAsString();
+    //set the stream the message belongs to
+    _clientMessage.set_stream(_stream);
+
+    //string representation of the clientMessage protobuf (reusing the message buffer memory)
+    _clientMessage.SerializeToString(&_messageBuffer);
 
     //send response message
-    _s.sendString(tmp);
+    _s.sendString(_messageBuffer);
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
     _clientMessage.Clear();
@@ -598,15 +842,18 @@ void client::ProtocolManager::_send_clientMessage(){
 
 /**
  * ProtocolManager send AUTH message method.
- *  It will set the clientMessage protobuf version, type, username, mac address and password and then send it
+ *  It will set the clientMessage protobuf version, type, username, mac address, password and session token and then
+ *  send it
  *
  * @param username username of the user who wants to authenticate
  * @param macAddress mac address of the user's machine
  * @param password password of the user who wants to authenticate
+ * @param token session token got in a previous connection (empty if none)
  *
  * @author Michele Crepaldi s269551
  */
-void client::ProtocolManager::_send_AUTH(const std::string &username, const std::string &macAddress, const std::string &password){
+void client::ProtocolManager::_send_AUTH(const std::string &username, const std::string &macAddress,
+                                         const std::string &password, const std::string &token){
     _clientMessage.set_version(_protocolVersion);
     _clientMessage.set_type(messages::ClientMessage_Type_AUTH);
 
@@ -614,6 +861,7 @@ void client::ProtocolManager::_send_AUTH(const std::string &username, const std:
     _clientMessage.set_username(username);
     _clientMessage.set_macaddress(macAddress);
     _clientMessage.set_password(password);
+    _clientMessage.set_token(token);
 
     _send_clientMessage();
 }
@@ -659,21 +907,24 @@ void client::ProtocolManager::_send_DELE(Directory_entry &element){
 
 /**
  * ProtocolManager send STOR message method.
- *  It will set the clientMessage protobuf version, type, path, file size, last write time and hash and then send it
+ *  It will set the clientMessage protobuf version, type, path, file size, last write time, hash and offset and then
+ *  send it
  *
  * @param element Directory_entry element (file) to store on server
+ * @param offset offset from which the file will be sent (as confirmed by the server in the SEND message)
  *
  * @author Michele Crepaldi s269551
  */
-void client::ProtocolManager::_send_STOR(Directory_entry &element){
+void client::ProtocolManager::_send_STOR(Directory_entry &element, uintmax_t offset){
     _clientMessage.set_version(_protocolVersion);
     _clientMessage.set_type(messages::ClientMessage_Type_STOR);
 
-    //set path, file size, last write time and hash
+    //set path, file size, last write time, hash and offset
     _clientMessage.set_path(element.getRelativePath());
     _clientMessage.set_filesize(element.getSize());
     _clientMessage.set_lastwritetime(element.getLastWriteTime());
     _clientMessage.set_hash(element.getHash().get().first, element.getHash().get().second);
+    _clientMessage.set_offset(offset);
 
     _send_clientMessage();
 }
@@ -687,7 +938,7 @@ void client::ProtocolManager::_send_STOR(Directory_entry &element){
  *
  * @author Michele Crepaldi s269551
  */
-void client::ProtocolManager::_send_DATA(char *buff, uint64_t len){
+void client::ProtocolManager::_send_DATA(const char *buff, uint64_t len){
     _clientMessage.set_version(_protocolVersion);
     _clientMessage.set_type(messages::ClientMessage_Type_DATA);
 
@@ -734,6 +985,29 @@ void client::ProtocolManager::_send_RMD(Directory_entry &element){
     _send_clientMessage();
 }
 
+/**
+ * ProtocolManager send CANCEL message method.
+ *  It will set the clientMessage protobuf version and type and then send it
+ */
+void client::ProtocolManager::_send_CANCEL(){
+    _clientMessage.set_version(_protocolVersion);
+    _clientMessage.set_type(messages::ClientMessage_Type_CANCEL);
+
+    _send_clientMessage();
+}
+
+/**
+ * ProtocolManager send NOOP message method.
+ *  It will set the clientMessage protobuf version and type and then send it (it does not belong to any operation)
+ */
+void client::ProtocolManager::_send_NOOP(){
+    _clientMessage.set_version(_protocolVersion);
+    _clientMessage.set_type(messages::ClientMessage_Type_NOOP);
+
+    _stream = 0;    //heartbeats do not belong to any operation
+    _send_clientMessage();
+}
+
 /**
  * ProtocolManager composeMessage method.
  *  Used to compose a clientMessage from an event
@@ -766,8 +1040,12 @@ void client::ProtocolManager::_composeMessage(Event &event) {
                 break;
 
             case FileSystemStatus::storeSent:
+                //the file transfer was interrupted -> probe the file again, the server will answer with the
+                //offset from which to resume it
+                Message::print(std::cout, "EVENT", "File transfer interrupted",
+                               event.getElement().getRelativePath());
 
-                _send_STOR(event.getElement()); //send STOR + DATA(+) messages
+                _send_PROB(event.getElement()); //send PROB message
                 break;
 
             default:    //I should never arrive here
@@ -803,72 +1081,164 @@ void client::ProtocolManager::_composeMessage(Event &event) {
 }
 
 /**
- * ProtocolManager sendFile method.
- *  Used to send a file to the server through messages
+ * ProtocolManager startFile method.
+ *  Used to start sending a file to the server: it sends the STOR message (confirming the offset) and opens the file;
+ *  if the file changed after the event the transfer is canceled right away (with a CANCEL message in place of the
+ *  DATA messages)
  *
- * @param element Directory_entry representing the file to send
+ * @param upload file to send
  *
- * @throws ProtocolManagerException:
- *  <b>client</b> if the file is not present any more in the system or if the file could not be opened
+ * @return true if the file DATA messages can be sent (with _sendSlice), false if the transfer was canceled
+ */
+bool client::ProtocolManager::_startFile(Upload &upload) {
+    Directory_entry &element = upload.element;  //file to send
+
+    //send the STOR message (confirming the offset)
+    _send_STOR(element, upload.offset);
+
+    //open input file (from the beginning, since the part the server already has is still needed for the hash),
+    //the next blocks are read ahead while the current one is sent
+    upload.file = std::make_unique<FileReader>(element.getAbsolutePath(), _maxDataChunkSize, _readAheadBuffers);
+
+    //if the file could not be opened or its size is not the expected one it was deleted or modified after the event
+    if(!upload.file->is_open() || stat(element.getAbsolutePath().data(), &upload.initial) != 0 ||
+            static_cast<uintmax_t>(upload.initial.st_size) != element.getSize()) {
+        Message::print(std::cerr, "WARNING", "File changed, transfer canceled", element.getRelativePath());
+
+        //cancel the transfer
+        _send_CANCEL();
+        return false;
+    }
+
+    upload.totRead = upload.offset; //the part the server already has is not sent again
+
+    upload.message = Message{"SENDING", "Sending file:", element.getRelativePath()};
+    std::cout << upload.message;
+
+    return true;
+}
+
+/**
+ * ProtocolManager sendSlice method.
+ *  Used to send the next slice (at most data_chunks_per_slice blocks) of a file to the server through DATA messages;
+ *  the file is hashed while it is read, and its size and last write time are checked after every block read: if the
+ *  file changed (or if its hash is not the expected one) the transfer is canceled (with a CANCEL message in place of
+ *  the remaining DATA messages)
  *
- * @author Michele Crepaldi s269551
+ * @param upload file being sent
+ *
+ * @return true if the file transfer is done (the last DATA message or the CANCEL message was sent), false otherwise
  */
-void client::ProtocolManager::_sendFile(Directory_entry &element) {
-    std::ifstream file;             //file to send
-    char buff[_maxDataChunkSize];   //buffer used to read from file and send to socket
+bool client::ProtocolManager::_sendSlice(Upload &upload) {
+    Directory_entry &element = upload.element;  //file being sent
 
-    //the file should exist and be the same as expected since I checked these things before calling _sendFile
+    const char *block;          //current block
+    size_t len;                 //current block length
 
-    //open input file
-    file.open(element.getAbsolutePath(), std::ios::in | std::ios::binary);
+    for(unsigned int i = 0; i < _dataChunksPerSlice; i++) {
+        bool last = !upload.file->read(block, len); //read file in max_data_chunk_size-wide blocks
+        upload.hm.update(block, len);   //update the hash with the block
 
-    if(file.is_open()){
-        int64_t totRead = 0;    //total bytes read
+        //if the file changed there is no point in sending the rest of it
+        bool changed = _changed(element, upload.initial);
 
-        Message message{"SENDING", "Sending file:", element.getRelativePath()};
-        std::cout << message;
+        //when the whole file was read also check its hash is the expected one
+        if(last && !changed) {
+            Hash hash = upload.hm.get();    //file hash
+            changed = hash != element.getHash();
+        }
 
-        while(file.read(buff, _maxDataChunkSize)) { //read file in max_data_chunk_size-wide blocks
-            totRead += file.gcount();   //update total bytes read
-            _send_DATA(buff, file.gcount());    //send the data block
+        if(changed) {
+            std::cout << std::endl;
+            Message::print(std::cerr, "WARNING", "File changed while sending it, transfer canceled",
+                           element.getRelativePath());
 
-            //update the progress bar in the message
-            message.update(std::floor((float)100.0 * totRead/element.getSize()));
-            std::cout << message;
+            //cancel the transfer (in place of the remaining data blocks)
+            _send_CANCEL();
+            return true;
         }
 
-        _clientMessage.set_last(true);   //mark the last data block
+        //send only the part of the block after offset (the last block is always sent, it marks the end of the file)
+        if(last || upload.position + len > upload.offset) {
+            //bytes of the block the server already has
+            size_t skip = upload.position < upload.offset ? upload.offset - upload.position : 0;
 
-        totRead += file.gcount();   //update total bytes read
-        _send_DATA(buff, file.gcount()); //send the last data block
+            if(last)
+                _clientMessage.set_last(true);  //mark the last data block
 
-        //update the progress bar in the message
-        if(totRead != 0)
-        {
-            message.update(std::floor((float)100.0 * totRead / element.getSize()));
+            upload.totRead += len - skip;   //update total bytes read
+            _send_DATA(block + skip, len - skip);   //send the data block
+
+            //update the progress bar in the message
+            if(upload.totRead != 0)
+                upload.message.update(std::floor((float)100.0 * upload.totRead / element.getSize()));
+            else
+                upload.message.update(100);
+
+            std::cout << upload.message;
         }
-        else
-            message.update(100);
 
-        std::cout << message << std::endl;
+        upload.position += len;
 
-        //close the input file
-        file.close();
+        if(last) {
+            std::cout << std::endl;
+            return true;
+        }
     }
-    else
-        throw ProtocolManagerException("Could not open file", ProtocolManagerError::client);
+
+    return false;
+}
+
+/**
+ * ProtocolManager changed method.
+ *  Used to know if a file changed (size or last write time) since the start of its transfer
+ *
+ * @param element Directory_entry representing the file being sent
+ * @param initial file info got at the start of the transfer
+ *
+ * @return true if the file changed (or it does not exist anymore), false otherwise
+ */
+bool client::ProtocolManager::_changed(Directory_entry &element, struct stat &initial) {
+    struct stat current{};  //current file info
+
+    if(stat(element.getAbsolutePath().data(), &current) != 0)
+        return true;
+
+    return current.st_size != initial.st_size || current.st_mtim.tv_sec != initial.st_mtim.tv_sec ||
+            current.st_mtim.tv_nsec != initial.st_mtim.tv_nsec;
 }
 
 /**
  * ProtocolManager send RETR message method.
- *  It will set the clientMessage protobuf version, type, mac address and all boolean and then send it
+ *  It will set the clientMessage protobuf version, type, mac address, all boolean, the files to resume and the digests
+ *  of the files already present and then send it; the digests are split among more RETR messages if they are too
+ *  many for one (all of them but the last one have the last boolean set to false)
  *
  * @param macAddress mac address to retrieve the data about from server
  * @param all if to retrieve all the data about the user or only the ones related to the user-mac pair
+ * @param partials files partially received in a previous RETR (the server will resume them)
+ * @param present digests of the files already present in the destination folder (the server will skip them)
+ * @param hashed whether the present digests include the files hashes
  *
  * @author Michele Crepaldi s269551
  */
-void client::ProtocolManager::_send_RETR(const std::string &macAddress, bool all){
+void client::ProtocolManager::_send_RETR(const std::string &macAddress, bool all, std::vector<PartialFile> &partials,
+                                         std::vector<uint64_t> &present, bool hashed){
+    size_t sent = 0;    //number of present digests sent so far
+
+    //send the digests which do not fit in the last RETR message
+    while(present.size() - sent > RETR_PRESENT_BATCH){
+        _clientMessage.set_version(_protocolVersion);
+        _clientMessage.set_type(messages::ClientMessage_Type_RETR);
+
+        _clientMessage.mutable_present()->Add(present.begin() + sent, present.begin() + sent + RETR_PRESENT_BATCH);
+        _clientMessage.set_hashed(hashed);
+        _clientMessage.set_last(false); //other RETR messages will follow
+
+        sent += RETR_PRESENT_BATCH;
+        _send_clientMessage();
+    }
+
     _clientMessage.set_version(_protocolVersion);
     _clientMessage.set_type(messages::ClientMessage_Type_RETR);
 
@@ -876,15 +1246,80 @@ void client::ProtocolManager::_send_RETR(const std::string &macAddress, bool all
     _clientMessage.set_macaddress(macAddress);
     _clientMessage.set_all(all);
 
+    //set the files to resume (path, hash and offset of the last good chunk)
+    for(auto &partial : partials){
+        uintmax_t offset = partial.recover();   //offset from which to resume the file
+        if(offset == 0)
+            continue;
+
+        auto resume = _clientMessage.add_resume();
+        resume->set_path(partial.getKey());
+        resume->set_hash(partial.getHash().get().first, partial.getHash().get().second);
+        resume->set_offset(offset);
+    }
+
+    //set the remaining present digests
+    _clientMessage.mutable_present()->Add(present.begin() + sent, present.end());
+    _clientMessage.set_hashed(hashed);
+    _clientMessage.set_last(true);
+
     _send_clientMessage();
 }
 
+/**
+ * ProtocolManager present method.
+ *  Used to compute the digests of the files already present in the destination folder (from their path, size and
+ *  last write time, and hash if requested); the temporary folder is skipped
+ *
+ * @param destFolder destination folder where to put the user's files
+ * @param temporaryPath temporary path where to put temporary files
+ * @param hashed whether to include the files hashes in the digests (reading all the files)
+ *
+ * @return digests of the files already present
+ */
+std::vector<uint64_t> client::ProtocolManager::_present(const std::string &destFolder,
+                                                        const std::string &temporaryPath, bool hashed){
+    std::vector<uint64_t> present;
+
+    //if the destination folder does not exist yet there is nothing in it
+    if(!std::filesystem::is_directory(destFolder))
+        return present;
+
+    for(auto it = std::filesystem::recursive_directory_iterator(destFolder);
+            it != std::filesystem::recursive_directory_iterator(); ++it){
+
+        //skip the temporary folder (the partial files are resumed instead)
+        if(it->path() == temporaryPath){
+            it.disable_recursion_pending();
+            continue;
+        }
+
+        if(!it->is_regular_file())
+            continue;
+
+        //element path relative to the destination folder (as it is sent by the server)
+        std::string path = "/" + it->path().lexically_relative(destFolder).generic_string();
+
+        //element (its last write time is read from the filesystem, and its hash is computed only if requested)
+        Directory_entry element = hashed ? Directory_entry{destFolder, *it} :
+                Directory_entry{destFolder, path, it->file_size(), "file", "", Hash()};
+
+        std::string lastWriteTime = hashed ? element.getLastWriteTime() : element.get_time_from_file();
+
+        present.push_back(Directory_entry::digest(path, it->file_size(), lastWriteTime,
+                                                  hashed ? element.getHash().str() : ""));
+    }
+
+    return present;
+}
+
 /**
  * ProtocolManager storeFile method.
  *  Used to interpret the STOR message sent by server and to get all the DATA messages for a file;
- *  it stores the file in a temporary directory with a temporary random name; when the
- *  file transfer is done then it checks the file was correctly saved and moves it to
- *  the final destination (overwriting any old existing file).
+ *  it stores the file in a temporary directory as a partial file (named after its path, so that an interrupted
+ *  transfer can be resumed by the next RETR); when the file transfer is done then it checks the file was correctly
+ *  saved and moves it to the final destination (overwriting any old existing file). A file different than expected
+ *  (its hash is the one stored by the server when it received it) is not stored, and the retrieve goes on.
  *
  * @param destFolder destination folder where to put files
  * @param temporaryPath temporary path where to put temporary files
@@ -894,8 +1329,6 @@ void client::ProtocolManager::_send_RETR(const std::string &macAddress, bool all
  * @throws ProtocolManagerException:
  *  <b>internal</b> if the server had an error and the file transfer was interrupted by another message type
  * @throws ProtocolManagerException:
- *  <b>internal</b> if the stored file has a different dimension than expected
- * @throws ProtocolManagerException:
  *  <b>internal</b> if errors were found in the server message (validation failed)
  *
  * @author Michele Crepaldi s269551
@@ -906,6 +1339,7 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
     uintmax_t size = _serverMessage.filesize();                 //file size
     std::string lastWriteTime = _serverMessage.lastwritetime(); //file last write time
     Hash h = Hash(_serverMessage.hash());                       //file hash
+    uintmax_t offset = _serverMessage.offset();                 //offset from which the server sends the file
 
     //it is more efficient to clear the serverMessage protobuf than creating a new one
     _serverMessage.Clear();
@@ -927,11 +1361,6 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
 
     Message::print(std::cout, "STOR", expected.getRelativePath(), "in " + destFolder);
 
-    //create a random temporary name for the file
-
-    RandomNumberGenerator rng;  //random number generator
-    std::string tmpFileName = "/" + rng.getHexString(_tempNameSize) + ".tmp";   //temporary file name
-
     //check if the temporary folder already exists
     bool tmpPathExists = std::filesystem::exists(temporaryPath);
 
@@ -940,14 +1369,18 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
         //create all the directories (that do not already exist) up to the temporary path
         std::filesystem::create_directories(temporaryPath);
 
-    std::ofstream temporaryFile; //temporary file
+    //partial (temporary) file, named after the file path
+    PartialFile temporaryFile{temporaryPath, path, h};
+
+    //if the server is resuming a previous transfer, the data up to the offset must still be there
+    if(offset != 0 && temporaryFile.recover() < offset)
+        throw ProtocolManagerException("Resume offset not available.", ProtocolManagerError::serverMessage);
 
-    //create the temporary file
-    temporaryFile.open(temporaryPath + tmpFileName, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-    if(temporaryFile.is_open()){
+    //create (or re-open at offset) the temporary file
+    if(temporaryFile.open(offset)){
         try {
             bool loop = true;
-            int64_t totRecv = 0;    //total number of bytes received from server
+            int64_t totRecv = offset;   //total number of bytes received from server (or already there)
 
             Message msg{"RECV", "Receiving file:", expected.getRelativePath()};
             std::cout << msg;
@@ -955,21 +1388,18 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
             while(loop){
                 //receive message from server
 
-                std::string message = _s.recvString();      //message got from client
+                _s.recvString(_messageBuffer);  //message got from server
 
-                //convert message to clientMessage protobuf
-                _serverMessage.ParseFromString(message);
+                //convert message to serverMessage protobuf
+                _serverMessage.ParseFromString(_messageBuffer);
 
                 //check message version
                 if (_serverMessage.version() != _protocolVersion) { //if the version is different
                     //it is more efficient to clear the clientMessage protobuf than creating a new one
                     _serverMessage.Clear();
 
-                    //close the temporary file
-                    temporaryFile.close();
-
-                    //delete the temporary file
-                    std::filesystem::remove(temporaryPath + tmpFileName);
+                    //close and delete the temporary file
+                    temporaryFile.remove();
 
                     //throw exception
                     throw ProtocolManagerException("Server is using a different version",
@@ -981,11 +1411,8 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
                     //it is more efficient to clear the clientMessage protobuf than creating a new one
                     _serverMessage.Clear();
 
-                    //close the temporary file
-                    temporaryFile.close();
-
-                    //delete the temporary file
-                    std::filesystem::remove(temporaryPath + tmpFileName);
+                    //close and delete the temporary file
+                    temporaryFile.remove();
 
                     //no DATA message with "last" boolean set was encountered before this message, error!
 
@@ -999,7 +1426,7 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
                 //data got from the clientMessage protobuf
                 std::string data = _serverMessage.data();
 
-                //write the data to temporary file
+                //write the data (chunk) to temporary file
                 temporaryFile.write(data.data(), data.size());
 
                 totRecv += data.size(); //update total bytes received
@@ -1018,7 +1445,8 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
 
             std::cout << std::endl;
         }
-        //in case of socket exceptions while transferring the file I need to delete the temporary file
+        //in case of socket exceptions while transferring the file I keep the temporary file (with the chunks
+        //received so far), so that the next RETR can resume the transfer
         catch (SocketException &e) {
 
             std::cout << std::endl;
@@ -1026,18 +1454,17 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
             //close the temporary file
             temporaryFile.close();
 
-            //delete the temporary file
-            std::filesystem::remove(temporaryPath + tmpFileName);
-
             //re-throw the exception
             throw;
         }
 
-        //close the temporary file
-        temporaryFile.close();
+        //close the temporary file (and check all the data was written)
+        bool written = temporaryFile.close();
 
-        //Directory entry which represents the newly created file
-        Directory_entry newFile{temporaryPath, std::filesystem::directory_entry(temporaryPath + tmpFileName)};
+        //Directory entry which represents the newly created file (its size and hash were computed while receiving
+        //the data, so there is no need to read the file again)
+        Directory_entry newFile{temporaryPath, "/" + std::filesystem::path(temporaryFile.getPath()).filename().string(),
+                                temporaryFile.getSize(), "file", "", temporaryFile.getDataHash()};
 
         //change last write time for the temporary file to what was expected
         newFile.set_time_to_file(expected.getLastWriteTime());
@@ -1046,16 +1473,18 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
         Hash hash = newFile.getHash();
 
         //check if the newly created (temporary) file properties match the expected ones
-        if(newFile.getSize() != expected.getSize() || hash != expected.getHash() ||
+        if(!written || newFile.getSize() != expected.getSize() || hash != expected.getHash() ||
                 newFile.getLastWriteTime() != expected.getLastWriteTime()) {
 
-            //if the temporary file is not as we expected
+            //if the temporary file is not as we expected (for example the server copy is corrupted: the server
+            //does not verify the files it trusts before sending them), reject just this file
 
             //delete the temporary file
-            std::filesystem::remove(temporaryPath + tmpFileName);
+            temporaryFile.remove();
 
-            throw ProtocolManagerException("Stored file is different than expected.",
-                                           ProtocolManagerError::serverMessage);
+            Message::print(std::cerr, "ERROR", expected.getRelativePath(),
+                           "is different than expected, it will not be stored");
+            return;
         }
 
         //get the file parent path from the expected file name
@@ -1085,7 +1514,10 @@ void client::ProtocolManager::_storeFile(const std::string &destFolder, const st
 
         //If we are here then the file was successfully transferred and its copy on the server is as expected
         //it can be moved to the final destination
-        std::filesystem::rename(temporaryPath + tmpFileName, expected.getAbsolutePath());
+        std::filesystem::rename(temporaryFile.getPath(), expected.getAbsolutePath());
+
+        //the transfer is complete, remove what is left of the partial file (its checksums)
+        temporaryFile.remove();
 
         //if the parent directory is not the server base path
         if(parent.getAbsolutePath() != destFolder)
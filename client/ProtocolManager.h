@@ -10,9 +10,18 @@
 
 #include "../myLibraries/Socket.h"
 #include "../myLibraries/Directory_entry.h"
-#include "../myLibraries/Circular_vector.h"
+#include "../myLibraries/PartialFile.h"
+#include "../myLibraries/FileReader.h"
+#include "../myLibraries/Hash.h"
+#include "../myLibraries/Message.h"
 #include "../Event.h"
 #include <messages.pb.h>
+#include <sys/stat.h>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
 
 
 /**
@@ -102,7 +111,10 @@ namespace client {
         authenticated,
 
         //all the user requested data was sent
-        retrieved
+        retrieved,
+
+        //file transfer canceled by the client (the file was modified while it was being sent)
+        canceled
     };
 
     /*
@@ -116,6 +128,15 @@ namespace client {
      *  It also has a list of sent messages without response in order to be able to re-send them
      *  (so without missing events) in case of errors.
      *
+     *  <p> Every operation has its own stream id (carried by its messages and by the server replies), so the replies
+     *  are matched by id, and the DATA messages of several files can be interleaved with each other and with the
+     *  other messages (which have priority over the file data).
+     *
+     *  <p> The number of messages waiting for a response (window) adapts to the connection: the round trip time of
+     *  the event messages is measured and compared with the minimum one, and the difference tells how many messages
+     *  are queued (at the server or in the network) beyond the bandwidth-delay product; the window grows while
+     *  there are few queued messages (doubling at the start of the connection) and shrinks when there are too many.
+     *
      * @author Michele Crepaldi s269551
      */
     class ProtocolManager {
@@ -126,41 +147,97 @@ namespace client {
         ProtocolManager& operator=(ProtocolManager &&) = delete;        //move assignment deleted
         ~ProtocolManager() = default;   //default destructor
 
-        //constructor with the socket, waiting messages queue, and protocol version
-        ProtocolManager(Socket &s, Circular_vector<Event> &waitingForResponse, int ver);
+        //constructor with the socket, waiting messages (by stream), and protocol version
+        ProtocolManager(Socket &s, std::map<uint64_t, Event> &waitingForResponse, int ver);
 
-        //authenticate method with username, password and mac address
-        void authenticate(const std::string &username, const std::string &password, const std::string &macAddress);
+        //authenticate method with username, password, mac address and session token (kept between connections)
+        void authenticate(const std::string &username, const std::string &password, const std::string &macAddress,
+                          std::string &token);
 
         bool canSend() const;       //boolean "can it send event messages" method
         bool isWaiting() const;     //boolean "is waiting for responses" method
+        bool isSending() const;     //boolean "has file data to send" method
         int nWaiting() const;       //number of event messages waiting for responses getter method
+        unsigned int getWindow() const; //window (maximum number of messages waiting for a response) getter method
+        double getRtt() const;          //smoothed round trip time (in milliseconds) getter method
+        double getThroughput() const;   //throughput (responses per second) getter method
 
         void recoverFromError();    //recover from error method
         bool send(Event &event);    //send event message to server method
+        void sendData();            //send the next slice of file data to server method
+        void heartbeat();           //send heartbeat (NOOP) message to server method
         void receive();             //receive response message from server method
 
-        //retrieve the files from server method (with mac, all boolean and destination folder)
-        void retrieveFiles(const std::string &macAddress, bool all, const std::string &destFolder);
+        //retrieve the files from server method (with mac, all boolean, destination folder and verify boolean)
+        void retrieveFiles(const std::string &macAddress, bool all, const std::string &destFolder, bool verify);
 
     private:
+        /**
+         * Upload struct. A file being sent to the server: its DATA messages are sent a slice at a time (by sendData),
+         *  so that the server responses can be read in between
+         */
+        struct Upload {
+            //constructor with the file to send, the offset from which to send it and the stream of the transfer
+            Upload(Directory_entry element, uintmax_t offset, uint64_t stream):
+                    element(std::move(element)), offset(offset), stream(stream){
+            }
+
+            Directory_entry element;            //file to send
+            uintmax_t offset;                   //offset from which to send the file (the server has the data before it)
+            uint64_t stream;                    //stream of the file transfer
+            std::unique_ptr<FileReader> file;   //file reader (opened when the transfer starts)
+            struct stat initial{};              //file info when the transfer started
+            HashMaker hm;                       //hash of the file (computed while reading it)
+            uintmax_t position = 0;             //position of the next block in the file
+            int64_t totRead = 0;                //total bytes read (including the part the server already has)
+            Message message;                    //progress message
+            bool stale = false;                 //whether a newer version of the file was queued after this one
+        };
+
         Socket &_s; //socket associated to the protocol manager
 
         std::shared_ptr<Database> _db;  //shared pointer to the Database object
 
         messages::ClientMessage _clientMessage; //protocol buffer message to use to get messages from client
         messages::ServerMessage _serverMessage; //protocol buffer message to use to reply to client
+        std::string _messageBuffer;             //(serialized) message buffer, reused for every message
 
         std::string _path_to_watch; //path watched by the client (the same as used by FileSystemWatcher)
 
-        Circular_vector<Event> &_waitingForResponse; //event messages waiting for a response queue (circular vector)
+        std::map<uint64_t, Event> &_waitingForResponse; //event messages waiting for a response (by stream)
+        uint64_t _stream;       //stream of the message being sent
+        uint64_t _nextStream;   //stream of the next operation
 
         int _protocolVersion;   //client's protocol version
 
-        unsigned int _tempNameSize;     //size of the temporary files name
         unsigned int _maxDataChunkSize; //maximum size of sent data chunk
+        unsigned int _readAheadBuffers; //number of file blocks read ahead while sending a file
+        unsigned int _dataChunksPerSlice;   //number of DATA messages sent in a row (by sendData)
+        unsigned int _minResponseWaiting;   //minimum (and initial) window
+        unsigned int _maxResponseWaiting;   //maximum window
+        unsigned int _parallelUploads;      //number of files sent at the same time
+
+        std::deque<std::unique_ptr<Upload>> _uploads;   //files to send (the first parallel_uploads are being sent)
+
+        //adaptive window of the messages waiting for a response
+        unsigned int _window;   //current window (maximum number of messages waiting for a response)
+        bool _slowStart;        //whether the window is still doubling (no queueing detected yet)
+        bool _windowLimited;    //whether the window was full in the current round trip (so it limited the sends)
+
+        bool _heartbeatWaiting; //whether the last heartbeat is still waiting for a response
+
+        //send times of the event messages being timed (by stream); the resent ones are not timed
+        std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> _sentTimes;
+
+        double _srtt;       //smoothed round trip time (seconds)
+        double _minRtt;     //minimum round trip time (seconds), the one without queueing
+        double _roundRtt;   //minimum round trip time in the current round trip (seconds)
+        double _throughput; //responses per second (measured in the last round trip)
+        unsigned int _roundResponses;   //responses received in the current round trip
+        std::chrono::steady_clock::time_point _roundStart; //start of the current round trip
 
         void _send_clientMessage();     //send clientMessage method
+        void _measure(uint64_t stream); //measure the round trip time of a message (and adapt the window) method
 
         /*
          * +-----------------------------------------------------------------------------------------------------------+
@@ -170,18 +247,23 @@ namespace client {
         //send message methods for the normal usage
 
         //send AUTH message method
-        void _send_AUTH(const std::string &username, const std::string &macAddress, const std::string &password);
+        void _send_AUTH(const std::string &username, const std::string &macAddress, const std::string &password,
+                        const std::string &token);
 
         void _send_PROB(Directory_entry &e);        //send PROB message method
         void _send_DELE(Directory_entry &e);        //send DELE message method
-        void _send_STOR(Directory_entry &e);        //send STOR message method
-        void _send_DATA(char *buff, uint64_t len);  //send DATA message method
+        void _send_STOR(Directory_entry &e, uintmax_t offset);  //send STOR message method
+        void _send_DATA(const char *buff, uint64_t len);    //send DATA message method
         void _send_MKD(Directory_entry &e);         //send MKD message method
         void _send_RMD(Directory_entry &e);         //send RMD message method
+        void _send_CANCEL();                        //send CANCEL message method
+        void _send_NOOP();                          //send NOOP (heartbeat) message method
 
         //client action performing methods
         void _composeMessage(Event &event);             //compose message method
-        void _sendFile(Directory_entry &element);   //send file method
+        bool _startFile(Upload &upload);    //start sending file method
+        bool _sendSlice(Upload &upload);    //send file slice method
+        bool _changed(Directory_entry &element, struct stat &initial);  //file changed (while sending) method
 
         /*
          * +-----------------------------------------------------------------------------------------------------------+
@@ -189,7 +271,13 @@ namespace client {
          */
 
         //send message methods for the special case of client retrieving data from server
-        void _send_RETR(const std::string &macAddress, bool all);   //send RETR message method
+        //send RETR message method
+        void _send_RETR(const std::string &macAddress, bool all, std::vector<PartialFile> &partials,
+                        std::vector<uint64_t> &present, bool hashed);
+
+        //digests of the files already present in the destination folder method
+        static std::vector<uint64_t> _present(const std::string &destFolder, const std::string &temporaryPath,
+                                              bool hashed);
 
         //special action performing methods for the special case of client retrieving data from server
         void _storeFile(const std::string &destFolder, const std::string &temporaryPath);   //store file method
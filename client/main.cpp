@@ -11,6 +11,9 @@
 #include <string>
 #include <iostream>
 #include <atomic>
+#include <cmath>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "../myLibraries/Socket.h"
 #include "../myLibraries/Circular_vector.h"
@@ -26,7 +29,7 @@
 #include "Config.h"
 
 
-#define VERSION 1
+#define VERSION 2
 
 #define SOCKET_TYPE SocketType::TLS
 #define CONFIG_FILE_PATH "../config.txt"
@@ -35,7 +38,7 @@ using namespace client;
 
 //function to handle the communication with the server
 void communicate(std::atomic<bool> &, std::atomic<bool> &, TS_Circular_vector<Event> &, const std::string &, int,
-                 const std::string &, const std::string &, bool);
+                 const std::string &, const std::string &, bool, bool, int);
 
 /**
  * main function
@@ -68,17 +71,22 @@ int main(int argc, char **argv) {
             //specify the CA certificate path to be used by the TLS socket
             Socket::specifyCertificates(config->getCAFilePath());
 
+            //specify the maximum size of the messages the client will accept
+            Socket::setMaxFrameSize(config->getMaxFrameSize());
+
             Socket client_socket{SOCKET_TYPE};  //client socket
 
             //connect to the server
             client_socket.connect(inputArgs.getServerIp(), stoi(inputArgs.getSeverPort()));
 
             //queue of messages sent and waiting for a server response
-            Circular_vector<Event> waitingForResponse{1};
+            std::map<uint64_t, Event> waitingForResponse;
             ProtocolManager pm(client_socket, waitingForResponse, VERSION); //protocol manager instance
 
+            std::string token;  //session token (none yet)
+
             //authenticate the client to the server (using username, password and mac address)
-            pm.authenticate(inputArgs.getUsername(), inputArgs.getPassword(), client_socket.getMAC());
+            pm.authenticate(inputArgs.getUsername(), inputArgs.getPassword(), client_socket.getMAC(), token);
 
             //send the RETR message and get all the data from server
 
@@ -90,7 +98,7 @@ int main(int argc, char **argv) {
 
                 //send RETR message with the specified mac (with all boolean to false),
                 //get all data from server and save it in destFolder
-                pm.retrieveFiles(inputArgs.getMac(), false, inputArgs.getDestFolder());
+                pm.retrieveFiles(inputArgs.getMac(), false, inputArgs.getDestFolder(), inputArgs.isVerifySet());
             }
             else if(inputArgs.isAllSet()){  //else if all option is set
                 //retrieve all the user's data
@@ -100,7 +108,7 @@ int main(int argc, char **argv) {
 
                 //send RETR message with the with all boolean to true (and no specified mac),
                 //get all data from server and save it in destFolder
-                pm.retrieveFiles("", true, inputArgs.getDestFolder());
+                pm.retrieveFiles("", true, inputArgs.getDestFolder(), inputArgs.isVerifySet());
             }
             else{   //otherwise
                 //retrieve all the user's data corresponding to the current mac address
@@ -112,7 +120,7 @@ int main(int argc, char **argv) {
 
                 //send RETR message with the current mac (with all boolean to false),
                 //get all data from server and save it in destFolder
-                pm.retrieveFiles(thisSocketMac, false, inputArgs.getDestFolder());
+                pm.retrieveFiles(thisSocketMac, false, inputArgs.getDestFolder(), inputArgs.isVerifySet());
             }
         }
 
@@ -133,27 +141,44 @@ int main(int argc, char **argv) {
         //atomic boolean used to force the file system watcher thread to stop
         std::atomic<bool> fileWatcher_stop = false;
 
+        //eventfd used to wake the communication thread up (out of its select) when a new event is queued
+        int wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(wakefd < 0)
+            throw SocketException("Cannot create eventfd", SocketError::create);
+
+        //wake function: wake the communication thread up (after pushing an event)
+        auto wake = [wakefd](){
+            uint64_t one = 1;   //eventfd increment
+            write(wakefd, &one, sizeof(one));
+        };
+
         //create communication thread and start it
         std::thread communication_thread(communicate, std::ref(communicate_stop),
                                          std::ref(fileWatcher_stop), std::ref(eventQueue),
                                          std::ref(inputArgs.getServerIp()), stoi(inputArgs.getSeverPort()),
                                          std::ref(inputArgs.getUsername()), std::ref(inputArgs.getPassword()),
-                                         inputArgs.isPersistSet());
+                                         inputArgs.isPersistSet(), inputArgs.isKeepAliveSet(), wakefd);
 
         //thread guard used to stop the communication thread when the file system watcher returns
         Thread_guard tg_communication(communication_thread, communicate_stop);
 
         //make the filesystem watcher retrieve previously saved data from db
-        fw.recoverFromDB(db.get(), [&eventQueue, &fileWatcher_stop](Directory_entry &element, FileSystemStatus status) -> bool {
+        fw.recoverFromDB(db.get(), [&eventQueue, &fileWatcher_stop, &wake](Directory_entry &element,
+                                                                           FileSystemStatus status) -> bool {
             //push event into event queue (to check the server has copies of all files we have in the db)
-            return eventQueue.push(std::move(Event(element, status)), fileWatcher_stop);
+            bool pushed = eventQueue.push(std::move(Event(element, status)), fileWatcher_stop);
+            wake();
+            return pushed;
         });
 
         //start monitoring the path to watch for changes and (in case of changes) run the provided function
-        fw.start([&eventQueue](Directory_entry &element, FileSystemStatus status) -> bool {
+        fw.start([&eventQueue, &wake](Directory_entry &element, FileSystemStatus status) -> bool {
             //try to push the event inside the event queue, immediately returning if the queue is full
             //non-pushed elements will be re-detected after some time and this process will be repeated
-            return eventQueue.tryPush(std::move(Event(element, status)));
+            bool pushed = eventQueue.tryPush(std::move(Event(element, status)));
+            if(pushed)
+                wake();
+            return pushed;
         }, fileWatcher_stop);
 
     }
@@ -305,12 +330,16 @@ int main(int argc, char **argv) {
  * @param server_port port of the server to connect to
  * @param username username of the current user
  * @param password password of the current user
+ * @param persist whether to retry the connection indefinitely
+ * @param keepAlive whether to keep the connection open (with heartbeats) when there are no changes
+ * @param wakefd eventfd signaled when a new event is queued (so that the select returns to send it)
  *
  * @author Michele Crepaldi
  */
 void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWatcher_stop,
                  TS_Circular_vector<Event> &eventQueue, const std::string &server_ip,
-                 int server_port, const std::string &username, const std::string &password, bool persist) {
+                 int server_port, const std::string &username, const std::string &password, bool persist,
+                 bool keepAlive, int wakefd) {
 
     int connectionCounter = 0;
 
@@ -320,8 +349,14 @@ void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWat
         //specify the CA certificate path to be used by the TLS socket
         Socket::specifyCertificates(config->getCAFilePath());
 
-        //queue of messages sent and waiting for a server response
-        Circular_vector<Event> waitingForResponse{config->getMaxResponseWaiting()};
+        //specify the maximum size of the messages the client will accept
+        Socket::setMaxFrameSize(config->getMaxFrameSize());
+
+        //messages sent and waiting for a server response (by stream)
+        std::map<uint64_t, Event> waitingForResponse;
+
+        //session token got from the server (presented when reconnecting, to skip the password check)
+        std::string token;
 
         fd_set read_fds;    //fd read set for select
         fd_set write_fds;   //fd write set for select
@@ -359,7 +394,7 @@ void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWat
                                 + std::to_string(connectionCounter) + " established");
 
                 //authenticate user
-                pm.authenticate(username, password, client_socket.getMAC());
+                pm.authenticate(username, password, client_socket.getMAC(), token);
 
                 //resend all unacknowledged messages (in case we just recovered from a connection error)
                 pm.recoverFromError();
@@ -367,28 +402,52 @@ void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWat
                 //total time waited without detecting changed in the folder and without receiving messages from server
                 unsigned int timeWaited = 0;
                 bool loop = true;   //loop condition
+                auto lastReport = std::chrono::steady_clock::now(); //time of the last window report
 
                 //loop until we are told to stop or loop condition becomes false
                 while (loop && !communicate_stop.load()) {
+                    //periodically print the window of messages waiting for a response, round trip time and throughput
+                    auto now = std::chrono::steady_clock::now();    //current time
+                    if(now - lastReport >= std::chrono::seconds(config->getStatsSeconds())) {
+                        Message::print(std::cout, "INFO", "Window", "size: " + std::to_string(pm.getWindow()) +
+                                        ", rtt: " + std::to_string(std::lround(pm.getRtt())) + " ms, throughput: " +
+                                        std::to_string(std::lround(pm.getThroughput())) + " msg/s");
+                        lastReport = now;
+                    }
+
                     //build fd sets
 
                     FD_ZERO(&read_fds);
                     FD_SET(client_socket.getSockfd(), &read_fds);
+                    FD_SET(wakefd, &read_fds);  //wake up when a new event is queued
                     FD_ZERO(&write_fds);
 
-                    //if we can send messages and there is something to send
-                    if (pm.canSend() && eventQueue.canGet())
+                    //if there is file data to send, or if we can send messages and there is something to send
+                    if (pm.isSending() || (pm.canSend() && eventQueue.canGet()))
                         //set up write_fd for socket
                         FD_SET(client_socket.getSockfd(), &write_fds);
 
-                    int maxfd = client_socket.getSockfd();  //select max fd
+                    int maxfd = std::max(client_socket.getSockfd(), wakefd);    //select max fd
                     struct timeval tv{};    //timeval struct for select
                     tv.tv_sec = config->getSelectTimeoutSeconds();  //set timeval for the select function
 
+                    //if the socket has already buffered (part of) the next message(s) the select would not see them
+                    bool buffered = client_socket.pending() > 0;
+                    if(buffered)
+                        tv.tv_sec = 0;  //do not wait
+
                     //select on read and write socket
 
                     int activity = select(maxfd + 1, &read_fds, &write_fds, nullptr, &tv);
 
+                    if(buffered && activity >= 0) {
+                        //there is something to read anyway
+                        if(!FD_ISSET(client_socket.getSockfd(), &read_fds)) {
+                            FD_SET(client_socket.getSockfd(), &read_fds);
+                            activity++;
+                        }
+                    }
+
                     switch (activity) {
                         case -1:
                             //I should never get here
@@ -409,6 +468,16 @@ void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWat
 
                             timeWaited += config->getSelectTimeoutSeconds();    //update the timeWaited variable
 
+                            //if the connection is kept alive send a heartbeat (instead of disconnecting)
+                            if (keepAlive) {
+                                if (timeWaited >= config->getHeartbeatSeconds()) {
+                                    pm.heartbeat();
+                                    timeWaited = 0;
+                                }
+
+                                break;
+                            }
+
                             //if the time already waited is greater than TimeoutSeconds
                             if (timeWaited >= config->getTimeoutSeconds()) {
                                 Message::print(std::cout, "INFO", "No changes detected",
@@ -424,14 +493,27 @@ void communicate(std::atomic<bool> &communicate_stop, std::atomic<bool> &fileWat
                             //reset timeout
                             timeWaited = 0;
 
+                            //if a new event was queued just reset the eventfd (it is sent below, or in the next
+                            //iteration, when the socket is writable)
+                            if (FD_ISSET(wakefd, &read_fds)) {
+                                uint64_t count; //eventfd counter
+                                read(wakefd, &count, sizeof(count));
+                            }
+
                             //if I have something to write and I can write
                             if (FD_ISSET(client_socket.getSockfd(), &write_fds)) {
-                                //send a message related to the next event in the event queue without removing it
-                                //from the queue; doing so in case of connection error I will not lose the event
-                                //and I will retry with the same one
-                                if(pm.send(eventQueue.front())) //if the event was sent (or was of an unsupported type)
-                                    //pop the last sent event from the queue
-                                    eventQueue.pop();
+                                //the other messages have priority over the file data
+                                if(pm.canSend() && eventQueue.canGet()) {
+                                    //send a message related to the next event in the event queue without removing
+                                    //it from the queue; doing so in case of connection error I will not lose the
+                                    //event and I will retry with the same one
+                                    if (pm.send(eventQueue.front())) //if the event was sent (or was unsupported)
+                                        //pop the last sent event from the queue
+                                        eventQueue.pop();
+                                }
+                                //otherwise send the next slice of the files being sent (and then read the responses)
+                                else if(pm.isSending())
+                                    pm.sendData();
                             }
 
                             //if I have something to read
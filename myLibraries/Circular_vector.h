@@ -403,6 +403,18 @@ public:
         return _start != _end;  //true if there is at least one element, false otherwise
     }
 
+    /**
+     * method used to know the number of elements in the vector
+     *
+     * @return the number of elements in the vector
+     *
+     * @author Michele Crepaldi s269551
+     */
+    unsigned int size(){
+        std::unique_lock l(_m); //unique lock to ensure thread safeness
+        return (_end + _capacity - _start) % _capacity;
+    }
+
     /**
      * method used to notify all thread in passive waiting on the condition variables
      *
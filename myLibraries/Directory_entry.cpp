@@ -368,4 +368,34 @@ void Directory_entry::updateValues(){
 
         _hash = hm.get();   //get the computed Hash
     }
+}
+
+/**
+ * Directory_entry utility method, it computes a (64 bit) digest of a file from its path, size, last write time and
+ *  (optionally) hash. The client and the server compute it in the same way, so the client can tell the server which
+ *  files it already has by sending just their digests
+ *
+ * @param path path of the file (relative to the destination folder of the client)
+ * @param size size of the file
+ * @param lastWriteTime last write time of the file
+ * @param hash hash of the file (as string), or an empty string to leave the content out of the digest
+ *
+ * @return digest of the file
+ */
+uint64_t Directory_entry::digest(const std::string &path, uintmax_t size, const std::string &lastWriteTime,
+                                 const std::string &hash){
+    HashMaker hm{path};
+
+    //separate the fields (the path and the last write time do not contain '\0' characters)
+    hm.update(std::string(1, '\0') + std::to_string(size) + '\0' + lastWriteTime + '\0');
+    hm.update(hash);
+
+    //take the first 8 bytes of the hash
+    uint64_t digest = 0;
+    auto sum = hm.get();
+    auto buf = sum.get();
+    for(size_t i = 0; i < sizeof(digest); i++)
+        digest = (digest << 8) | static_cast<unsigned char>(buf.first[i]);
+
+    return digest;
 }
\ No newline at end of file
@@ -90,6 +90,10 @@ public:
     bool exists();       //method to know if this Directory_element actually exists on filesystem
     void updateValues(); //method used to update this Directory_element's info from filesystem (using its absolute path)
 
+    //digest of a file (from its path, size, last write time and optionally hash)
+    static uint64_t digest(const std::string &path, uintmax_t size, const std::string &lastWriteTime,
+                           const std::string &hash);
+
 private:
     std::string _relativePath;      //directory entry relative path (relative to base path)
     std::string _absolutePath;      //directory entry absolute path
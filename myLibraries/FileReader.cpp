@@ -0,0 +1,144 @@
+#include "FileReader.h"
+
+#include <filesystem>
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * FileReader class methods
+ */
+
+/**
+ * FileReader constructor; it opens the file and (if the file is bigger than a block) starts the reader thread
+ *
+ * @param path path of the file to read
+ * @param blockSize size of the blocks to read
+ * @param nBuffers number of blocks to read ahead (at least 2)
+ * @param offset offset from which to read the file
+ */
+FileReader::FileReader(const std::string &path, size_t blockSize, unsigned int nBuffers, uintmax_t offset) :
+        _blockSize(blockSize) {
+
+    //open the file
+    _file.open(path, std::ios::in | std::ios::binary);
+    if(!_file.is_open())
+        return;
+
+    //skip the first offset bytes
+    _file.seekg(static_cast<std::streamoff>(offset));
+
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);  //file size
+
+    //if the file fits in a single block there is no point in reading ahead
+    if(ec || size < offset + blockSize){
+        _buffers.resize(1);
+        _buffers[0].data.resize(blockSize);
+        return;
+    }
+
+    _buffers.resize(std::max(nBuffers, 2u));
+    for(auto &buffer : _buffers)
+        buffer.data.resize(blockSize);
+
+    //start the reader thread
+    _reader = std::thread(&FileReader::_fill, this);
+}
+
+/**
+ * FileReader destructor; it stops the reader thread (if any) and closes the file
+ */
+FileReader::~FileReader() {
+    if(_reader.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+
+        _reader.join();
+    }
+}
+
+/**
+ * FileReader is_open method
+ *
+ * @return whether the file was opened or not
+ */
+bool FileReader::is_open() const {
+    return _file.is_open();
+}
+
+/**
+ * FileReader read method. Used to get the next block of the file; the block stays valid until the next call
+ *
+ * @param block pointer to the block data (output)
+ * @param len length of the block (output)
+ *
+ * @return true if a full block was read, false if this is the last (partial, possibly empty) block
+ */
+bool FileReader::read(const char *&block, size_t &len) {
+    //if there is no reader thread just read the block directly
+    if(!_reader.joinable()){
+        bool full = static_cast<bool>(_file.read(_buffers[0].data.data(), static_cast<std::streamsize>(_blockSize)));
+
+        block = _buffers[0].data.data();
+        len = _file.gcount();
+        return full;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    //give the previous block back to the reader thread
+    if(_holding){
+        _holding = false;
+        _readIndex = (_readIndex + 1) % _buffers.size();
+        _count--;
+        _cv.notify_all();
+    }
+
+    //wait for the next block to be read
+    _cv.wait(lock, [this](){ return _count > 0; });
+
+    Buffer &buffer = _buffers[_readIndex];  //next block
+    _holding = true;
+
+    block = buffer.data.data();
+    len = buffer.len;
+    return !buffer.last;
+}
+
+/**
+ * FileReader fill method. It is the reader thread function: it reads the file block by block, filling the free
+ *  buffers of the ring, until the end of the file
+ */
+void FileReader::_fill() {
+    unsigned int writeIndex = 0;    //index of the next buffer to fill
+
+    while(true){
+        {
+            //wait for a free buffer
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this](){ return _stop || _count < _buffers.size(); });
+
+            if(_stop)
+                return;
+        }
+
+        //fill the buffer (without holding the lock, the consumer can use the other buffers meanwhile)
+        Buffer &buffer = _buffers[writeIndex];
+        buffer.last = !_file.read(buffer.data.data(), static_cast<std::streamsize>(_blockSize));
+        buffer.len = _file.gcount();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _count++;
+        }
+        _cv.notify_all();
+
+        if(buffer.last)
+            return;
+
+        writeIndex = (writeIndex + 1) % _buffers.size();
+    }
+}
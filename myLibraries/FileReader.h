@@ -0,0 +1,65 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * FileReader class
+ */
+
+/**
+ * FileReader class. It reads a file in fixed size blocks, with a reader thread filling a ring of buffers ahead of
+ *  the consumer (read-ahead), so that reading the next blocks from disk overlaps with sending the current one.
+ *
+ *  <p> The blocks are returned in the same way as std::ifstream::read does in a loop: all the blocks are full except
+ *  the last one, which may be partial (or empty). Files smaller than a block are read directly, without any thread.
+ */
+class FileReader {
+public:
+    FileReader(const FileReader &) = delete;                //copy constructor deleted
+    FileReader& operator=(const FileReader &) = delete;     //copy assignment deleted
+    FileReader(FileReader &&) = delete;                     //move constructor deleted
+    FileReader& operator=(FileReader &&) = delete;          //move assignment deleted
+
+    //constructor
+    FileReader(const std::string &path, size_t blockSize, unsigned int nBuffers, uintmax_t offset = 0);
+    ~FileReader();  //destructor
+
+    bool is_open() const;
+    bool read(const char *&block, size_t &len);
+
+private:
+    /**
+     * Buffer struct. One block of the file
+     */
+    struct Buffer {
+        std::vector<char> data; //block data
+        size_t len = 0;         //block length
+        bool last = false;      //whether this is the last block of the file
+    };
+
+    std::ifstream _file;            //file to read
+    size_t _blockSize;              //size of the blocks
+    std::vector<Buffer> _buffers;   //ring of buffers
+
+    unsigned int _readIndex = 0;    //index of the next buffer to be returned to the consumer
+    unsigned int _count = 0;        //number of filled buffers (including the one held by the consumer)
+    bool _holding = false;          //whether the consumer holds a buffer (the one returned by the last read)
+    bool _stop = false;             //whether the reader thread has to stop
+
+    std::mutex _mutex;              //mutex protecting the buffer ring
+    std::condition_variable _cv;    //condition variable used to wait for free/filled buffers
+    std::thread _reader;            //reader thread (not started for files smaller than a block)
+
+    void _fill();   //reader thread function
+};
+
+
+#endif //FILEREADER_H
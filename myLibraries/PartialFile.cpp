@@ -0,0 +1,336 @@
+#include "PartialFile.h"
+
+#include <filesystem>
+
+#include "RandomNumberGenerator.h"
+
+#define DATA_EXTENSION ".part"
+#define CHECKSUM_EXTENSION ".chk"
+#define MAX_KEY_SIZE 8192
+#define REHASH_BUFFER_SIZE 4096
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * PartialFile class methods
+ */
+
+/**
+ * PartialFile constructor; the file name is derived from the transfer key (its hash, in hex representation)
+ *
+ * @param directory (temporary) directory where to put the partial file
+ * @param key transfer key (it identifies the transfer, for example user, mac and path of the file)
+ * @param hash hash of the whole file to transfer
+ */
+PartialFile::PartialFile(const std::string &directory, const std::string &key, const Hash &hash) :
+        _key(key), _hash(hash) {
+
+    //name of the partial file (hex representation of the key hash)
+    std::string name = RandomNumberGenerator::string_to_hex(HashMaker(key).get().str());
+
+    _path = directory + "/" + name + DATA_EXTENSION;
+    _checksumPath = directory + "/" + name + CHECKSUM_EXTENSION;
+}
+
+/**
+ * PartialFile list static method. Used to get all the partial files present in a directory
+ *
+ * @param directory directory where to look for partial files
+ *
+ * @return vector of all the partial files found in the directory
+ */
+std::vector<PartialFile> PartialFile::list(const std::string &directory) {
+    std::vector<PartialFile> partials;  //partial files found
+
+    //if the directory does not exist there are no partial files
+    if(!std::filesystem::is_directory(directory))
+        return partials;
+
+    //for all the checksum files in the directory
+    for(auto &entry : std::filesystem::directory_iterator(directory)){
+        if(!entry.is_regular_file() || entry.path().extension() != CHECKSUM_EXTENSION)
+            continue;
+
+        PartialFile partial;    //current partial file
+        partial._checksumPath = entry.path().string();
+        partial._path = std::filesystem::path(entry.path()).replace_extension(DATA_EXTENSION).string();
+
+        //get key and hash from the checksum file header (skip it if it is not readable)
+        if(partial._readHeader())
+            partials.push_back(std::move(partial));
+    }
+
+    return partials;
+}
+
+/**
+ * PartialFile recover method. Used to find the last good chunk of a previous transfer (using the chunk checksums);
+ *  if no previous transfer with the same key and hash exists the partial file is removed
+ *
+ * @return offset from which the transfer can be resumed (0 if it has to start from scratch)
+ */
+uintmax_t PartialFile::recover() {
+    _ends.clear();
+    _hashMaker = HashMaker();
+
+    //read the header and check it is from a transfer of the same file
+    std::string key = _key; //expected key
+    Hash hash = _hash;      //expected hash
+
+    if(!_readHeader() || _key != key || _hash != hash){
+        //restore the expected key and hash and remove what is left of the other transfer
+        _key = std::move(key);
+        _hash = std::move(hash);
+        remove();
+        return 0;
+    }
+
+    std::ifstream checksumFile(_checksumPath, std::ios::in | std::ios::binary);    //checksums file
+    std::ifstream file(_path, std::ios::in | std::ios::binary);    //data file
+    if(!checksumFile.is_open() || !file.is_open())
+        return 0;
+
+    //skip the header
+    checksumFile.seekg(static_cast<std::streamoff>(sizeof(uint32_t) + _key.size() + SHA256_DIGEST_SIZE));
+
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(_path, ec);   //data file size
+    if(ec)
+        return 0;
+
+    uintmax_t start = 0;    //start of the current chunk
+    uint64_t end;           //end of the current chunk
+    char sum[SHA256_DIGEST_SIZE];   //checksum of the current chunk
+    std::vector<char> buff;         //current chunk data
+
+    //check every chunk against its checksum, stopping at the first bad (or missing) one
+    while(checksumFile.read(reinterpret_cast<char *>(&end), sizeof(end)) && checksumFile.read(sum, sizeof(sum))){
+        if(end <= start || end > size)
+            break;
+
+        buff.resize(end - start);
+        if(!file.read(buff.data(), static_cast<std::streamsize>(buff.size())))
+            break;
+
+        Hash expected{sum, sizeof(sum)};    //expected chunk hash
+        Hash effective = HashMaker(buff.data(), buff.size()).get(); //effective chunk hash
+        if(effective != expected)
+            break;
+
+        //the chunk is good, add it to the data hash
+        _hashMaker.update(buff.data(), buff.size());
+
+        _ends.push_back(end);
+        start = end;
+    }
+
+    _offset = start;
+    return start;
+}
+
+/**
+ * PartialFile open method. Used to open the partial file for writing, starting from the offset given; anything after
+ *  it is discarded
+ *
+ * @param offset offset from which to write (it has to be 0 or the end of one of the chunks found by recover)
+ *
+ * @return true if the file was opened, false otherwise
+ */
+bool PartialFile::open(uintmax_t offset) {
+    close();
+
+    if(offset == 0) {
+        //start from scratch
+        _ends.clear();
+        _offset = 0;
+        _hashMaker = HashMaker();
+
+        _file.open(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        _checksumFile.open(_checksumPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!_file.is_open() || !_checksumFile.is_open())
+            return false;
+
+        //write the header (key and hash)
+        auto keySize = static_cast<uint32_t>(_key.size());  //key length
+        _checksumFile.write(reinterpret_cast<const char *>(&keySize), sizeof(keySize));
+        _checksumFile.write(_key.data(), keySize);
+        _checksumFile.write(_hash.get().first, _hash.get().second);
+
+        return true;
+    }
+
+    //find the chunk which ends at offset
+    size_t n = 0;   //number of chunks to keep
+    while(n < _ends.size() && _ends[n] != offset)
+        n++;
+
+    if(n == _ends.size())
+        return false;
+
+    //if some of the recovered chunks are discarded the data hash has to be computed again
+    if(offset != _offset)
+        _rehash(offset);
+
+    _ends.resize(n + 1);
+    _offset = offset;
+
+    //discard everything after the chunk (data and checksums)
+    std::error_code ec;
+    std::filesystem::resize_file(_path, offset, ec);
+    if(ec)
+        return false;
+    std::filesystem::resize_file(_checksumPath, sizeof(uint32_t) + _key.size() + SHA256_DIGEST_SIZE +
+                                                (n + 1) * (sizeof(uint64_t) + SHA256_DIGEST_SIZE), ec);
+    if(ec)
+        return false;
+
+    _file.open(_path, std::ios::out | std::ios::binary | std::ios::app);
+    _checksumFile.open(_checksumPath, std::ios::out | std::ios::binary | std::ios::app);
+
+    return _file.is_open() && _checksumFile.is_open();
+}
+
+/**
+ * PartialFile write method. Used to append a chunk (and its checksum) to the partial file, updating the data hash
+ *
+ * @param buf buffer containing the chunk
+ * @param len length of the chunk
+ */
+void PartialFile::write(const char *buf, size_t len) {
+    if(len == 0)
+        return;
+
+    _file.write(buf, static_cast<std::streamsize>(len));
+    _offset += len;
+
+    //update the data hash with the chunk
+    _hashMaker.update(buf, len);
+
+    //append the chunk end offset and checksum
+    uint64_t end = _offset; //chunk end offset
+    Hash sum = HashMaker(buf, len).get();   //chunk checksum
+    _checksumFile.write(reinterpret_cast<const char *>(&end), sizeof(end));
+    _checksumFile.write(sum.get().first, sum.get().second);
+
+    _ends.push_back(end);
+}
+
+/**
+ * PartialFile close method. Used to close the partial file (it is kept in the filesystem, so that the transfer can
+ *  be resumed later)
+ *
+ * @return true if all the data was written to the file, false if some write failed
+ */
+bool PartialFile::close() {
+    bool good = true;   //whether all the writes succeeded
+
+    if(_file.is_open()) {
+        _file.close();
+        good = !_file.fail();
+    }
+    if(_checksumFile.is_open())
+        _checksumFile.close();
+
+    return good;
+}
+
+/**
+ * PartialFile remove method. Used to close and remove the partial file and its checksums file (if still present)
+ */
+void PartialFile::remove() {
+    close();
+
+    std::error_code ec;
+    std::filesystem::remove(_path, ec);
+    std::filesystem::remove(_checksumPath, ec);
+
+    _ends.clear();
+    _offset = 0;
+}
+
+/**
+ * PartialFile key getter
+ *
+ * @return transfer key
+ */
+const std::string &PartialFile::getKey() const {
+    return _key;
+}
+
+/**
+ * PartialFile path getter
+ *
+ * @return path of the file containing the data
+ */
+const std::string &PartialFile::getPath() const {
+    return _path;
+}
+
+/**
+ * PartialFile hash getter
+ *
+ * @return hash of the whole file
+ */
+Hash &PartialFile::getHash() {
+    return _hash;
+}
+
+/**
+ * PartialFile size getter
+ *
+ * @return size of the data written so far (recovered chunks included)
+ */
+uintmax_t PartialFile::getSize() const {
+    return _offset;
+}
+
+/**
+ * PartialFile data hash getter (to be called only once, when the transfer is complete)
+ *
+ * @return hash of the data written so far (recovered chunks included)
+ */
+Hash PartialFile::getDataHash() {
+    return _hashMaker.get();
+}
+
+/**
+ * PartialFile readHeader method. Used to read the key and the hash from the checksum file header
+ *
+ * @return true if the header was read, false otherwise
+ */
+bool PartialFile::_readHeader() {
+    std::ifstream checksumFile(_checksumPath, std::ios::in | std::ios::binary);    //checksums file
+    if(!checksumFile.is_open())
+        return false;
+
+    uint32_t keySize;   //key length
+    if(!checksumFile.read(reinterpret_cast<char *>(&keySize), sizeof(keySize)) || keySize > MAX_KEY_SIZE)
+        return false;
+
+    std::string key(keySize, '\0');     //transfer key
+    char sum[SHA256_DIGEST_SIZE];       //hash of the whole file
+    if(!checksumFile.read(key.data(), keySize) || !checksumFile.read(sum, sizeof(sum)))
+        return false;
+
+    _key = std::move(key);
+    _hash = Hash{sum, sizeof(sum)};
+
+    return true;
+}
+
+/**
+ * PartialFile rehash method. Used to compute again the data hash, considering only the data before offset
+ *
+ * @param offset offset up to which to compute the hash
+ */
+void PartialFile::_rehash(uintmax_t offset) {
+    _hashMaker = HashMaker();
+
+    std::ifstream file(_path, std::ios::in | std::ios::binary);    //data file
+    char buff[REHASH_BUFFER_SIZE];  //buffer used to read the data file
+
+    while(offset > 0 && file.read(buff, static_cast<std::streamsize>(std::min<uintmax_t>(offset, sizeof(buff))))){
+        _hashMaker.update(buff, file.gcount());
+        offset -= file.gcount();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef PARTIALFILE_H
+#define PARTIALFILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "Hash.h"
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * PartialFile class
+ */
+
+/**
+ * PartialFile class. It represents a (possibly interrupted) file transfer saved in a temporary folder.
+ *
+ *  <p> The data received so far is saved in a "<name>.part" file, while a "<name>.chk" file contains the transfer
+ *  key, the hash of the whole file and a checksum for every chunk written; the name is derived from the key, so a
+ *  transfer of the same key can find and resume the data already received. The chunk checksums are used to find the
+ *  last good chunk (and discard anything after it) before resuming. The hash of the data is computed while it is
+ *  written (and recovered), so the received file does not need to be read again to be checked.
+ */
+class PartialFile {
+public:
+    PartialFile(const PartialFile &) = delete;              //copy constructor deleted
+    PartialFile& operator=(const PartialFile &) = delete;   //copy assignment deleted
+    PartialFile(PartialFile &&) = default;                  //default move constructor
+    PartialFile& operator=(PartialFile &&) = default;       //default move assignment
+    ~PartialFile() = default;                               //default destructor
+
+    PartialFile(const std::string &directory, const std::string &key, const Hash &hash);   //constructor
+
+    static std::vector<PartialFile> list(const std::string &directory);
+
+    uintmax_t recover();
+    bool open(uintmax_t offset);
+    void write(const char *buf, size_t len);
+    bool close();
+    void remove();
+
+    const std::string &getKey() const;
+    const std::string &getPath() const;
+    Hash &getHash();
+    uintmax_t getSize() const;
+    Hash getDataHash();
+
+private:
+    PartialFile() = default;    //empty constructor (used by list)
+
+    std::string _key;           //transfer key
+    Hash _hash;                 //hash of the whole file
+    std::string _path;          //path of the file containing the data
+    std::string _checksumPath;  //path of the file containing the chunk checksums
+
+    std::vector<uintmax_t> _ends;   //end offsets of the good chunks (found by recover)
+    uintmax_t _offset = 0;          //current end offset of the data
+
+    HashMaker _hashMaker;           //hash of the data written so far
+
+    std::ofstream _file;            //data file
+    std::ofstream _checksumFile;    //checksums file
+
+    bool _readHeader();
+    void _rehash(uintmax_t offset);
+};
+
+
+#endif //PARTIALFILE_H
@@ -13,7 +13,13 @@
 #include <fstream>
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+
+#define MAX_FRAME_SIZE 1048576  //default maximum size (in bytes) of a received frame (1MB)
 
 
 /*
@@ -62,7 +68,8 @@ TCP_Socket::TCP_Socket() {
  * @author Michele Crepaldi s269551
  */
 TCP_Socket::TCP_Socket(TCP_Socket &&other) noexcept :
-    _sockfd(other._sockfd) {    //assign to my sockfd the content of the other socket sockfd
+    _sockfd(other._sockfd),                         //assign to my sockfd the content of the other socket sockfd
+    _readBuffer(std::move(other._readBuffer)) {     //take the other socket read buffer (and its unread data)
 
     other._sockfd = 0;  //reset the other socket sockfd
 }
@@ -80,6 +87,7 @@ TCP_Socket& TCP_Socket::operator=(TCP_Socket &&other) noexcept {
         close(_sockfd);
     _sockfd = other._sockfd;    //assign to my sockfd the value of the other socket
     other._sockfd = 0;          //reset the content of sockfd for the other socket
+    _readBuffer = std::move(other._readBuffer); //take the other socket read buffer (and its unread data)
     return *this;
 }
 
@@ -106,7 +114,7 @@ void TCP_Socket::connect(const std::string &addr, unsigned int port) {
 }
 
 /**
- * TCP_Socket read method
+ * TCP_Socket read method (it reads exactly len bytes passing through the per-connection read buffer)
  *
  * @param buffer buffer where to put the read data
  * @param len length of the data to read
@@ -121,13 +129,9 @@ void TCP_Socket::connect(const std::string &addr, unsigned int port) {
  * @author Michele Crepaldi s269551
  */
 ssize_t TCP_Socket::read(char *buffer, size_t len, int options) const {
-    char *ptr = buffer; //pointer to buffer
-    int64_t numRec;     //number of bytes received
-    int64_t rec = 0;        //total amount of bytes received
-
-    while(len > 0){
-        //receive len bytes from the socket and put it into the buffer at the position pointed by ptr
-        numRec = recv(_sockfd, ptr, len, options);
+    //fill function: receive (up to) n bytes from the socket and put them into ptr
+    auto fill = [this, options](char *ptr, size_t n) -> size_t {
+        ssize_t numRec = recv(_sockfd, ptr, n, options);    //number of bytes received
         if(numRec < 0)
             //if # of bytes read is < 0 throw exception
             throw SocketException("Cannot read from socket", SocketError::read);
@@ -136,12 +140,11 @@ ssize_t TCP_Socket::read(char *buffer, size_t len, int options) const {
             //if # of bytes read is == 0 the socket was closed from the other party, so throw exception
             throw SocketException("Socket closed", SocketError::closed);
 
-        //update variables
-        ptr += numRec;
-        len -= numRec;
-        rec += numRec;
-    }
-    return rec;
+        return numRec;
+    };
+
+    _readBuffer.read(buffer, len, fill);
+    return len;
 }
 
 /**
@@ -150,36 +153,76 @@ ssize_t TCP_Socket::read(char *buffer, size_t len, int options) const {
  * @return string read from TCP_socket
  *
  * @throws SocketException:
- *  <b>read</b> if it could not read data from the TCP_socket or data is less than expected
+ *  <b>read</b> if it could not read data from the TCP_socket or the frame is bigger than the maximum frame size
  *
  * @author Michele Crepaldi s269551
 */
 std::string TCP_Socket::recvString() const {
     std::string stringBuffer;   //string buffer
+    recvString(stringBuffer);
+    return stringBuffer;
+}
+
+/**
+ * TCP_Socket receive string method (reusing the memory already held by the given string)
+ *
+ * @param stringBuffer string where to put the data read from TCP_socket
+ *
+ * @throws SocketException:
+ *  <b>read</b> if it could not read data from the TCP_socket or the frame is bigger than the maximum frame size
+ *
+ * @author Michele Crepaldi s269551
+*/
+void TCP_Socket::recvString(std::string &stringBuffer) const {
     uint32_t dataLength;        //data length
 
     //receive first the message length
+    read(reinterpret_cast<char *>(&dataLength), sizeof(uint32_t), 0);
 
-    int64_t len = read(reinterpret_cast<char *>(&dataLength), sizeof(uint32_t), 0); //bytes read
+    dataLength = ntohl(dataLength); //ensure host system byte order
 
-    //if # of received bytes is less than expected throw exception
-    if(len < sizeof(uint32_t))
-        throw SocketException("Read from socket error, read bytes are less than expected", SocketError::read);
+    //the length comes from the other party: do not trust it
+    if(dataLength > Socket::_max_frame_size)
+        throw SocketException("Read from socket error, frame is bigger than the maximum frame size",
+                              SocketError::read);
 
-    dataLength = ntohl(dataLength); //ensure host system byte order
+    stringBuffer.resize(dataLength);    //(it does not reallocate if the string already has enough capacity)
 
-    std::vector<uint8_t> rcvBuf;        //receive buffer
-    rcvBuf.resize(dataLength,0x00);  //initialize receive buffer with the necessary size
+    read(stringBuffer.data(), dataLength, 0);  //receive the data
+}
 
-    len = read(reinterpret_cast<char *>(&(rcvBuf[0])), dataLength, 0);  //receive the data
+/**
+ * TCP_Socket receive string method that does not wait for the other party: it consumes the bytes already available
+ *  and keeps the part of the frame received so far (in the read buffer) until the rest arrives
+ *
+ * @param stringBuffer string where to put the data read from TCP_socket (only if the whole frame was received)
+ * @return true if a whole frame was received, false if the rest of it has not arrived yet
+ *
+ * @throws SocketException:
+ *  <b>read</b> if it could not read data from the TCP_socket or the frame is bigger than the maximum frame size
+ * @throws SocketException:
+ *  <b>closed</b> if the socket is closed
+*/
+bool TCP_Socket::tryRecvString(std::string &stringBuffer) const {
+    //fill function: receive (up to) n bytes from the socket and put them into ptr, without waiting
+    auto fill = [this](char *ptr, size_t n) -> size_t {
+        ssize_t numRec = recv(_sockfd, ptr, n, MSG_DONTWAIT);   //number of bytes received
+        if(numRec < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;   //nothing available now
+
+            //otherwise throw exception
+            throw SocketException("Cannot read from socket", SocketError::read);
+        }
+
+        if(numRec == 0)
+            //if # of bytes read is == 0 the socket was closed from the other party, so throw exception
+            throw SocketException("Socket closed", SocketError::closed);
 
-    //if # of received bytes is less than expected throw exception
-    if(len < dataLength)
-        throw SocketException("Read from socket error, read bytes are less than expected", SocketError::read);
+        return numRec;
+    };
 
-    //assign buffered data to a string
-    stringBuffer.assign(reinterpret_cast<const char *>(&(rcvBuf[0])), rcvBuf.size());
-    return stringBuffer;
+    return _readBuffer.readFrame(stringBuffer, Socket::_max_frame_size, fill);
 }
 
 /**
@@ -232,15 +275,46 @@ ssize_t TCP_Socket::sendString(std::string &stringBuffer) const {
 
     uint32_t dataLength = htonl(stringBuffer.size());   //data to send size
 
-    //send first the data length
-    ssize_t len = write(reinterpret_cast<const char *>(&dataLength), sizeof(uint32_t) , 0);
+    //send the data length and the string data together (gather write: one syscall per frame)
+    struct iovec iov[2];
+    iov[0].iov_base = &dataLength;
+    iov[0].iov_len = sizeof(uint32_t);
+    iov[1].iov_base = stringBuffer.data();
+    iov[1].iov_len = stringBuffer.size();
 
-    //if # of sent bytes is less than expected throw exception
-    if(len < sizeof(uint32_t))
-        throw SocketException("Write to socket error, sent bytes are less than expected", SocketError::write);
+    struct iovec *ptr = iov;    //pointer to the first iovec not completely sent
+    int count = 2;              //number of iovec not completely sent
+
+    while(count > 0){
+        ssize_t numSent = writev(_sockfd, ptr, count);    //number of bytes written
+
+        //if # of sent bytes is < 0 throw exception
+        if(numSent < 0)
+            throw SocketException("Cannot write to socket", SocketError::write);
+
+        //skip what was already sent
+        while(count > 0 && static_cast<size_t>(numSent) >= ptr->iov_len){
+            numSent -= static_cast<ssize_t>(ptr->iov_len);
+            ptr++;
+            count--;
+        }
+        if(count > 0){
+            ptr->iov_base = static_cast<char *>(ptr->iov_base) + numSent;
+            ptr->iov_len -= numSent;
+        }
+    }
+
+    return static_cast<ssize_t>(stringBuffer.size());
+}
 
-    //send the string data;
-    return write(stringBuffer.data() ,stringBuffer.size() ,0);
+/**
+ * TCP_Socket pending method
+ *
+ * @return number of bytes already received (and buffered) but not consumed yet;
+ *  if it is not 0 a select on the socket could block even if a message is already available
+ */
+size_t TCP_Socket::pending() const {
+    return _readBuffer.size();
 }
 
 /**
@@ -456,13 +530,22 @@ TCP_Socket::~TCP_Socket() {
  *
  * @param port port to use
  * @param n length of the listen queue
+ * @param reusePort whether to share the port with other server sockets (SO_REUSEPORT, the kernel balances the
+ *  incoming connections between them)
  *
  * @throws SocketException:
- *  <b>bind</b> if it could not bind the port
+ *  <b>bind</b> if it could not bind the port (or share it)
  *
  * @author Michele Crepaldi s269551
  */
-TCP_ServerSocket::TCP_ServerSocket(unsigned int port, unsigned int n) {
+TCP_ServerSocket::TCP_ServerSocket(unsigned int port, unsigned int n, bool reusePort) {
+    //share the port with the other server sockets
+    if(reusePort) {
+        int enable = 1;
+        if(::setsockopt(_sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0)
+            throw SocketException("Cannot share port", SocketError::bind);
+    }
+
     struct sockaddr_in sockaddrIn{};                //prepare struct sockaddr_in
     sockaddrIn.sin_port = htons(port);              //ensure network byte order
     sockaddrIn.sin_family = AF_INET;                //set address family
@@ -500,6 +583,20 @@ SocketBridge* TCP_ServerSocket::accept(struct sockaddr_in *addr, unsigned long *
     return new TCP_Socket(fd);  //return a new TCP_Socket with the fd we just got
 }
 
+/**
+ * TCP_ServerSocket wait client method
+ *
+ * @param seconds maximum time to wait
+ * @return true if there is a client to accept, false if the time expired
+ */
+bool TCP_ServerSocket::waitClient(unsigned int seconds) {
+    struct pollfd pfd{};    //pollfd struct for the listening socket
+    pfd.fd = _sockfd;
+    pfd.events = POLLIN;
+
+    return ::poll(&pfd, 1, static_cast<int>(seconds * 1000)) > 0;
+}
+
 /**
  * TCP_ServerSocket destructor
  *
@@ -515,6 +612,10 @@ TCP_ServerSocket::~TCP_ServerSocket() {
  * (wolfSSL) TLS Socket implementation
  */
 
+std::mutex TLS_Socket::_sessionMutex;
+tls_socket::UniquePtr<WOLFSSL_SESSION> TLS_Socket::_session;
+std::string TLS_Socket::_sessionServer;
+
 /**
  * TLS_Socket constructor
  *
@@ -539,23 +640,8 @@ TLS_Socket::TLS_Socket(int sockfd, WOLFSSL *ssl) :
 TLS_Socket::TLS_Socket() {
     wolfSSL_Init();     //init wolfSSL library
 
-    //crete wolfSSL context by using wolfTLS client method
-    _ctx = tls_socket::UniquePtr<WOLFSSL_CTX>(wolfSSL_CTX_new(wolfTLS_client_method()));
-    if(_ctx.get() == nullptr)
-        throw SocketException("Error in initializing wolfSSL context", SocketError::create);
-
-    //load verify CA from the filesystem
-    if(wolfSSL_CTX_load_verify_locations(_ctx.get(), Socket::_ca_file_path.c_str(), nullptr) != SSL_SUCCESS) {
-        std::stringstream errorMsg;
-        errorMsg << "Error loading " << Socket::_ca_file_path << ", please check the file.";
-        throw SocketException(errorMsg.str(), SocketError::create);
-    }
-
-    //set the TLS client to verify the server certificate
-    wolfSSL_CTX_set_verify(_ctx.get(), SSL_VERIFY_PEER, nullptr);
-
-    //set the certificate verify depth into the CA
-    wolfSSL_CTX_set_verify_depth(_ctx.get(), 1);
+    //create the (shared) client context, if this is the first client socket
+    _clientContext();
 
     _sock = std::make_unique<TCP_Socket>();  //create TCP socket
 }
@@ -570,7 +656,10 @@ TLS_Socket::TLS_Socket() {
 TLS_Socket::TLS_Socket(TLS_Socket &&other) noexcept :
     _sock(other._sock.release()),   //assign to _sock the other socket's sock (freeing it)
     _ctx(other._ctx.release()),     //assign to _ctx the context of the other socket (freeing it)
-    _ssl(other._ssl.release()) {    //assign to _ssl the other socket ssl (freeing it)
+    _ssl(other._ssl.release()),     //assign to _ssl the other socket ssl (freeing it)
+    _readBuffer(std::move(other._readBuffer)),      //take the other socket read buffer (and its unread data)
+    _writeBuffer(std::move(other._writeBuffer)),    //take the other socket write buffer
+    _server(std::move(other._server)) {             //take the other socket server
 }
 
 /**
@@ -599,6 +688,10 @@ TLS_Socket& TLS_Socket::operator=(TLS_Socket &&other) noexcept {
 
     //set the ssl object to be what the other's ssl was
     _ssl = tls_socket::UniquePtr<WOLFSSL>(other._ssl.release());
+
+    _readBuffer = std::move(other._readBuffer);     //take the other socket read buffer (and its unread data)
+    _writeBuffer = std::move(other._writeBuffer);   //take the other socket write buffer
+    _server = std::move(other._server);             //take the other socket server
     return *this;
 }
 
@@ -617,18 +710,26 @@ void TLS_Socket::connect(const std::string& addr, unsigned int port) {
     //connect underlying TCP socket
     _sock->connect(addr, port);
 
-    //create a new wolfSSL object from the context
-    _ssl = tls_socket::UniquePtr<WOLFSSL>(wolfSSL_new(_ctx.get()));
+    //create a new wolfSSL object from the (shared) client context
+    _ssl = tls_socket::UniquePtr<WOLFSSL>(wolfSSL_new(_clientContext()));
     if (_ssl.get() == nullptr)
         throw SocketException("Error in creating wolfSSL ssl", SocketError::connect);
 
     //associate the socket file descriptor to the wolfSSL object
     if(wolfSSL_set_fd(_ssl.get(), _sock->getSockfd()) != SSL_SUCCESS)
         throw SocketException("Cannot set fd to wolfSSL ssl", SocketError::connect);
+
+    _server = addr + ":" + std::to_string(port);
+
+    //resume the session of the previous connection to the same server (if any), so that the handshake is abbreviated
+    //(if the server does not have the session anymore a full handshake is done)
+    std::lock_guard<std::mutex> lock(_sessionMutex);
+    if(_session != nullptr && _sessionServer == _server)
+        wolfSSL_set_session(_ssl.get(), _session.get());
 }
 
 /**
- * TLS_Socket read method
+ * TLS_Socket read method (it reads exactly len bytes passing through the per-connection read buffer)
  *
  * @param buffer buffer where to put the read data
  * @param len length of the data to read
@@ -636,24 +737,36 @@ void TLS_Socket::connect(const std::string& addr, unsigned int port) {
  *
  * @throws SocketException:
  *  <b>read</b> if it could not receive data from the TLS_socket
+ * @throws SocketException:
+ *  <b>closed</b> if the socket is closed
  *
  * @author Michele Crepaldi s269551
  */
 ssize_t TLS_Socket::read(char *buffer, size_t len) const {
-    //receive len bytes from the socket and put it into buffer
+    //fill function: receive (up to) n bytes from the socket and put them into ptr
+    //(wolfSSL returns at most one record per call)
+    auto fill = [this](char *ptr, size_t n) -> size_t {
+        ssize_t res = wolfSSL_read(_ssl.get(), ptr, static_cast<int>(n));   //number of bytes read
+
+        //if # of bytes read is < 0 throw exception
+        if(res < 0) {
+            char errorString[80];
+            int err = wolfSSL_get_error(_ssl.get(), 0); //get error code
+            wolfSSL_ERR_error_string(err, errorString); //get string from error code
+            std::stringstream errMsg;
+            errMsg << "Cannot read from socket. Error: " << errorString;
+            throw SocketException(errMsg.str(), SocketError::read);
+        }
 
-    ssize_t res = wolfSSL_read(_ssl.get(), buffer, len);    //number of bytes read
+        if(res == 0)
+            //if # of bytes read is == 0 the socket was closed from the other party, so throw exception
+            throw SocketException("Socket closed", SocketError::closed);
 
-    //if # of bytes read is < 0 throw exception
-    if(res < 0) {
-        char errorString[80];
-        int err = wolfSSL_get_error(_ssl.get(), 0); //get error code
-        wolfSSL_ERR_error_string(err, errorString); //get string from error code
-        std::stringstream errMsg;
-        errMsg << "Cannot read from socket. Error: " << errorString;
-        throw SocketException(errMsg.str(), SocketError::read);
-    }
-    return res;
+        return res;
+    };
+
+    _readBuffer.read(buffer, len, fill);
+    return len;
 }
 
 /**
@@ -662,36 +775,86 @@ ssize_t TLS_Socket::read(char *buffer, size_t len) const {
  * @return string read from TLS_Socket
  *
  * @throws SocketException:
- *  <b>read</b> if it could not read data from the TLS_Socket or data is less than expected
+ *  <b>read</b> if it could not read data from the TLS_Socket or the frame is bigger than the maximum frame size
  *
  * @author Michele Crepaldi s269551
 */
 std::string TLS_Socket::recvString() const {
     std::string stringBuffer;   //string buffer
+    recvString(stringBuffer);
+    return stringBuffer;
+}
+
+/**
+ * TLS_Socket receive string method (reusing the memory already held by the given string)
+ *
+ * @param stringBuffer string where to put the data read from TLS_Socket
+ *
+ * @throws SocketException:
+ *  <b>read</b> if it could not read data from the TLS_Socket or the frame is bigger than the maximum frame size
+ *
+ * @author Michele Crepaldi s269551
+*/
+void TLS_Socket::recvString(std::string &stringBuffer) const {
     uint32_t dataLength;        //data length
 
     //receive first the message length
+    read(reinterpret_cast<char *>(&dataLength), sizeof(uint32_t));
 
-    ssize_t len = read(reinterpret_cast<char *>(&dataLength), sizeof(uint32_t));    //bytes read
+    dataLength = ntohl(dataLength); //ensure host system byte order
 
-    //if # of received bytes is less than expected throw exception
-    if(len < sizeof(uint32_t))
-        throw SocketException("Read from socket error, read bytes are less than expected", SocketError::read);
+    //the length comes from the other party: do not trust it
+    if(dataLength > Socket::_max_frame_size)
+        throw SocketException("Read from socket error, frame is bigger than the maximum frame size",
+                              SocketError::read);
 
-    dataLength = ntohl(dataLength); //ensure host system byte order
+    stringBuffer.resize(dataLength);    //(it does not reallocate if the string already has enough capacity)
 
-    std::vector<uint8_t> rcvBuf;        //receive buffer
-    rcvBuf.resize(dataLength,0x00);  //initialize receive buffer with the necessary size
+    read(stringBuffer.data(), dataLength);  //receive the data
+}
+
+/**
+ * TLS_Socket receive string method that does not wait for the other party: it consumes the bytes already available
+ *  and keeps the part of the frame received so far (in the read buffer) until the rest arrives
+ *  (the TLS handshake of a server socket also progresses this way)
+ *
+ * @param stringBuffer string where to put the data read from TLS_Socket (only if the whole frame was received)
+ * @return true if a whole frame was received, false if the rest of it has not arrived yet
+ *
+ * @throws SocketException:
+ *  <b>read</b> if it could not read data from the TLS_Socket or the frame is bigger than the maximum frame size
+ * @throws SocketException:
+ *  <b>closed</b> if the socket is closed
+*/
+bool TLS_Socket::tryRecvString(std::string &stringBuffer) const {
+    //fill function: receive (up to) n bytes from the socket and put them into ptr, without waiting
+    //(wolfSSL keeps the part of a record received so far and returns at most one record per call)
+    auto fill = [this](char *ptr, size_t n) -> size_t {
+        wolfSSL_SetIOReadFlags(_ssl.get(), MSG_DONTWAIT);
+        ssize_t res = wolfSSL_read(_ssl.get(), ptr, static_cast<int>(n));   //number of bytes read
+        wolfSSL_SetIOReadFlags(_ssl.get(), 0);  //(the other reads wait for the data)
+
+        //if # of bytes read is < 0 throw exception
+        if(res < 0) {
+            int err = wolfSSL_get_error(_ssl.get(), 0); //get error code
+            if(err == WOLFSSL_ERROR_WANT_READ)
+                return 0;   //nothing available now
+
+            char errorString[80];
+            wolfSSL_ERR_error_string(err, errorString); //get string from error code
+            std::stringstream errMsg;
+            errMsg << "Cannot read from socket. Error: " << errorString;
+            throw SocketException(errMsg.str(), SocketError::read);
+        }
 
-    len = read(reinterpret_cast<char *>(&(rcvBuf[0])), dataLength); //receive the data
+        if(res == 0)
+            //if # of bytes read is == 0 the socket was closed from the other party, so throw exception
+            throw SocketException("Socket closed", SocketError::closed);
 
-    //if # of received bytes is less than expected throw exception
-    if(len < dataLength)
-        throw SocketException("Read from socket error, read bytes are less than expected", SocketError::read);
+        return res;
+    };
 
-    //assign buffered data to a string
-    stringBuffer.assign(reinterpret_cast<const char *>(&(rcvBuf[0])), rcvBuf.size());
-    return stringBuffer;
+    return _readBuffer.readFrame(stringBuffer, Socket::_max_frame_size, fill);
 }
 
 /**
@@ -739,15 +902,35 @@ ssize_t TLS_Socket::sendString(std::string &stringBuffer) const {
 
     uint32_t dataLength = htonl(stringBuffer.size());   //data to send size
 
-    //send first the data length
-    ssize_t len = write(reinterpret_cast<const char *>(&dataLength), sizeof(uint32_t));
+    //coalesce the data length and the string data in the write buffer, so that the whole frame is sent with
+    //a single wolfSSL write (one TLS record, if the frame fits in it) instead of 2
+    //(the buffer keeps its memory between calls)
+    _writeBuffer.resize(sizeof(uint32_t) + stringBuffer.size());
+    memcpy(_writeBuffer.data(), &dataLength, sizeof(uint32_t));
+    memcpy(_writeBuffer.data() + sizeof(uint32_t), stringBuffer.data(), stringBuffer.size());
+
+    ssize_t len = write(_writeBuffer.data(), _writeBuffer.size());   //bytes written
 
     //if # of sent bytes is less than expected throw exception
-    if(len < sizeof(uint32_t))
+    if(len < static_cast<ssize_t>(_writeBuffer.size()))
         throw SocketException("Write to socket error, sent bytes are less than expected", SocketError::write);
 
-    //send the string data
-    return write(stringBuffer.c_str(), stringBuffer.size());
+    return static_cast<ssize_t>(stringBuffer.size());
+}
+
+/**
+ * TLS_Socket pending method
+ *
+ * @return number of bytes already received (and buffered, also inside wolfSSL) but not consumed yet;
+ *  if it is not 0 a select on the socket could block even if a message is already available
+ */
+size_t TLS_Socket::pending() const {
+    size_t buffered = _readBuffer.size();   //bytes in my read buffer
+
+    if(_ssl != nullptr)
+        buffered += wolfSSL_pending(_ssl.get());    //bytes already decrypted by wolfSSL
+
+    return buffered;
 }
 
 /**
@@ -789,6 +972,7 @@ std::string TLS_Socket::getIP() const{
  * @author Michele Crepaldi s269551
  */
 void TLS_Socket::closeConnection() {
+    _saveSession();  //keep the session to resume it on the next connection
     _sock.reset();   //close the socket
 }
 
@@ -798,15 +982,85 @@ void TLS_Socket::closeConnection() {
  * @author Michele Crepaldi s269551
  */
 TLS_Socket::~TLS_Socket() {
+    _saveSession();     //keep the session to resume it on the next connection
+
     //the TCP socket will already be closed by the unique pointer
+    _ssl.reset();       //free the wolfSSL object before the cleanup
     wolfSSL_Cleanup();  //cleanup the wolfSSL library
 }
 
+/**
+ * TLS_Socket client context method
+ *
+ * @return the wolfSSL context shared by all the client sockets (it is created, loading the CA file, the first time)
+ *
+ * @throws SocketException:
+ *  <b>create</b> if there was an error in the initialization of the wolfSSL context or in loading the verifying CA
+ */
+WOLFSSL_CTX *TLS_Socket::_clientContext() {
+    static std::mutex mutex;    //mutex protecting the context creation
+    static tls_socket::UniquePtr<WOLFSSL_CTX> context;  //shared client context
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(context != nullptr)
+        return context.get();
+
+    //the context (and the saved session) outlive the sockets, so keep the wolfSSL library initialized
+    wolfSSL_Init();
+
+    //crete wolfSSL context by using wolfTLS client method
+    auto ctx = tls_socket::UniquePtr<WOLFSSL_CTX>(wolfSSL_CTX_new(wolfTLS_client_method()));
+    if(ctx.get() == nullptr)
+        throw SocketException("Error in initializing wolfSSL context", SocketError::create);
+
+    //load verify CA from the filesystem
+    if(wolfSSL_CTX_load_verify_locations(ctx.get(), Socket::_ca_file_path.c_str(), nullptr) != SSL_SUCCESS) {
+        std::stringstream errorMsg;
+        errorMsg << "Error loading " << Socket::_ca_file_path << ", please check the file.";
+        throw SocketException(errorMsg.str(), SocketError::create);
+    }
+
+    //set the TLS client to verify the server certificate
+    wolfSSL_CTX_set_verify(ctx.get(), SSL_VERIFY_PEER, nullptr);
+
+    //set the certificate verify depth into the CA
+    wolfSSL_CTX_set_verify_depth(ctx.get(), 1);
+
+#ifdef HAVE_SESSION_TICKET
+    //ask the server for session tickets (so that it does not have to keep the session to resume it)
+    wolfSSL_CTX_UseSessionTicket(ctx.get());
+#endif
+
+    context = std::move(ctx);
+    return context.get();
+}
+
+/**
+ * TLS_Socket save session method. Used by the client sockets to save the TLS session of the connection, so that the
+ *  next connection to the same server can resume it
+ */
+void TLS_Socket::_saveSession() {
+    //only the client sockets (connected to a server) resume their sessions
+    if(_ssl == nullptr || _server.empty())
+        return;
+
+    //session of the connection (nullptr if the handshake was not done)
+    auto session = tls_socket::UniquePtr<WOLFSSL_SESSION>(wolfSSL_get1_session(_ssl.get()));
+    if(session == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(_sessionMutex);
+    _session = std::move(session);
+    _sessionServer = std::move(_server);
+    _server.clear();
+}
+
 /**
  * TLS_ServerSocket constructor
  *
  * @param port port to use
  * @param n length of the listen queue
+ * @param reusePort whether to share the port with other server sockets (SO_REUSEPORT)
  *
  * @throws SocketException:
  *  <b>create</b> if it could not create the wolfSSL context, or it could not load the certificate or private key files
@@ -814,7 +1068,7 @@ TLS_Socket::~TLS_Socket() {
  *
  * @author Michele Crepaldi s269551
  */
-TLS_ServerSocket::TLS_ServerSocket(unsigned int port, unsigned int n) {
+TLS_ServerSocket::TLS_ServerSocket(unsigned int port, unsigned int n, bool reusePort) {
     //create a new wolfSSL context using the wolfTLS server method
     _ctx = tls_socket::UniquePtr<WOLFSSL_CTX>(wolfSSL_CTX_new(wolfTLS_server_method()));
 
@@ -845,7 +1099,10 @@ TLS_ServerSocket::TLS_ServerSocket(unsigned int port, unsigned int n) {
     //set the server to not ask the client for a certificate (no client TLS authentication)
     wolfSSL_CTX_set_verify(_ctx.get(), SSL_VERIFY_NONE, nullptr);
 
-    _serverSock = std::make_unique<TCP_ServerSocket>(port, n);  //create new TCP server socket
+    //the sessions of the clients are resumed from the server session cache (enabled by default in the context), so
+    //the server does not issue session tickets (wolfSSL_CTX_UseSessionTicket is the client side extension only)
+
+    _serverSock = std::make_unique<TCP_ServerSocket>(port, n, reusePort);  //create new TCP server socket
 }
 
 /**
@@ -879,6 +1136,16 @@ SocketBridge* TLS_ServerSocket::accept(struct sockaddr_in *addr, unsigned long *
     return new TLS_Socket(s->getSockfd(), ssl.release());
 }
 
+/**
+ * TLS_ServerSocket wait client method
+ *
+ * @param seconds maximum time to wait
+ * @return true if there is a client to accept, false if the time expired
+ */
+bool TLS_ServerSocket::waitClient(unsigned int seconds) {
+    return _serverSock->waitClient(seconds);
+}
+
 /**
  * TLS_ServerSocket destructor
  *
@@ -898,6 +1165,7 @@ TLS_ServerSocket::~TLS_ServerSocket() {
 //static variables declaration
 
 std::string Socket::_ca_file_path;
+size_t Socket::_max_frame_size = MAX_FRAME_SIZE;
 
 /**
  * Socket static method to set the certificate path for the client socket (TLS)
@@ -910,6 +1178,16 @@ void Socket::specifyCertificates(const std::string &ca_file_path){
     _ca_file_path = ca_file_path;
 }
 
+/**
+ * Socket static method to set the maximum size of a frame (message) that can be received;
+ *  frames announcing a bigger size are refused (this also protects against malicious peers)
+ *
+ * @param maxFrameSize maximum frame size (bytes)
+ */
+void Socket::setMaxFrameSize(size_t maxFrameSize){
+    _max_frame_size = maxFrameSize;
+}
+
 /**
  * Socket constructor with SocketBridge pointer
  *
@@ -998,6 +1276,58 @@ ssize_t Socket::sendString(std::string &stringBuffer) const {
     return _socket->sendString(stringBuffer);
 }
 
+/**
+ * Socket receive string method (reusing the memory already held by the given string)
+ *
+ * @param stringBuffer string where to put the data read from Socket
+ *
+ * @author Michele Crepaldi s269551
+*/
+void Socket::recvString(std::string &stringBuffer) const {
+    _socket->recvString(stringBuffer);
+}
+
+/**
+ * Socket receive string method that does not wait for the other party (the part of the frame received so far is
+ *  kept until the rest arrives; do not mix it with the other receive methods while a frame is incomplete)
+ *
+ * @param stringBuffer string where to put the data read from Socket (only if the whole frame was received)
+ * @return true if a whole frame was received, false if the rest of it has not arrived yet
+*/
+bool Socket::tryRecvString(std::string &stringBuffer) const {
+    return _socket->tryRecvString(stringBuffer);
+}
+
+/**
+ * Socket pending method
+ *
+ * @return number of bytes already received but not consumed yet
+ *  (if it is not 0 the next message may already be available: do not wait on select)
+ */
+size_t Socket::pending() const {
+    return _socket->pending();
+}
+
+/**
+ * Socket set timeout method. It sets the maximum time a send (or a receive which waits for the data) can wait for
+ *  the other party; after it the operation fails (so a peer which does not read, or does not send, cannot hold the
+ *  thread using the socket forever)
+ *
+ * @param seconds maximum time to wait (0 means no limit)
+ *
+ * @throws SocketException:
+ *  <b>create</b> if the timeout could not be set
+ */
+void Socket::setTimeout(unsigned int seconds) {
+    struct timeval timeout{};   //timeout to set
+    timeout.tv_sec = seconds;
+
+    int fd = getSockfd();   //socket file descriptor
+    if(::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+       ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0)
+        throw SocketException("Cannot set the socket timeout", SocketError::create);
+}
+
 /**
  * Socket (tcp) file descriptor getter method
  *
@@ -1073,14 +1403,16 @@ void ServerSocket::specifyCertificates(const std::string &certificate_path, cons
  *
  * @param port port to use
  * @param n length of the listen queue
+ * @param type type of the socket
+ * @param reusePort whether to share the port with other server sockets (each one will get part of the connections)
  *
  * @author Michele Crepaldi s269551
  */
-ServerSocket::ServerSocket(unsigned int port, unsigned int n, SocketType type) : Socket(type) {
+ServerSocket::ServerSocket(unsigned int port, unsigned int n, SocketType type, bool reusePort) : Socket(type) {
     if(type == SocketType::TCP)
-        _serverSocket = std::make_unique<TCP_ServerSocket>(port, n);
+        _serverSocket = std::make_unique<TCP_ServerSocket>(port, n, reusePort);
     else if(type == SocketType::TLS)
-        _serverSocket = std::make_unique<TLS_ServerSocket>(port, n);
+        _serverSocket = std::make_unique<TLS_ServerSocket>(port, n, reusePort);
 }
 
 /**
@@ -1123,3 +1455,13 @@ ServerSocket& ServerSocket::operator=(ServerSocket &&source) noexcept {
 Socket ServerSocket::accept(struct sockaddr_in *addr, unsigned long *len) {
     return Socket(_serverSocket->accept(addr, len));
 }
+
+/**
+ * ServerSocket wait client method
+ *
+ * @param seconds maximum time to wait
+ * @return true if there is a client to accept, false if the time expired
+ */
+bool ServerSocket::waitClient(unsigned int seconds) {
+    return _serverSocket->waitClient(seconds);
+}
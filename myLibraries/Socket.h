@@ -9,10 +9,17 @@
 
 #include <memory>
 #include <string>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
 #include <stdexcept>
 #include <wolfssl/options.h>
 #include <wolfssl/ssl.h>
 
+#define SOCKET_READ_BUFFER_SIZE 65536   //size (in bytes) of the per-connection read buffer
+
 
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
@@ -33,7 +40,10 @@ public:
     //pure abstract methods
     virtual void connect(const std::string& addr, unsigned int port) = 0;
     [[nodiscard]] virtual std::string recvString() const = 0;
+    virtual void recvString(std::string &stringBuffer) const = 0;
+    virtual bool tryRecvString(std::string &stringBuffer) const = 0;
     virtual ssize_t sendString(std::string &stringBuffer) const = 0;
+    [[nodiscard]] virtual size_t pending() const = 0;
     [[nodiscard]] virtual int getSockfd() const = 0;
     [[nodiscard]] virtual std::string getMAC() const = 0;
     [[nodiscard]] virtual std::string getIP() const = 0;
@@ -56,12 +66,146 @@ public:
  */
 class ServerSocketBridge : public virtual SocketBridge {
 public:
-    //pure abstract method
+    //pure abstract methods
     virtual SocketBridge* accept(struct sockaddr_in* addr, unsigned long* len) = 0;
+    virtual bool waitClient(unsigned int seconds) = 0;
     ~ServerSocketBridge() override = 0;
 };
 
 
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * ReadBuffer class
+ */
+
+/**
+ * ReadBuffer class. Per-connection receive buffer used by the socket implementations
+ *
+ *  <p>
+ *  The socket fills it with as many bytes as are available on the connection, so that many small frames
+ *  (e.g. PROB/OK messages) can be parsed out of a single read; requests bigger than the whole buffer bypass it
+ *  and are read directly into the destination.
+ *  The memory is allocated on the first read and then reused for the whole life of the connection.
+ *  </p>
+ *  <p>
+ *  A frame can also be assembled without waiting for the connection (readFrame): the part received so far is kept
+ *  here until the rest arrives. Do not mix the 2 ways of reading on the same connection while a frame is only
+ *  partially assembled.
+ *  </p>
+ */
+class ReadBuffer {
+public:
+    explicit ReadBuffer(size_t capacity) : _capacity(capacity), _start(0), _end(0) {}   //constructor with capacity
+
+    /**
+     * method used to get the number of bytes already received but not consumed yet
+     *
+     * @return number of buffered bytes
+     *
+     * @author Michele Crepaldi s269551
+     */
+    [[nodiscard]] size_t size() const {
+        return _end - _start;
+    }
+
+    /**
+     * method used to read exactly len bytes, refilling the buffer (with the fill function) when it gets empty
+     *
+     * @tparam F type of the fill function: ssize_t(char *buffer, size_t len); it must read at most len bytes
+     *  from the connection into buffer and return the number of bytes read (> 0) or throw
+     * @param dest buffer where to put the read data
+     * @param len number of bytes to read
+     * @param fill function used to get new data from the connection
+     */
+    template<typename F>
+    void read(char *dest, size_t len, F &&fill) {
+        size_t n = _take(dest, len);  //first consume what is already buffered
+        dest += n;
+        len -= n;
+
+        //here the buffer is empty (otherwise len would be 0)
+        while(len > 0) {
+            if(len >= _capacity) {
+                //the remaining data would not fit into the buffer anyway: avoid the double copy
+                n = fill(dest, len);
+            }
+            else {
+                if(_buffer.empty())
+                    _buffer.resize(_capacity);  //allocate the buffer on first use
+
+                //get as many bytes as are available (up to the buffer capacity)
+                _end = fill(_buffer.data(), _capacity);
+                n = _take(dest, len);
+            }
+
+            dest += n;
+            len -= n;
+        }
+    }
+
+    //read a whole frame without waiting for the connection method (defined after the SocketException class)
+    template<typename F>
+    bool readFrame(std::string &dest, size_t maxSize, F &&fill);
+
+private:
+    std::vector<char> _buffer;  //buffer memory
+    size_t _capacity;           //buffer capacity
+    size_t _start;              //position of the first not consumed byte
+    size_t _end;                //position after the last received byte
+
+    std::string _frame;                 //data of the frame being assembled (received so far)
+    char _header[sizeof(uint32_t)]{};   //data length of the frame being assembled (network byte order)
+    size_t _frameReceived = 0;          //bytes of the frame being assembled (data length included) received so far
+    size_t _frameLength = 0;            //data length of the frame being assembled
+
+    /**
+     * method used to read up to len bytes, consuming the buffered ones first and otherwise calling the fill function
+     *  once (it does not wait for the connection if the fill function does not)
+     *
+     * @tparam F type of the fill function (see readFrame)
+     * @param dest buffer where to put the read data
+     * @param len maximum number of bytes to read
+     * @param fill function used to get new data from the connection
+     * @return number of bytes read (0 if none was available)
+     */
+    template<typename F>
+    size_t _readSome(char *dest, size_t len, F &&fill) {
+        size_t n = _take(dest, len);  //first consume what is already buffered
+        if(n > 0)
+            return n;
+
+        if(len >= _capacity)
+            //the data would not fit into the buffer anyway: avoid the double copy
+            return fill(dest, len);
+
+        if(_buffer.empty())
+            _buffer.resize(_capacity);  //allocate the buffer on first use
+
+        //get as many bytes as are available (up to the buffer capacity)
+        _end = fill(_buffer.data(), _capacity);
+        return _take(dest, len);
+    }
+
+    /**
+     * method used to consume (up to len) already buffered bytes
+     *
+     * @param dest buffer where to put the data
+     * @param len maximum number of bytes to consume
+     * @return number of bytes consumed
+     */
+    size_t _take(char *dest, size_t len) {
+        size_t n = std::min(len, _end - _start);  //number of bytes to consume
+        if(n > 0)
+            memcpy(dest, _buffer.data() + _start, n);
+        _start += n;
+
+        if(_start == _end)  //buffer completely consumed: rewind it
+            _start = _end = 0;
+        return n;
+    }
+};
+
+
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
  * TCP_Socket class implementation
@@ -93,8 +237,11 @@ public:
     void connect(const std::string& addr, unsigned int port) override;  //connect method
     ssize_t read(char *buffer, size_t len, int options) const;          //read buffer method
     [[nodiscard]] std::string recvString() const override;              //receive string method
+    void recvString(std::string &stringBuffer) const override;          //receive string (into buffer) method
+    bool tryRecvString(std::string &stringBuffer) const override;       //receive string (without waiting) method
     ssize_t write(const char *buffer, size_t len, int options) const;   //write buffer method
     ssize_t sendString(std::string &stringBuffer) const override;       //send string method
+    [[nodiscard]] size_t pending() const override;                      //get number of buffered bytes method
 
     [[nodiscard]] int getSockfd() const override;       //get socket file descriptor method
     [[nodiscard]] std::string getMAC() const override;  //get MAC address of this machine's network card
@@ -104,6 +251,7 @@ public:
 
 private:
     int _sockfd;     //soket file descriptor
+    mutable ReadBuffer _readBuffer{SOCKET_READ_BUFFER_SIZE};    //per-connection read buffer
 
     explicit TCP_Socket(int sockfd);    //explicit constructor (from socket file descriptor)
 
@@ -126,10 +274,12 @@ private:
  */
 class TCP_ServerSocket: public ServerSocketBridge, public TCP_Socket{
 public:
-    TCP_ServerSocket(unsigned int port, unsigned int n);    //constructor with port and length of the listen queue
+    //constructor with port, length of the listen queue and whether to share the port with other server sockets
+    TCP_ServerSocket(unsigned int port, unsigned int n, bool reusePort = false);
     ~TCP_ServerSocket() override;   //destructor
 
     SocketBridge* accept(struct sockaddr_in* addr, unsigned long* len) override;    //accept method
+    bool waitClient(unsigned int seconds) override;     //wait for a client to accept method
 };
 
 
@@ -174,6 +324,16 @@ namespace tls_socket {
         void operator()(WOLFSSL_CTX *p) const { wolfSSL_CTX_free(p); }
     };
 
+    /**
+     * template specialization for the WOLFSSL_SESSION class
+     *
+     * @author Michele Crepaldi s269551
+     */
+    template<>
+    struct DeleterOf<WOLFSSL_SESSION> {
+        void operator()(WOLFSSL_SESSION *p) const { wolfSSL_SESSION_free(p); }
+    };
+
     /*
      * definition of the UniquePtr construct, it is simply a unique_ptr object with the deleter for the
      * wolfSSLType template class redefined
@@ -192,6 +352,10 @@ namespace tls_socket {
  *  It inherits publicly and virtually from SocketBridge interface
  *  </p>
  *  <p>
+ *  The client sockets share one wolfSSL context (the CA file is loaded only once) and resume the TLS session of the
+ *  previous connection to the same server, so reconnecting does not pay a full handshake
+ *  </p>
+ *  <p>
  *  <b>Not to be used directly
  *  </p>
  *
@@ -210,8 +374,11 @@ public:
     void connect(const std::string& addr, unsigned int port) override;  //connect method
     ssize_t read(char *buffer, size_t len) const;                       //read buffer method
     [[nodiscard]] std::string recvString() const override;              //receive string method
+    void recvString(std::string &stringBuffer) const override;          //receive string (into buffer) method
+    bool tryRecvString(std::string &stringBuffer) const override;       //receive string (without waiting) method
     ssize_t write(const char *buffer, size_t len) const;                //write buffer method
     ssize_t sendString(std::string &stringBuffer) const override;       //send string method
+    [[nodiscard]] size_t pending() const override;                      //get number of buffered bytes method
 
     [[nodiscard]] int getSockfd() const override;       //get socket file descriptor method
     [[nodiscard]] std::string getMAC() const override;  //get MAC address of this machine's network card
@@ -221,11 +388,21 @@ public:
 
 private:
     std::unique_ptr<TCP_Socket> _sock;          //unique pointer to the underlying TCP socket
-    tls_socket::UniquePtr<WOLFSSL_CTX> _ctx;    //Unique pointer to WOLFSSL_CTX
+    tls_socket::UniquePtr<WOLFSSL_CTX> _ctx;    //Unique pointer to WOLFSSL_CTX (server sockets only)
     tls_socket::UniquePtr<WOLFSSL> _ssl;        //Unique pointer to WOLFSSL
+    mutable ReadBuffer _readBuffer{SOCKET_READ_BUFFER_SIZE};    //per-connection read buffer (of decrypted data)
+    mutable std::vector<char> _writeBuffer;                     //per-connection write buffer (one record per frame)
+    std::string _server;    //server (address:port) the client socket is connected to
+
+    static std::mutex _sessionMutex;    //mutex protecting the saved session
+    static tls_socket::UniquePtr<WOLFSSL_SESSION> _session;    //session of the last connection (to resume it)
+    static std::string _sessionServer;  //server (address:port) of the saved session
 
     TLS_Socket(int sockfd, WOLFSSL *ssl);   //constructor (from socket file descriptor and WOLFSSL object)
 
+    static WOLFSSL_CTX *_clientContext();   //get the (shared) client context method
+    void _saveSession();    //save the session (to resume it on the next connection) method
+
     friend class TLS_ServerSocket;
 };
 
@@ -244,10 +421,12 @@ private:
  */
 class TLS_ServerSocket: public ServerSocketBridge, public TLS_Socket{
 public:
-    explicit TLS_ServerSocket(unsigned int port, unsigned int n);   //constructor with port and length of the listen queue
+    //constructor with port, length of the listen queue and whether to share the port with other server sockets
+    TLS_ServerSocket(unsigned int port, unsigned int n, bool reusePort = false);
     ~TLS_ServerSocket() override;   //destructor
 
     SocketBridge* accept(struct sockaddr_in* addr, unsigned long* len) override;    //accept method
+    bool waitClient(unsigned int seconds) override;     //wait for a client to accept method
 
 private:
     std::unique_ptr<TCP_ServerSocket> _serverSock;   //unique pointer to the underlying TCP server socket
@@ -290,6 +469,7 @@ enum class SocketType{
 class Socket {
 public:
     static void specifyCertificates(const std::string &cacert);
+    static void setMaxFrameSize(size_t maxFrameSize);
 
     Socket(const Socket &) = delete;                //delete copy constructor
     Socket& operator=(const Socket &) = delete;     //delete copy assignment
@@ -302,7 +482,11 @@ public:
 
     void connect(const std::string& addr, unsigned int port);   //connect method
     [[nodiscard]] std::string recvString() const;               //receive string method
+    void recvString(std::string &stringBuffer) const;           //receive string (into buffer) method
+    bool tryRecvString(std::string &stringBuffer) const;        //receive string (without waiting) method
     ssize_t sendString(std::string &stringBuffer) const;        //send string method
+    [[nodiscard]] size_t pending() const;                       //get number of buffered bytes method
+    void setTimeout(unsigned int seconds);                      //set the send/receive timeout method
 
     [[nodiscard]] int getSockfd() const;    //get socket file descriptor method
     [[nodiscard]] std::string getMAC();     //get MAC address of this machine's network card
@@ -319,8 +503,10 @@ private:
     explicit Socket(SocketBridge *sb);  //explicit constructor with pointer to SocketBridge object
 
     static std::string _ca_file_path;    //path to the certification authority file
+    static size_t _max_frame_size;       //maximum size of a received frame (message)
 
     friend class ServerSocket;
+    friend class TCP_Socket;
     friend class TLS_Socket;
 };
 
@@ -345,8 +531,8 @@ public:
     //specify certificates methods
     static void specifyCertificates(const std::string &cert, const std::string &prikey, const std::string &cacert);
 
-    //constructor with port, length of the listen queue and type
-    ServerSocket(unsigned int port, unsigned int n, SocketType type);
+    //constructor with port, length of the listen queue, type and whether to share the port with other server sockets
+    ServerSocket(unsigned int port, unsigned int n, SocketType type, bool reusePort = false);
 
     ServerSocket(const ServerSocket &other) = delete;               //delete copy constructor
     ServerSocket& operator=(const ServerSocket& source) = delete;   //delete copy assignment
@@ -355,6 +541,7 @@ public:
     ServerSocket& operator=(ServerSocket &&source) noexcept;    //move assignment
 
     Socket accept(struct sockaddr_in* addr, unsigned long* len);    //accept method
+    bool waitClient(unsigned int seconds);      //wait for a client to accept method
 
 private:
     std::unique_ptr<ServerSocketBridge> _serverSocket;   //unique pointer to ServerSocketBridge object
@@ -445,4 +632,73 @@ private:
     SocketError _code;   //code describing the error
 };
 
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * ReadBuffer template methods
+ */
+
+/**
+ * method used to read a whole frame (data length, 4 bytes in network byte order, followed by the data) without
+ *  waiting for the connection: the part of the frame received so far is kept in this buffer until the rest arrives
+ *  (the frame memory grows with the received data, not with the announced length)
+ *
+ * @tparam F type of the fill function: ssize_t(char *buffer, size_t len); it must read at most len bytes from the
+ *  connection into buffer without waiting and return the number of bytes read (0 if none is available now) or throw
+ * @param dest string where to put the frame data (only when the whole frame has been received)
+ * @param maxSize maximum data length of a frame
+ * @param fill function used to get new data from the connection
+ * @return true if a whole frame was received (and put into dest), false if the rest of it has not arrived yet
+ *  (then no byte is left in the buffer)
+ *
+ * @throws SocketException:
+ *  <b>read</b> if the frame is bigger than the maximum frame size
+ */
+template<typename F>
+bool ReadBuffer::readFrame(std::string &dest, size_t maxSize, F &&fill) {
+    while(true) {
+        if(_frameReceived < sizeof(uint32_t)) {
+            //receive first the data length
+            size_t n = _readSome(_header + _frameReceived, sizeof(uint32_t) - _frameReceived, fill);
+            if(n == 0)
+                return false;
+
+            _frameReceived += n;
+            if(_frameReceived < sizeof(uint32_t))
+                continue;
+
+            //(network byte order)
+            _frameLength = static_cast<size_t>(static_cast<unsigned char>(_header[0])) << 24 |
+                           static_cast<size_t>(static_cast<unsigned char>(_header[1])) << 16 |
+                           static_cast<size_t>(static_cast<unsigned char>(_header[2])) << 8 |
+                           static_cast<size_t>(static_cast<unsigned char>(_header[3]));
+
+            //the length comes from the other party: do not trust it
+            if(_frameLength > maxSize)
+                throw SocketException("Read from socket error, frame is bigger than the maximum frame size",
+                                      SocketError::read);
+        }
+
+        size_t received = _frameReceived - sizeof(uint32_t);  //data bytes received so far
+        if(received == _frameLength) {
+            //frame complete: hand it out (the string taken in exchange keeps its memory for the next frame)
+            _frame.resize(_frameLength);
+            dest.swap(_frame);
+            _frameReceived = 0;
+            return true;
+        }
+
+        //make room for (at most) another buffer worth of data
+        size_t target = std::min(_frameLength, received + _capacity);
+        if(_frame.size() < target)
+            _frame.resize(target);
+
+        size_t n = _readSome(_frame.data() + received, target - received, fill);
+        if(n == 0)
+            return false;
+
+        _frameReceived += n;
+    }
+}
+
 #endif //SOCKET_H
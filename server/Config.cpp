@@ -37,6 +37,70 @@
 //So, keeping in mind that there are also other fields in the message, KEEP IT BELOW (or equal) 15KB.
 #define MAX_DATA_CHUNK_SIZE 15360   //now set to 15KB
 
+//Maximum size (in bytes) of a received message (frame); bigger frames are refused and the connection is closed.
+//KEEP IT ABOVE max_data_chunk_size (the DATA messages also carry the other fields and the file path).
+#define MAX_FRAME_SIZE 1048576     //now set to 1MB
+
+//Number of file blocks (of max_data_chunk_size bytes) read ahead while sending a file, so that reading the file
+//and sending it overlap.
+#define READ_AHEAD_BUFFERS 8        //now set to 8 blocks
+
+//Number of disk/database worker threads; the file writes, renames and database updates are done by these threads,
+//so that a slow disk (or a locked database) does not stall the server threads reading from the sockets.
+#define DISK_THREADS 4              //now set to 4 threads
+
+//Maximum number of operations (file chunks to write, messages to complete) queued for each disk/database thread;
+//when it is full the server thread reading the socket waits, so it also bounds the memory used by the queued chunks.
+#define DISK_QUEUE_SIZE 64          //now set to 64 operations
+
+//Seconds between 2 subsequent prints of the server queues depths (connections waiting for a server thread and
+//operations waiting for a disk/database thread).
+#define STATS_SECONDS 60            //now set to 60 seconds
+
+//Number of server shards; each shard has its own listening socket (sharing the port with SO_REUSEPORT), accepting
+//thread, poller (pinned to a core), server threads and disk/database threads, so only the databases are shared.
+//n_threads, socket_queue_size, disk_threads, disk_queue_size and retrieve_threads are per shard.
+#define SHARDS 1                    //now set to 1 shard
+
+//Seconds a session token is valid; a client reconnecting with a valid token is not authenticated with the password
+//again.
+#define SESSION_TOKEN_SECONDS 300   //now set to 5 minutes
+
+//Maximum time (in milliseconds) a database mutation (insert, update or remove) waits for other mutations to be
+//committed in the same transaction; the mutations of all the clients are committed together (group commit), so they
+//share the same disk sync.
+#define GROUP_COMMIT_MS 5           //now set to 5 milliseconds
+
+//Maximum number of database mutations committed in the same transaction.
+#define GROUP_COMMIT_ROWS 256       //now set to 256 mutations
+
+//Number of user databases kept open (the most recently used ones); each user has its own database file (with its own
+//connection and lock), the others are closed as soon as no session is using them.
+#define DATABASE_HANDLES 32         //now set to 32 databases
+
+//Seconds a session (the state of a user-mac pair, with its map of saved elements) is kept loaded after its last
+//connection is closed, so a client reconnecting in the meantime does not recover it from the database again.
+#define SESSION_IDLE_SECONDS 300    //now set to 5 minutes
+
+//Memory budget (in MiB) of the sessions kept loaded without connections; when it is exceeded the least recently used
+//ones are released (the sessions in use are never released).
+#define SESSION_CACHE_MB 256        //now set to 256 MiB
+
+//Maximum rate (in MiB/s) at which the scrubber reads the saved files to verify their content against their hashes (so
+//it does not take the disk bandwidth needed to serve the clients).
+#define SCRUB_MB_PER_SECOND 8       //now set to 8 MiB/s
+
+//Hours after which the content of a saved file is verified again by the scrubber.
+#define SCRUB_INTERVAL_HOURS 168    //now set to 1 week
+
+//Number of retrieve worker threads; a retrieve (RETR) sends all the files of the user, so it is served by one of
+//these threads instead of a server thread (a long restore does not take a server thread away from the other clients).
+#define RETRIEVE_THREADS 2          //now set to 2 threads
+
+//Maximum number of digests of the files already present on the client accepted with a retrieve (RETR); they are kept
+//in memory until the last RETR message arrives, a retrieve with more of them is refused.
+#define MAX_PRESENT_DIGESTS 1048576 //now set to 1Mi digests
+
 
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
@@ -201,7 +265,7 @@ void server::Config::_load() {
                                             "# Password Database path"},
 
                                         {"server_database_path",    DATABASE_PATH,
-                                            "# Server Database path"},
+                                            "# Server Database path (the user databases are in the directory with \".d\" appended)"},
 
                                         {"certificate_path",        CERTIFICATE_PATH,
                                             "# Server Certificate path"},
@@ -237,7 +301,56 @@ void server::Config::_load() {
                                             " it is 1GB,\n"
                                             "# and for a TLS socket it is 16KB.\n"
                                             "# So, keeping in mind that there are also other fields in the message,\n"
-                                            "# KEEP IT BELOW (or equal) 15KB."}};
+                                            "# KEEP IT BELOW (or equal) 15KB."},
+
+                                        {"max_frame_size",          std::to_string(MAX_FRAME_SIZE),
+                                            "# Maximum size (in bytes) of a received message (frame): bigger frames are refused\n"
+                                            "# KEEP IT ABOVE max_data_chunk_size (plus the size of a path)."},
+
+                                        {"read_ahead_buffers",      std::to_string(READ_AHEAD_BUFFERS),
+                                            "# Number of file blocks (of max_data_chunk_size bytes) read ahead while sending a file"},
+
+                                        {"disk_threads",            std::to_string(DISK_THREADS),
+                                            "# Number of disk/database worker threads (file writes, renames and database updates)"},
+
+                                        {"disk_queue_size",         std::to_string(DISK_QUEUE_SIZE),
+                                            "# Maximum number of operations queued for each disk/database thread"},
+
+                                        {"stats_seconds",           std::to_string(STATS_SECONDS),
+                                            "# Seconds between 2 subsequent prints of the server queues depths"},
+
+                                        {"shards",                  std::to_string(SHARDS),
+                                            "# Number of server shards (each one with its own listening socket, poller and threads)"},
+
+                                        {"session_token_seconds",   std::to_string(SESSION_TOKEN_SECONDS),
+                                            "# Seconds a session token (issued after authentication, to skip it when reconnecting) is valid"},
+
+                                        {"group_commit_ms",         std::to_string(GROUP_COMMIT_MS),
+                                            "# Maximum time (in milliseconds) a database mutation waits for others to be committed in the same transaction"},
+
+                                        {"group_commit_rows",       std::to_string(GROUP_COMMIT_ROWS),
+                                            "# Maximum number of database mutations committed in the same transaction"},
+
+                                        {"database_handles",        std::to_string(DATABASE_HANDLES),
+                                            "# Number of user databases (one for each user) kept open"},
+
+                                        {"session_idle_seconds",    std::to_string(SESSION_IDLE_SECONDS),
+                                            "# Seconds a session (the user-mac state) is kept loaded after its last connection is closed"},
+
+                                        {"session_cache_mb",        std::to_string(SESSION_CACHE_MB),
+                                            "# Memory budget (in MiB) of the sessions kept loaded without connections"},
+
+                                        {"scrub_mb_per_second",     std::to_string(SCRUB_MB_PER_SECOND),
+                                            "# Maximum rate (in MiB/s) at which the scrubber reads the saved files to verify them"},
+
+                                        {"scrub_interval_hours",    std::to_string(SCRUB_INTERVAL_HOURS),
+                                            "# Hours after which the content of a saved file is verified again by the scrubber"},
+
+                                        {"retrieve_threads",        std::to_string(RETRIEVE_THREADS),
+                                            "# Number of retrieve worker threads (each one sending the files of a client retrieving them)"},
+
+                                        {"max_present_digests",     std::to_string(MAX_PRESENT_DIGESTS),
+                                            "# Maximum number of digests of the files already present on the client accepted with a retrieve"}};
 
         //comments on top of the file
         std::string initial_comments[] = {          "###########################################################################",
@@ -355,6 +468,38 @@ void server::Config::_load() {
                         _tmp_file_name_size = static_cast<unsigned int>(stoul(value));
                     else if (key == "max_data_chunk_size")
                         _max_data_chunk_size = static_cast<unsigned int>(stoul(value));
+                    else if (key == "max_frame_size")
+                        _max_frame_size = static_cast<unsigned int>(stoul(value));
+                    else if (key == "read_ahead_buffers")
+                        _read_ahead_buffers = static_cast<unsigned int>(stoul(value));
+                    else if (key == "disk_threads")
+                        _disk_threads = static_cast<unsigned int>(stoul(value));
+                    else if (key == "disk_queue_size")
+                        _disk_queue_size = static_cast<unsigned int>(stoul(value));
+                    else if (key == "stats_seconds")
+                        _stats_seconds = static_cast<unsigned int>(stoul(value));
+                    else if (key == "shards")
+                        _shards = static_cast<unsigned int>(stoul(value));
+                    else if (key == "session_token_seconds")
+                        _session_token_seconds = static_cast<unsigned int>(stoul(value));
+                    else if (key == "group_commit_ms")
+                        _group_commit_ms = static_cast<unsigned int>(stoul(value));
+                    else if (key == "group_commit_rows")
+                        _group_commit_rows = static_cast<unsigned int>(stoul(value));
+                    else if (key == "database_handles")
+                        _database_handles = static_cast<unsigned int>(stoul(value));
+                    else if (key == "session_idle_seconds")
+                        _session_idle_seconds = static_cast<unsigned int>(stoul(value));
+                    else if (key == "session_cache_mb")
+                        _session_cache_mb = static_cast<unsigned int>(stoul(value));
+                    else if (key == "scrub_mb_per_second")
+                        _scrub_mb_per_second = static_cast<unsigned int>(stoul(value));
+                    else if (key == "scrub_interval_hours")
+                        _scrub_interval_hours = static_cast<unsigned int>(stoul(value));
+                    else if (key == "retrieve_threads")
+                        _retrieve_threads = static_cast<unsigned int>(stoul(value));
+                    else if (key == "max_present_digests")
+                        _max_present_digests = static_cast<unsigned int>(stoul(value));
                 }
             }
         }
@@ -588,4 +733,195 @@ unsigned int server::Config::getMaxDataChunkSize() {
         _max_data_chunk_size = MAX_DATA_CHUNK_SIZE;
 
     return _max_data_chunk_size;
+}
+
+/**
+ * max frame size getter method (if no value was provided in the config file use a default one)
+ *
+ * @return max frame size
+ */
+unsigned int server::Config::getMaxFrameSize() {
+    if(_max_frame_size == 0)
+        _max_frame_size = MAX_FRAME_SIZE;
+
+    return _max_frame_size;
+}
+
+/**
+ * read ahead buffers getter method (if no value was provided in the config file use a default one)
+ *
+ * @return read ahead buffers
+ */
+unsigned int server::Config::getReadAheadBuffers() {
+    if(_read_ahead_buffers == 0)
+        _read_ahead_buffers = READ_AHEAD_BUFFERS;
+
+    return _read_ahead_buffers;
+}
+
+/**
+ * disk threads getter method (if no value was provided in the config file use a default one)
+ *
+ * @return disk threads
+ */
+unsigned int server::Config::getDiskThreads() {
+    if(_disk_threads == 0)
+        _disk_threads = DISK_THREADS;
+
+    return _disk_threads;
+}
+
+/**
+ * disk queue size getter method (if no value was provided in the config file use a default one)
+ *
+ * @return disk queue size
+ */
+unsigned int server::Config::getDiskQueueSize() {
+    if(_disk_queue_size == 0)
+        _disk_queue_size = DISK_QUEUE_SIZE;
+
+    return _disk_queue_size;
+}
+
+/**
+ * stats seconds getter method (if no value was provided in the config file use a default one)
+ *
+ * @return stats seconds
+ */
+unsigned int server::Config::getStatsSeconds() {
+    if(_stats_seconds == 0)
+        _stats_seconds = STATS_SECONDS;
+
+    return _stats_seconds;
+}
+
+/**
+ * shards getter method (if no value was provided in the config file use a default one)
+ *
+ * @return shards
+ */
+unsigned int server::Config::getShards() {
+    if(_shards == 0)
+        _shards = SHARDS;
+
+    return _shards;
+}
+
+/**
+ * session token seconds getter method (if no value was provided in the config file use a default one)
+ *
+ * @return session token seconds
+ */
+unsigned int server::Config::getSessionTokenSeconds() {
+    if(_session_token_seconds == 0)
+        _session_token_seconds = SESSION_TOKEN_SECONDS;
+
+    return _session_token_seconds;
+}
+
+/**
+ * group commit ms getter method (if no value was provided in the config file use a default one)
+ *
+ * @return group commit ms
+ */
+unsigned int server::Config::getGroupCommitMs() {
+    if(_group_commit_ms == 0)
+        _group_commit_ms = GROUP_COMMIT_MS;
+
+    return _group_commit_ms;
+}
+
+/**
+ * group commit rows getter method (if no value was provided in the config file use a default one)
+ *
+ * @return group commit rows
+ */
+unsigned int server::Config::getGroupCommitRows() {
+    if(_group_commit_rows == 0)
+        _group_commit_rows = GROUP_COMMIT_ROWS;
+
+    return _group_commit_rows;
+}
+
+/**
+ * database handles getter method (if no value was provided in the config file use a default one)
+ *
+ * @return database handles
+ */
+unsigned int server::Config::getDatabaseHandles() {
+    if(_database_handles == 0)
+        _database_handles = DATABASE_HANDLES;
+
+    return _database_handles;
+}
+
+/**
+ * session idle seconds getter method (if no value was provided in the config file use a default one)
+ *
+ * @return session idle seconds
+ */
+unsigned int server::Config::getSessionIdleSeconds() {
+    if(_session_idle_seconds == 0)
+        _session_idle_seconds = SESSION_IDLE_SECONDS;
+
+    return _session_idle_seconds;
+}
+
+/**
+ * session cache mb getter method (if no value was provided in the config file use a default one)
+ *
+ * @return session cache mb
+ */
+unsigned int server::Config::getSessionCacheMb() {
+    if(_session_cache_mb == 0)
+        _session_cache_mb = SESSION_CACHE_MB;
+
+    return _session_cache_mb;
+}
+
+/**
+ * scrub mb per second getter method (if no value was provided in the config file use a default one)
+ *
+ * @return scrub mb per second
+ */
+unsigned int server::Config::getScrubMbPerSecond() {
+    if(_scrub_mb_per_second == 0)
+        _scrub_mb_per_second = SCRUB_MB_PER_SECOND;
+
+    return _scrub_mb_per_second;
+}
+
+/**
+ * scrub interval hours getter method (if no value was provided in the config file use a default one)
+ *
+ * @return scrub interval hours
+ */
+unsigned int server::Config::getScrubIntervalHours() {
+    if(_scrub_interval_hours == 0)
+        _scrub_interval_hours = SCRUB_INTERVAL_HOURS;
+
+    return _scrub_interval_hours;
+}
+
+/**
+ * retrieve threads getter method (if no value was provided in the config file use a default one)
+ *
+ * @return retrieve threads
+ */
+unsigned int server::Config::getRetrieveThreads() {
+    if(_retrieve_threads == 0)
+        _retrieve_threads = RETRIEVE_THREADS;
+
+    return _retrieve_threads;
+}
+/**
+ * max present digests getter method (if no value was provided in the config file use a default one)
+ *
+ * @return max present digests
+ */
+unsigned int server::Config::getMaxPresentDigests() {
+    if(_max_present_digests == 0)
+        _max_present_digests = MAX_PRESENT_DIGESTS;
+
+    return _max_present_digests;
 }
\ No newline at end of file
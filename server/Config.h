@@ -81,6 +81,22 @@ namespace server {
         unsigned int getTimeoutSeconds();
         unsigned int getTmpFileNameSize();
         unsigned int getMaxDataChunkSize();
+        unsigned int getMaxFrameSize();
+        unsigned int getReadAheadBuffers();
+        unsigned int getDiskThreads();
+        unsigned int getDiskQueueSize();
+        unsigned int getStatsSeconds();
+        unsigned int getShards();
+        unsigned int getSessionTokenSeconds();
+        unsigned int getGroupCommitMs();
+        unsigned int getGroupCommitRows();
+        unsigned int getDatabaseHandles();
+        unsigned int getSessionIdleSeconds();
+        unsigned int getSessionCacheMb();
+        unsigned int getScrubMbPerSecond();
+        unsigned int getScrubIntervalHours();
+        unsigned int getRetrieveThreads();
+        unsigned int getMaxPresentDigests();
 
     protected:
         //protected constructor
@@ -115,6 +131,22 @@ namespace server {
         unsigned int _timeout_seconds{};
         unsigned int _tmp_file_name_size{};
         unsigned int _max_data_chunk_size{};
+        unsigned int _max_frame_size{};
+        unsigned int _read_ahead_buffers{};
+        unsigned int _disk_threads{};
+        unsigned int _disk_queue_size{};
+        unsigned int _stats_seconds{};
+        unsigned int _shards{};
+        unsigned int _session_token_seconds{};
+        unsigned int _group_commit_ms{};
+        unsigned int _group_commit_rows{};
+        unsigned int _database_handles{};
+        unsigned int _session_idle_seconds{};
+        unsigned int _session_cache_mb{};
+        unsigned int _scrub_mb_per_second{};
+        unsigned int _scrub_interval_hours{};
+        unsigned int _retrieve_threads{};
+        unsigned int _max_present_digests{};
 
         //config file load function
         void _load();
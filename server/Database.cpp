@@ -8,24 +8,75 @@
 
 #include <filesystem>
 #include <fstream>
+#include <sys/stat.h>
+#include <ctime>
 
 #include "../myLibraries/RandomNumberGenerator.h"
+#include "Config.h"
+
+#define SCHEMA_VERSION 3    //version of the database schema (stored as the database user_version)
 
 
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Stat struct methods
+ */
+
+/**
+ * Stat of method. Used to get the stat tuple of a file
+ *
+ * @param path path of the file
+ *
+ * @return stat tuple of the file (all zeros if the file cannot be accessed, which never matches a stored one)
+ */
+server::Stat server::Stat::of(const std::string &path) {
+    struct stat st{};   //file status
+
+    if(::stat(path.c_str(), &st) != 0)
+        return Stat{0, 0};
+
+    return Stat{static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+                static_cast<uint64_t>(st.st_ino)};
+}
+
+/**
+ * Stat operator== override
+ *
+ * @param other other stat tuple to compare
+ *
+ * @return true if the tuples are equal, false otherwise
+ */
+bool server::Stat::operator==(const Stat &other) const {
+    return mtimeNs == other.mtimeNs && inode == other.inode;
+}
+
+/**
+ * Stat operator!= override
+ *
+ * @param other other stat tuple to compare
+ *
+ * @return true if the tuples are different, false otherwise
+ */
+bool server::Stat::operator!=(const Stat &other) const {
+    return !(*this == other);
+}
+
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
  * Database class methods
  */
 
 //static variable definition
-std::shared_ptr<server::Database> server::Database::database_;
 std::mutex server::Database::mutex_;
+std::unordered_map<std::string, std::weak_ptr<server::Database>> server::Database::open_;
+std::list<std::shared_ptr<server::Database>> server::Database::recent_;
 std::string server::Database::path_;
 
 /**
  * Database class path_ variable setter
  *
- * @param path path of the database on disk
+ * @param path path of the (old) shared database on disk; the user databases are in the directory with the same
+ *  path and ".d" appended
  *
  * @author Michele Crepaldi s269551
  */
@@ -34,32 +85,246 @@ void server::Database::setPath(std::string path){
 }
 
 /**
- * Database class singleton instance getter method
+ * Database class split shared method. Used to split the (old) shared database, with the elements of all the users,
+ *  into the user databases (if there is one); the shared database file is then renamed (adding ".split"), to be
+ *  kept as a backup
  *
- * @return Database instance
+ * @throws DatabaseException:
+ *  <b>path</b> if no path was set before this call
+ * @throws DatabaseException:
+ *  <b>migrate</b> if the shared database could not be split
+ */
+void server::Database::splitShared() {
+    if(path_.empty())   //a path must be previously set
+        throw DatabaseException("No path set", DatabaseError::path);
+
+    if(!std::filesystem::exists(path_))
+        return;
+
+    std::vector<std::string> users; //users with elements in the shared database
+    {
+        Database shared{path_};     //shared database (migrated to the current schema if needed)
+
+        std::lock_guard<std::mutex> lock(shared._access_mutex);
+
+        //get all the users (the table is ordered by username)
+        sqlite3_stmt* stmt = shared._statement("SELECT DISTINCT username FROM savedFiles;");
+
+        int rc; //sqlite3 methods' return code
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            users.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        shared._handleSQLError(rc, SQLITE_DONE, "Cannot read table: ", DatabaseError::migrate);
+
+        for(auto &username : users) {
+            //create the user database (if it does not exist)
+            getInstance(username);
+
+            std::string path = _pathOf(username);   //path of the user database
+
+            //attach the user database to the shared database connection
+            stmt = shared._statement("ATTACH DATABASE ? AS user;");
+            rc = sqlite3_bind_text(stmt, 1, path.c_str(), path.length(), SQLITE_TRANSIENT);
+            shared._handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+            rc = sqlite3_step(stmt);
+            shared._handleSQLError(rc, SQLITE_DONE, "Cannot attach the user database: ", DatabaseError::migrate);
+
+            //copy the user's rows into it
+            stmt = shared._statement("INSERT OR REPLACE INTO user.savedFiles SELECT * FROM savedFiles "
+                                     "WHERE username=?;");
+            rc = sqlite3_bind_text(stmt, 1, username.c_str(), username.length(), SQLITE_TRANSIENT);
+            shared._handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+            rc = sqlite3_step(stmt);
+            shared._handleSQLError(rc, SQLITE_DONE, "Cannot copy the user's rows: ", DatabaseError::migrate);
+
+            //then detach it
+            stmt = shared._statement("DETACH DATABASE user;");
+            rc = sqlite3_step(stmt);
+            shared._handleSQLError(rc, SQLITE_DONE, "Cannot detach the user database: ", DatabaseError::migrate);
+        }
+    }
+
+    //keep the shared database as a backup
+    std::filesystem::rename(path_, path_ + ".split");
+    std::filesystem::remove(path_ + "-wal");
+    std::filesystem::remove(path_ + "-shm");
+}
+
+/**
+ * Database class (user) instance getter method. The database is opened (and created if it does not exist) the first
+ *  time, then it is kept open by the registry while it is among the database_handles most recently used ones (or
+ *  while some session is using it)
+ *
+ * @param username username of the user
+ *
+ * @return user Database instance
+ *
+ * @throws DatabaseException:
+ *  <b>path</b> if no path was set before this call
  *
  * @author Michele Crepaldi s269551
  */
-std::shared_ptr<server::Database> server::Database::getInstance() {
+std::shared_ptr<server::Database> server::Database::getInstance(const std::string &username) {
+    if(path_.empty())   //a path must be previously set
+        throw DatabaseException("No path set", DatabaseError::path);
+
+    unsigned int handles = Config::getInstance()->getDatabaseHandles(); //number of databases kept open
+
     std::lock_guard<std::mutex> lock(mutex_);
-    if(database_ == nullptr) //first time, or when it was released from everybody
-        database_ = std::shared_ptr<Database>(new Database());  //create the database object
-    return database_;
+
+    auto database = open_[username].lock(); //user database
+    if(database == nullptr) { //first time, or when it was released from everybody
+        database = std::shared_ptr<Database>(new Database(_pathOf(username)));  //open the database
+        open_[username] = database;
+    }
+
+    //move the database to the front of the recently used ones
+    if(database->_cached)
+        recent_.splice(recent_.begin(), recent_, database->_recent);
+    else {
+        recent_.push_front(database);
+        database->_recent = recent_.begin();
+        database->_cached = true;
+    }
+
+    //close the least recently used databases (they are actually closed when the sessions using them release them)
+    while(recent_.size() > handles) {
+        auto &last = recent_.back();    //least recently used database
+        last->_cached = false;
+        recent_.pop_back();
+    }
+
+    //forget the databases closed
+    for(auto it = open_.begin(); it != open_.end();){
+        if(it->second.expired())
+            it = open_.erase(it);
+        else
+            ++it;
+    }
+
+    return database;
 }
 
 /**
- * (protected) constructor of the database object
+ * Database class (user) uncached instance getter method. Used by the background tasks (which go through all the
+ *  users): the database already open is shared, otherwise it is opened only for the caller (it is closed as soon as
+ *  the caller releases it, unless in the meantime some session started using it); the databases kept open by the
+ *  registry (and their order) are not changed
+ *
+ * @param username username of the user
+ *
+ * @return user Database instance
  *
  * @throws DatabaseException:
  *  <b>path</b> if no path was set before this call
+ */
+std::shared_ptr<server::Database> server::Database::getUncachedInstance(const std::string &username) {
+    if(path_.empty())   //a path must be previously set
+        throw DatabaseException("No path set", DatabaseError::path);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto database = open_[username].lock(); //user database
+    if(database == nullptr) { //not open: open it (without keeping it open)
+        database = std::shared_ptr<Database>(new Database(_pathOf(username)));
+        open_[username] = database;
+    }
+
+    return database;
+}
+
+/**
+ * Database class users getter method. Used to get the users which have a database
  *
- * @author Michele Crepaldi s269551
+ * @return vector of the usernames
+ *
+ * @throws DatabaseException:
+ *  <b>path</b> if no path was set before this call
+ */
+std::vector<std::string> server::Database::getUsers() {
+    if(path_.empty())   //a path must be previously set
+        throw DatabaseException("No path set", DatabaseError::path);
+
+    std::filesystem::path directory{_directory()};  //directory of the user databases
+
+    std::vector<std::string> users; //users with a database
+    if(!std::filesystem::is_directory(directory))
+        return users;
+
+    for(auto &entry : std::filesystem::directory_iterator(directory))
+        if(entry.is_regular_file() && entry.path().extension() == ".sqlite")
+            users.emplace_back(entry.path().stem().string());
+
+    return users;
+}
+
+/**
+ * Database class user database existence check method. Used to know whether a user has a database, without creating
+ *  it (as getting its instance would)
+ *
+ * @param username username of the user
+ *
+ * @return true if the user has a database, false otherwise
+ *
+ * @throws DatabaseException:
+ *  <b>path</b> if no path was set before this call
  */
-server::Database::Database() {
+bool server::Database::exists(const std::string &username) {
     if(path_.empty())   //a path must be previously set
         throw DatabaseException("No path set", DatabaseError::path);
 
+    return std::filesystem::is_regular_file(_pathOf(username));
+}
+
+/**
+ * Database class path of a user database getter method
+ *
+ * @param username username of the user
+ *
+ * @return path of the user database file
+ */
+std::string server::Database::_pathOf(const std::string &username) {
+    return (std::filesystem::path{_directory()} / (username + ".sqlite")).string();
+}
+
+/**
+ * Database class directory of the user databases getter method; it is a sibling of the shared database file (its
+ *  path with ".d" appended), so it never collides with it (even if the path has no extension)
+ *
+ * @return path of the directory of the user databases
+ */
+std::string server::Database::_directory() {
+    return path_ + ".d";
+}
+
+/**
+ * (protected) constructor of the database object; it opens the database and starts the committer thread
+ *
+ * @param path path of the database file
+ *
+ * @author Michele Crepaldi s269551
+ */
+server::Database::Database(std::string path) : _path(std::move(path)) {
     _open();   //open the database from file
+
+    auto config = Config::getInstance();    //config object instance
+    _groupCommitMs = config->getGroupCommitMs();        //get max time a mutation waits for the others
+    _groupCommitRows = config->getGroupCommitRows();    //get max number of mutations committed together
+
+    _committer = std::thread(&Database::_commitLoop, this);
+}
+
+/**
+ * destructor of the database object; it stops the committer thread (after it committed the mutations left)
+ */
+server::Database::~Database() {
+    {
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        _stop = true;
+    }
+    _queued.notify_all();
+
+    if(_committer.joinable())
+        _committer.join();
 }
 
 /**
@@ -87,13 +352,15 @@ void server::Database::_handleSQLError(int rc, int check, std::string &&message,
 }
 
 /**
- * method used to open the connection to a sqlite3 database; if the database already exists then it opens it,
- *  otherwise it also creates the needed table
+ * method used to open the connection to a sqlite3 database; if the database already exists then it opens it (and
+ *  migrates it if it uses an old schema), otherwise it also creates the needed table
  *
  * @throws DatabaseException:
  *  <b>open</b> if the database could not be opened
  * @throws DatabaseException:
  *  <b>create</b> if the (new) database could not be created
+ * @throws DatabaseException:
+ *  <b>migrate</b> if the (old schema) database could not be migrated
  *
  * @author Michele Crepaldi s269551
  */
@@ -102,47 +369,210 @@ void server::Database::_open() {
 
     //check if the db already exists before opening it (create a new db if none is found)
 
-    bool dbExists = std::filesystem::exists(path_);
+    bool dbExists = std::filesystem::exists(_path);
 
     if(!dbExists){ //if the file does not exist create it
         std::ofstream f;
-        std::filesystem::path p{path_};
-        auto parent = p.parent_path();  //parent path of path_
+        std::filesystem::path p{_path};
+        auto parent = p.parent_path();  //parent path of _path
 
         //create all the directories (if they do not already exist) up to the parent path
         std::filesystem::create_directories(parent);
 
-        f.open(path_, std::ios::out | std::ios::trunc);  //create the file
+        f.open(_path, std::ios::out | std::ios::trunc);  //create the file
         f.close();  //close the file
     }
 
     //open the database
 
     sqlite3 *dbTmp; //pointer to the sqlite3 db
-    rc = sqlite3_open(path_.c_str(), &dbTmp);   //open the database
+    rc = sqlite3_open(_path.c_str(), &dbTmp);   //open the database
     _db.reset(dbTmp);   //assign the newly opened db to the _db smart pointer
 
     _handleSQLError(rc, SQLITE_OK, "Cannot open database: ", DatabaseError::open);
 
+    //use the write-ahead log: the readers do not block the writer, and a commit only appends to the log (with
+    //synchronous FULL, the default, each commit is still durable)
+    rc = sqlite3_exec(_db.get(), "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot set the journal mode: ", DatabaseError::open);
+
     //if the db is new then create the table inside it
     if(!dbExists){
-        //"CREATE" SQL statement
-        std::string sql = "CREATE TABLE savedFiles ("
-                          "id INTEGER,"
-                          "username TEXT,"
-                          "mac TEXT,"
-                          "path TEXT,"
-                          "size INTEGER,"
-                          "type TEXT,"
-                          "lastWriteTime TEXT,"
-                          "hash TEXT,"
-                          "PRIMARY KEY(id AUTOINCREMENT));";
-
-        //Execute SQL statement
+        _createTable("savedFiles");
+        _createIndex();
+
+        //set the schema version
+        std::string sql = "PRAGMA user_version = " + std::to_string(SCHEMA_VERSION) + ";";
         rc = sqlite3_exec(_db.get(), sql.c_str(), nullptr, nullptr, nullptr);
+        _handleSQLError(rc, SQLITE_OK, "Cannot set the schema version: ", DatabaseError::create);
 
-        _handleSQLError(rc, SQLITE_OK, "Cannot create table: ", DatabaseError::create);
+        return;
     }
+
+    //otherwise check the schema version of the db (the ones created before the versioning have version 0)
+
+    sqlite3_stmt* stmt; //statement handle
+    rc = sqlite3_prepare_v2(_db.get(), "PRAGMA user_version;", -1, &stmt, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
+
+    rc = sqlite3_step(stmt);
+    _handleSQLError(rc, SQLITE_ROW, "Cannot read the schema version: ", DatabaseError::read);
+    int version = sqlite3_column_int(stmt, 0);  //schema version of the db
+
+    //finalize statement handle
+    sqlite3_finalize(stmt);
+
+    //if the db uses an old schema migrate it
+    if(version < SCHEMA_VERSION)
+        _migrate(version);
+}
+
+/**
+ * method used to create the table of the saved elements.
+ *  <p> Its primary key is the (username, mac, path) triple, so every element is saved only once and the table is
+ *  stored (without rowid) ordered by it: all the elements of a user-mac pair are contiguous, and reading, updating
+ *  or removing them does not scan the other users' ones. The hashes are stored as blobs (as they are used in the
+ *  program); the stat tuple (mtimeNs, inode) of the server copy of each file is stored too (0 if unknown), and the
+ *  last time (seconds since epoch) its content was verified against its hash
+ *
+ * @param name name of the table to create
+ *
+ * @throws DatabaseException:
+ *  <b>create</b> if the table could not be created
+ */
+void server::Database::_createTable(const std::string &name) {
+    //"CREATE" SQL statement
+    std::string sql = "CREATE TABLE " + name + " ("
+                      "username TEXT NOT NULL,"
+                      "mac TEXT NOT NULL,"
+                      "path TEXT NOT NULL,"
+                      "size INTEGER,"
+                      "type TEXT,"
+                      "lastWriteTime TEXT,"
+                      "hash BLOB,"
+                      "mtimeNs INTEGER NOT NULL DEFAULT 0,"
+                      "inode INTEGER NOT NULL DEFAULT 0,"
+                      "verifiedAt INTEGER NOT NULL DEFAULT 0,"
+                      "PRIMARY KEY(username, mac, path)) WITHOUT ROWID;";
+
+    //Execute SQL statement
+    int rc = sqlite3_exec(_db.get(), sql.c_str(), nullptr, nullptr, nullptr);  //sqlite3 methods' return code
+
+    _handleSQLError(rc, SQLITE_OK, "Cannot create table: ", DatabaseError::create);
+}
+
+/**
+ * method used to create the index of the saved elements by last verification time (used by the scrubber to find the
+ *  files to verify first)
+ *
+ * @throws DatabaseException:
+ *  <b>create</b> if the index could not be created
+ */
+void server::Database::_createIndex() {
+    int rc = sqlite3_exec(_db.get(), "CREATE INDEX IF NOT EXISTS savedFiles_verifiedAt ON savedFiles(verifiedAt);",
+                          nullptr, nullptr, nullptr);  //sqlite3 methods' return code
+
+    _handleSQLError(rc, SQLITE_OK, "Cannot create index: ", DatabaseError::create);
+}
+
+/**
+ * method used to migrate a database with an old schema to the current one:
+ *  <ul>
+ *      <li> from version 0 (autoincrement id and hex hashes) all the rows are copied into a new table (in id order,
+ *      so for the elements saved more than once the last row is kept), which then replaces the old one
+ *      <li> from version 1 the stat tuple columns are added (the stat tuples are unknown, so every file is hashed
+ *      once during the next recovery)
+ *      <li> from version 2 the last verification time column is added (every file is verified by the scrubber)
+ *  </ul>
+ *  The migration is done in a single transaction, so if it fails the database is left as it was
+ *
+ * @param version schema version of the database
+ *
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statements could not be prepared
+ * @throws DatabaseException:
+ *  <b>create</b> if the new table could not be created
+ * @throws DatabaseException:
+ *  <b>migrate</b> if the rows could not be copied or the new table could not replace the old one
+ */
+void server::Database::_migrate(int version) {
+    int rc; //sqlite3 methods' return code
+
+    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
+
+    if(version >= 1) {
+        std::string sql;    //columns to add
+
+        if(version < 2)     //add the stat tuple columns
+            sql += "ALTER TABLE savedFiles ADD COLUMN mtimeNs INTEGER NOT NULL DEFAULT 0;"
+                   "ALTER TABLE savedFiles ADD COLUMN inode INTEGER NOT NULL DEFAULT 0;";
+
+        //add the last verification time column and set the schema version
+        sql += "ALTER TABLE savedFiles ADD COLUMN verifiedAt INTEGER NOT NULL DEFAULT 0;"
+               "PRAGMA user_version = " + std::to_string(SCHEMA_VERSION) + ";";
+
+        rc = sqlite3_exec(_db.get(), sql.c_str(), nullptr, nullptr, nullptr);
+        _handleSQLError(rc, SQLITE_OK, "Cannot add the new columns: ", DatabaseError::migrate);
+
+        _createIndex();
+
+        rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
+        _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::migrate);
+
+        return;
+    }
+
+    //create the new table
+    _createTable("savedFiles_new");
+
+    sqlite3_stmt* select;   //(old rows) select statement handle
+    sqlite3_stmt* insert;   //(new rows) insert statement handle
+
+    rc = sqlite3_prepare_v2(_db.get(), "SELECT username, mac, path, size, type, lastWriteTime, hash "
+                                       "FROM savedFiles ORDER BY id;", -1, &select, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
+
+    rc = sqlite3_prepare_v2(_db.get(), "INSERT OR REPLACE INTO savedFiles_new "
+                                       "(username, mac, path, size, type, lastWriteTime, hash) "
+                                       "VALUES (?,?,?,?,?,?,?);", -1, &insert, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
+
+    //copy all the rows (converting the hashes from hex to bitstring representation)
+    while((rc = sqlite3_step(select)) == SQLITE_ROW) {
+        //text columns (the old rows may have null columns)
+        for(int i : {0, 1, 2, 4, 5}) {
+            auto text = reinterpret_cast<const char *>(sqlite3_column_text(select, i));   //column value
+            sqlite3_bind_text(insert, i + 1, text == nullptr ? "" : text, -1, SQLITE_TRANSIENT);
+        }
+        sqlite3_bind_int64(insert, 4, sqlite3_column_int64(select, 3));
+
+        auto hashHex = reinterpret_cast<const char *>(sqlite3_column_text(select, 6));  //hex representation
+        std::string hash = RandomNumberGenerator::hex_to_string(hashHex == nullptr ? "" : hashHex);
+        sqlite3_bind_blob(insert, 7, hash.data(), hash.size(), SQLITE_TRANSIENT);
+
+        rc = sqlite3_step(insert);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot copy row into the new table: ", DatabaseError::migrate);
+        sqlite3_reset(insert);
+    }
+    _handleSQLError(rc, SQLITE_DONE, "Cannot read table: ", DatabaseError::migrate);
+
+    //finalize statement handles
+    sqlite3_finalize(select);
+    sqlite3_finalize(insert);
+
+    //replace the old table with the new one and set the schema version
+    std::string sql = "DROP TABLE savedFiles;"
+                      "ALTER TABLE savedFiles_new RENAME TO savedFiles;"
+                      "PRAGMA user_version = " + std::to_string(SCHEMA_VERSION) + ";";
+
+    rc = sqlite3_exec(_db.get(), sql.c_str(), nullptr, nullptr, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot replace the old table: ", DatabaseError::migrate);
+
+    _createIndex();
+
+    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::migrate);
 }
 
 /**
@@ -156,35 +586,24 @@ void server::Database::_open() {
  *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
  * @throws DatabaseException:
  *  <b>read</b> if the database could not be read
- * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
  *
  * @author Michele Crepaldi s269551
  */
 void server::Database::forAll(const std::string &username, const std::string &mac,
                 const std::function<void (const std::string &, const std::string &,
-                uintmax_t, const std::string &, const std::string &)> &f) {
+                uintmax_t, const std::string &, const std::string &, const Stat &)> &f) {
 
     std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
 
     int rc; //sqlite3 methods' return code
-    sqlite3_stmt* stmt; //statement handle
-
-    //"SELECT" SQL statement
-    std::string sql = "SELECT path, type, size, lastWriteTime, hash FROM savedFiles WHERE username=? AND mac=?;";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
+    //(cached) prepared "SELECT" SQL statement
+    sqlite3_stmt* stmt = _statement("SELECT path, type, size, lastWriteTime, hash, mtimeNs, inode FROM savedFiles "
+                                    "WHERE username=? AND mac=?;");
 
     //bind parameters
-    sqlite3_bind_text(stmt, 1, username.c_str(), username.length(), SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt, 1, username.c_str(), username.length(), SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt, 2, mac.c_str(), mac.length(), SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt, 2, mac.c_str(), mac.length(), SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
 
 
@@ -201,20 +620,17 @@ void server::Database::forAll(const std::string &username, const std::string &ma
                 //element type
                 std::string type = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
                 //element size
-                uintmax_t size = sqlite3_column_int(stmt, 2);
+                uintmax_t size = sqlite3_column_int64(stmt, 2);
                 //element last write time
                 std::string lastWriteTime = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)));
-                //hex representation of the element hash
-                std::string hashHex = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4)));
-
-                //convert hash from hex representation (as it is stored in the database)
-                //to bitstring representation (as it is used in the program)
-
-                //bitstring representation of the element hash
-                std::string hash = RandomNumberGenerator::hex_to_string(hashHex);
+                //element hash (stored as it is used in the program)
+                std::string hash = std::string(reinterpret_cast<const char *>(sqlite3_column_blob(stmt, 4)),
+                                               sqlite3_column_bytes(stmt, 4));
+                //stat tuple of the server copy of the element
+                Stat stat{sqlite3_column_int64(stmt, 5), static_cast<uint64_t>(sqlite3_column_int64(stmt, 6))};
 
                 //use provided function
-                f(path, type, size, lastWriteTime, hash);
+                f(path, type, size, lastWriteTime, hash, stat);
                 break;
             }
 
@@ -231,86 +647,71 @@ void server::Database::forAll(const std::string &username, const std::string &ma
                 throw DatabaseException(tmp.str(), DatabaseError::read);
         }
     }
-
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
-
-    //finalize statement handle
-    sqlite3_finalize(stmt);
 }
 
 /**
- * method used to insert a new element in the database for a specified user-mac pair
+ * method used to apply a provided function to a batch of rows of the database for a specified user-mac pair: the
+ *  rows are taken in path order (so every directory comes before the elements in it), starting after a path. It is
+ *  used as a cursor, reading the rows some at a time (passing the last path of a batch to get the next one) so the
+ *  database is locked only while reading a batch
  *
  * @param username username
  * @param mac mac address of the client host
- * @param path path of the element to be inserted
- * @param type type of the element to be inserted
- * @param size size of the element to be inserted
- * @param lastWriteTime last write time of the element to be inserted
+ * @param after path after which to start (the empty string to start from the first row)
+ * @param limit maximum number of rows of the batch
+ * @param f function to be used for each row extracted from the database
+ *
+ * @return number of rows of the batch (less than limit if it is the last one)
  *
  * @throws DatabaseException:
  *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
  * @throws DatabaseException:
- *  <b>insert</b> if the row could not be inserted into the database
- * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
+ *  <b>read</b> if the database could not be read
  *
  * @author Michele Crepaldi s269551
  */
-void server::Database::insert(const std::string &username, const std::string &mac,
-                              const std::string &path, const std::string &type,
-                              uintmax_t size, const std::string &lastWriteTime, const std::string &hash) {
+unsigned int server::Database::forAll(const std::string &username, const std::string &mac, const std::string &after,
+                unsigned int limit, const std::function<void (const std::string &, const std::string &,
+                uintmax_t, const std::string &, const std::string &, const Stat &)> &f) {
 
     std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
 
     int rc; //sqlite3 methods' return code
-
-    //convert hash from bitstring representation (as it is used in the program)
-    //to hex representation (as it is stored in the database)
-
-    std::string hashHex = RandomNumberGenerator::string_to_hex(hash);   //hex representation of the element hash
-
-    sqlite3_stmt* stmt; //statement handle
-
-    //"INSERT" SQL statement
-    std::string sql = "INSERT OR REPLACE INTO savedFiles (username, mac, path, type, size, lastWriteTime, hash) VALUES (?,?,?,?,?,?,?);";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
+    //(cached) prepared "SELECT" SQL statement (a range of the primary key)
+    sqlite3_stmt* stmt = _statement("SELECT path, type, size, lastWriteTime, hash, mtimeNs, inode FROM savedFiles "
+                                    "WHERE username=? AND mac=? AND path>? ORDER BY path LIMIT ?;");
 
     //bind parameters
-    sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt, 1, username.c_str(), username.length(), SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,2,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt, 2, mac.c_str(), mac.length(), SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,3,path.c_str(),path.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt, 3, after.c_str(), after.length(), SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,4,type.c_str(),type.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_int64(stmt,5,size);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,6,lastWriteTime.c_str(),lastWriteTime.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,7,hashHex.c_str(),hashHex.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_int64(stmt, 4, limit);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
 
-    //execute SQL statement
-    rc = sqlite3_step(stmt);    //execute the one (and only) step of this statement on the database
-    _handleSQLError(rc, SQLITE_DONE, "Cannot insert into savedFiles table: ", DatabaseError::insert);
+    unsigned int count = 0; //number of rows of the batch
 
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
+    //loop over the rows
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        //get column values from the row (and convert them)
 
-    //finalize statement handle
-    sqlite3_finalize(stmt);
+        std::string path = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        std::string type = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+        uintmax_t size = sqlite3_column_int64(stmt, 2);
+        std::string lastWriteTime = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)));
+        std::string hash = std::string(reinterpret_cast<const char *>(sqlite3_column_blob(stmt, 4)),
+                                       sqlite3_column_bytes(stmt, 4));
+        Stat stat{sqlite3_column_int64(stmt, 5), static_cast<uint64_t>(sqlite3_column_int64(stmt, 6))};
+
+        //use provided function
+        f(path, type, size, lastWriteTime, hash, stat);
+        count++;
+    }
+    _handleSQLError(rc, SQLITE_DONE, "Cannot read table: ", DatabaseError::read);
+
+    return count;
 }
 
 /**
@@ -318,6 +719,71 @@ void server::Database::insert(const std::string &username, const std::string &ma
  *
  * @param username username
  * @param mac mac address of the client host
+ * @param path path of the element to be inserted
+ * @param type type of the element to be inserted
+ * @param size size of the element to be inserted
+ * @param lastWriteTime last write time of the element to be inserted
+ * @param hash hash of the element to be inserted
+ * @param stat stat tuple of the server copy of the element to be inserted
+ *
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
+ * @throws DatabaseException:
+ *  <b>insert</b> if the row could not be inserted into the database
+ * @throws DatabaseException:
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
+ *
+ * @author Michele Crepaldi s269551
+ */
+void server::Database::insert(const std::string &username, const std::string &mac,
+                              const std::string &path, const std::string &type,
+                              uintmax_t size, const std::string &lastWriteTime, const std::string &hash,
+                              const Stat &stat) {
+
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "INSERT" SQL statement
+        sqlite3_stmt* stmt = _statement("INSERT OR REPLACE INTO savedFiles "
+                                        "(username, mac, path, type, size, lastWriteTime, hash, mtimeNs, inode, "
+                                        "verifiedAt) VALUES (?,?,?,?,?,?,?,?,?,?);");
+
+        //bind parameters
+        rc = sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,path.c_str(),path.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,4,type.c_str(),type.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,5,size);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,6,lastWriteTime.c_str(),lastWriteTime.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_blob(stmt,7,hash.data(),hash.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,8,stat.mtimeNs);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,9,static_cast<sqlite3_int64>(stat.inode));
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,10,std::time(nullptr));   //the hash was just computed from the content
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);    //execute the one (and only) step of this statement on the database
+        _handleSQLError(rc, SQLITE_DONE, "Cannot insert into savedFiles table: ", DatabaseError::insert);
+    });
+}
+
+/**
+ * method used to insert a new element in the database for a specified user-mac pair (the stat tuple of its server
+ *  copy is read from the filesystem)
+ *
+ * @param username username
+ * @param mac mac address of the client host
  * @param d Directory_entry to be inserted
  *
  * @author Michele Crepaldi s269551
@@ -329,8 +795,11 @@ void server::Database::insert(const std::string &username, const std::string &ma
     else
         type = "directory";
 
+    //stat tuple of the server copy of the element (only the files have one)
+    Stat stat = d.getType() == Directory_entry_TYPE::file ? Stat::of(d.getAbsolutePath()) : Stat{0, 0};
+
     //insert the element into the database
-    insert(username, mac, d.getRelativePath(), type, d.getSize(), d.getLastWriteTime(), d.getHash().str());
+    insert(username, mac, d.getRelativePath(), type, d.getSize(), d.getLastWriteTime(), d.getHash().str(), stat);
 }
 
 /**
@@ -345,46 +814,90 @@ void server::Database::insert(const std::string &username, const std::string &ma
  * @throws DatabaseException:
  *  <b>remove</b> if the row could not be removed from the database
  * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
  *
  * @author Michele Crepaldi s269551
  */
 void server::Database::remove(const std::string &username, const std::string &mac, const std::string &path) {
-    std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
-
-    int rc;  //sqlite3 methods' return code
-
-    sqlite3_stmt* stmt;  //statement handle
-
-    //"DELETE" SQL statement
-    std::string sql =   "DELETE FROM savedFiles WHERE path=? AND username=? AND mac=?;";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
-
-    //bind parameters
-    sqlite3_bind_text(stmt,1,path.c_str(),path.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,2,username.c_str(),username.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,3,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-
-    //execute SQL statement
-    rc = sqlite3_step(stmt);
-    _handleSQLError(rc, SQLITE_DONE, "Cannot delete row from savedFiles table: ", DatabaseError::remove);
-
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "DELETE" SQL statement
+        sqlite3_stmt* stmt = _statement("DELETE FROM savedFiles WHERE path=? AND username=? AND mac=?;");
+
+        //bind parameters
+        rc = sqlite3_bind_text(stmt,1,path.c_str(),path.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot delete row from savedFiles table: ", DatabaseError::remove);
+    });
+}
 
-    //finalize statement handle
-    sqlite3_finalize(stmt);
+/**
+ * method used to remove a directory and everything in it from the database for a specified user-mac pair; the
+ *  elements in it are all the paths starting with the directory path followed by '/', so they are a single range
+ *  of the table (which is ordered by path for each user-mac pair)
+ *
+ * @param username username
+ * @param mac mac address of the client host
+ * @param path path of the directory to be removed
+ *
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
+ * @throws DatabaseException:
+ *  <b>remove</b> if the rows could not be removed from the database
+ * @throws DatabaseException:
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
+ */
+void server::Database::removeDir(const std::string &username, const std::string &mac, const std::string &path) {
+    std::string first = path + "/";     //first path of the range (included)
+    std::string last = path + "0";      //last path of the range (excluded); '0' is the character after '/'
+
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "DELETE" SQL statement for the elements in the directory
+        sqlite3_stmt* stmt = _statement("DELETE FROM savedFiles WHERE username=? AND mac=? AND path>=? AND path<?;");
+
+        //bind parameters
+        rc = sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,first.c_str(),first.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,4,last.c_str(),last.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot delete rows from savedFiles table: ", DatabaseError::remove);
+
+        //(cached) prepared "DELETE" SQL statement for the directory itself
+        stmt = _statement("DELETE FROM savedFiles WHERE path=? AND username=? AND mac=?;");
+
+        //bind parameters
+        rc = sqlite3_bind_text(stmt,1,path.c_str(),path.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot delete row from savedFiles table: ", DatabaseError::remove);
+    });
 }
 
 /**
@@ -397,42 +910,28 @@ void server::Database::remove(const std::string &username, const std::string &ma
  * @throws DatabaseException:
  *  <b>remove</b> if the rows could not be removed from the database
  * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
  *
  * @author Michele Crepaldi s269551
  */
 void server::Database::removeAll(const std::string &username){
-    std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
-
-    int rc; //sqlite3 methods' return code
-
-    sqlite3_stmt* stmt; //statement handle
-
-    //"DELETE" SQL statement
-    std::string sql =   "DELETE FROM savedFiles WHERE username=?;";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
-
-    //bind parameter
-    sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-
-    //execute SQL statement
-    rc = sqlite3_step(stmt);
-    _handleSQLError(rc, SQLITE_DONE, "Cannot remove (user) entries from savedFiles table: ", DatabaseError::remove);
-
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
-
-    //finalize statement handle
-    sqlite3_finalize(stmt);
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "DELETE" SQL statement
+        sqlite3_stmt* stmt = _statement("DELETE FROM savedFiles WHERE username=?;");
+
+        //bind parameter
+        rc = sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot remove (user) entries from savedFiles table: ",
+                        DatabaseError::remove);
+    });
 }
 
 /**
@@ -446,44 +945,30 @@ void server::Database::removeAll(const std::string &username){
  * @throws DatabaseException:
  *  <b>remove</b> if the rows could not be removed from the database
  * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
  *
  * @author Michele Crepaldi s269551
  */
 void server::Database::removeAll(const std::string &username, const std::string &mac){
-    std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
-
-    int rc; //sqlite3 methods' return code
-
-    sqlite3_stmt* stmt; //statement handle
-
-    //"DELETE" SQL statement
-    std::string sql =   "DELETE FROM savedFiles WHERE username=? AND mac=?;";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
-
-    //bind parameter
-    sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,2,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-
-    //execute SQL statement
-    rc = sqlite3_step(stmt);
-    _handleSQLError(rc, SQLITE_DONE, "Cannot remove (user-mac) entries from savedFiles table: ", DatabaseError::remove);
-
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
-
-    //finalize statement handle
-    sqlite3_finalize(stmt);
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "DELETE" SQL statement
+        sqlite3_stmt* stmt = _statement("DELETE FROM savedFiles WHERE username=? AND mac=?;");
+
+        //bind parameter
+        rc = sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot remove (user-mac) entries from savedFiles table: ",
+                        DatabaseError::remove);
+    });
 }
 
 /**
@@ -497,8 +982,6 @@ void server::Database::removeAll(const std::string &username, const std::string
  *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
  * @throws DatabaseException:
  *  <b>read</b> if the database could not be read
- * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
  *
  * @author Michele Crepaldi s269551
  */
@@ -507,21 +990,11 @@ std::vector<std::string> server::Database::getAllMacAddresses(const std::string
 
     int rc; //sqlite3 methods' return code
 
-    sqlite3_stmt* stmt; //statement handle
-
-    //"SELECT" SQL statement
-    std::string sql = "SELECT DISTINCT mac FROM savedFiles WHERE username=?;";
-
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
-
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
+    //(cached) prepared "SELECT" SQL statement
+    sqlite3_stmt* stmt = _statement("SELECT DISTINCT mac FROM savedFiles WHERE username=?;");
 
     //bind parameters
-    sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_text(stmt,1,username.c_str(),username.length(),SQLITE_TRANSIENT);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
 
 
@@ -552,13 +1025,6 @@ std::vector<std::string> server::Database::getAllMacAddresses(const std::string
         }
     }
 
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
-
-    //finalize statement handle
-    sqlite3_finalize(stmt);
-
     //return (by moving it) the vector of mac addresses for the provided user
     return std::move(macAddrs);
 }
@@ -572,86 +1038,302 @@ std::vector<std::string> server::Database::getAllMacAddresses(const std::string
  * @param type type of the element to be updated
  * @param size size of the element to be updated
  * @param lastWriteTime last write time of the element to be updated
+ * @param hash hash of the element to be updated
+ * @param stat stat tuple of the server copy of the element to be updated
  *
  * @throws DatabaseException:
  *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
  * @throws DatabaseException:
  *  <b>update</b> if the element could not be updated in the database
  * @throws DatabaseException:
- *  <b>finalize</b> if the sql statement could not be finalized
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
  *
  * @author Michele Crepaldi s269551
  */
 void server::Database::update(const std::string &username, const std::string &mac,
                               const std::string &path, const std::string &type, uintmax_t size,
-                              const std::string &lastWriteTime, const std::string &hash) {
-
-    std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
-
-    int rc; //sqlite3 methods' return code
+                              const std::string &lastWriteTime, const std::string &hash, const Stat &stat) {
+
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "UPDATE" SQL statement
+        sqlite3_stmt* stmt = _statement("UPDATE savedFiles SET size=?, type=?, lastWriteTime=?, hash=?, mtimeNs=?, "
+                                        "inode=?, verifiedAt=? WHERE path=? AND username=? AND mac=?;");
+
+        //bind parameters
+        rc = sqlite3_bind_int64(stmt,1,size);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,type.c_str(),type.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,lastWriteTime.c_str(),lastWriteTime.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_blob(stmt,4,hash.data(),hash.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,5,stat.mtimeNs);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,6,static_cast<sqlite3_int64>(stat.inode));
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_int64(stmt,7,std::time(nullptr));    //the hash was just computed from the content
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,8,path.c_str(),path.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,9,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,10,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot update row in savedFiles table: ", DatabaseError::update);
+    });
+}
 
-    //convert hash from bitstring representation (as it is used in the program)
-    //to hex representation (as it is stored in the database)
+/**
+ * method used to update an element of the database for a specified user-mac pair (the stat tuple of its server
+ *  copy is read from the filesystem)
+ *
+ * @param username username
+ * @param mac mac address of the client host
+ * @param d Directory_entry element to be updated
+ *
+ * @author Michele Crepaldi s269551
+ */
+void server::Database::update(const std::string &username, const std::string &mac, Directory_entry &d) {
+    std::string type;
+    if(d.getType() == Directory_entry_TYPE::file)   //if the element is a file
+        type = "file";
+    else
+        type = "directory";
 
-    std::string hashHex = RandomNumberGenerator::string_to_hex(hash);   //hex representation of the element hash
+    //stat tuple of the server copy of the element (only the files have one)
+    Stat stat = d.getType() == Directory_entry_TYPE::file ? Stat::of(d.getAbsolutePath()) : Stat{0, 0};
 
-    sqlite3_stmt* stmt; //statement handle
+    //update the element in the database
+    update(username, mac, d.getRelativePath(), type, d.getSize(), d.getLastWriteTime(), d.getHash().str(), stat);
+}
 
-    //"UPDATE" SQL statement
-    std::string sql =   "UPDATE savedFiles SET size=?, type=?, lastWriteTime=?, hash=? WHERE path=? AND username=? AND mac=?;";
+/**
+ * method used to apply a provided function to the files (of any user-mac pair) whose content was verified the least
+ *  recently, if it was verified before a time
+ *
+ * @param before time (seconds since epoch) before which the files have to be verified again
+ * @param limit maximum number of files
+ * @param f function to be used for each file (with its username, mac, path, size, hash and stat tuple)
+ *
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
+ * @throws DatabaseException:
+ *  <b>read</b> if the database could not be read
+ */
+void server::Database::forUnverified(int64_t before, unsigned int limit,
+                const std::function<void(const std::string &, const std::string &, const std::string &,
+                uintmax_t, const std::string &, const Stat &)> &f) {
 
-    //prepare SQL statement
-    rc = sqlite3_prepare_v2(_db.get(), sql.c_str(), -1, &stmt, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
+    std::lock_guard<std::mutex> lock(_access_mutex);    //lock guard on _access_mutex to ensure thread safeness
 
-    //begin the transaction (will most likely increase performance)
-    rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot begin transaction: ", DatabaseError::prepare);
+    int rc; //sqlite3 methods' return code
+    //(cached) prepared "SELECT" SQL statement (it uses the index by last verification time)
+    sqlite3_stmt* stmt = _statement("SELECT username, mac, path, size, hash, mtimeNs, inode FROM savedFiles "
+                                    "WHERE verifiedAt<? AND type='file' ORDER BY verifiedAt LIMIT ?;");
 
     //bind parameters
-    sqlite3_bind_int64(stmt,1,size);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,2,type.c_str(),type.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,3,lastWriteTime.c_str(),lastWriteTime.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,4,hashHex.c_str(),hashHex.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,5,path.c_str(),path.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_int64(stmt, 1, before);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,6,username.c_str(),username.length(),SQLITE_TRANSIENT);
-    _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
-    sqlite3_bind_text(stmt,7,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+    rc = sqlite3_bind_int64(stmt, 2, limit);
     _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
 
-    //execute SQL statement
-    rc = sqlite3_step(stmt);
-    _handleSQLError(rc, SQLITE_DONE, "Cannot update row in savedFiles table: ", DatabaseError::update);
+    //loop over the rows
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        //get column values from the row (and convert them)
 
-    //end the transaction
-    rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
-    _handleSQLError(rc, SQLITE_OK, "Cannot end the transaction: ", DatabaseError::finalize);
+        std::string username = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        std::string mac = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+        std::string path = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)));
+        uintmax_t size = sqlite3_column_int64(stmt, 3);
+        std::string hash = std::string(reinterpret_cast<const char *>(sqlite3_column_blob(stmt, 4)),
+                                       sqlite3_column_bytes(stmt, 4));
+        Stat stat{sqlite3_column_int64(stmt, 5), static_cast<uint64_t>(sqlite3_column_int64(stmt, 6))};
 
-    //finalize statement handle
-    sqlite3_finalize(stmt);
+        //use provided function
+        f(username, mac, path, size, hash, stat);
+    }
+    _handleSQLError(rc, SQLITE_DONE, "Cannot read table: ", DatabaseError::read);
 }
 
 /**
- * method used to update an element of the database for a specified user-mac pair
+ * method used to record the last time the content of a file was verified (against its hash)
  *
  * @param username username
  * @param mac mac address of the client host
- * @param d Directory_entry element to be updated
+ * @param path path of the file
+ * @param verifiedAt time (seconds since epoch) of the verification
  *
- * @author Michele Crepaldi s269551
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statement could not be prepared (or there is an error in some parameter binding)
+ * @throws DatabaseException:
+ *  <b>update</b> if the element could not be updated in the database
+ * @throws DatabaseException:
+ *  <b>finalize</b> if the transaction (with the mutation) could not be committed
  */
-void server::Database::update(const std::string &username, const std::string &mac, Directory_entry &d) {
-    std::string type;
-    if(d.getType() == Directory_entry_TYPE::file)   //if the element is a file
-        type = "file";
-    else
-        type = "directory";
+void server::Database::setVerified(const std::string &username, const std::string &mac, const std::string &path,
+                                   int64_t verifiedAt) {
+
+    //queue the mutation: it is committed (by the committer thread) together with the ones queued in the meantime,
+    //and this call returns once it is durable
+    _commit([&](){
+        int rc; //sqlite3 methods' return code
+
+        //(cached) prepared "UPDATE" SQL statement
+        sqlite3_stmt* stmt = _statement("UPDATE savedFiles SET verifiedAt=? WHERE path=? AND username=? AND mac=?;");
+
+        //bind parameters
+        rc = sqlite3_bind_int64(stmt,1,verifiedAt);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,2,path.c_str(),path.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,3,username.c_str(),username.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+        rc = sqlite3_bind_text(stmt,4,mac.c_str(),mac.length(),SQLITE_TRANSIENT);
+        _handleSQLError(rc, SQLITE_OK, "Cannot bind the parameters: ", DatabaseError::prepare);
+
+        //execute SQL statement
+        rc = sqlite3_step(stmt);
+        _handleSQLError(rc, SQLITE_DONE, "Cannot update row in savedFiles table: ", DatabaseError::update);
+    });
+}
 
-    //update the element in the database
-    update(username, mac, d.getRelativePath(), type, d.getSize(), d.getLastWriteTime(), d.getHash().str());
+/**
+ * method used to get the (cached) prepared statement of an sql string; the statements are prepared only the first
+ *  time and then kept for the whole life of the database object (they are reset, with their bindings cleared, every
+ *  time they are returned). To be called with the access mutex held
+ *
+ * @param sql sql string of the statement
+ *
+ * @return prepared statement (owned by the database object)
+ *
+ * @throws DatabaseException:
+ *  <b>prepare</b> if the sql statement could not be prepared
+ */
+sqlite3_stmt *server::Database::_statement(const std::string &sql) {
+    auto it = _statements.find(sql);
+
+    if(it != _statements.end()) {
+        //reset the statement (it could have been left in the middle of an execution by an error)
+        sqlite3_reset(it->second.get());
+        sqlite3_clear_bindings(it->second.get());
+
+        return it->second.get();
+    }
+
+    sqlite3_stmt* stmt; //statement handle
+
+    //prepare SQL statement (telling sqlite it will be kept and reused)
+    int rc = sqlite3_prepare_v3(_db.get(), sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+    _handleSQLError(rc, SQLITE_OK, "Cannot prepare SQL statement: ", DatabaseError::prepare);
+
+    _statements.emplace(sql, UniquePtr<sqlite3_stmt>(stmt));
+    return stmt;
+}
+
+/**
+ * method used to commit a mutation (group commit): the mutation is queued and the committer thread executes it in
+ *  a single transaction together with all the other mutations queued in the meantime (by any thread), so many
+ *  mutations share the same (durable) commit. It returns once the transaction with the mutation was committed, so
+ *  the caller can acknowledge it
+ *
+ * @param mutation function executing the mutation (executed by the committer thread, with the access mutex held)
+ *
+ * @throws DatabaseException:
+ *  <b>[err]</b> the exception thrown by the mutation (if it failed)
+ * @throws DatabaseException:
+ *  <b>finalize</b> if the transaction could not be committed
+ */
+void server::Database::_commit(const std::function<void()> &mutation) {
+    std::unique_lock<std::mutex> lock(_queue_mutex);
+
+    //add the mutation to the batch being filled
+    auto batch = _batch;    //batch of the mutation
+    auto index = batch->mutations.size();   //index of the mutation in its batch
+    batch->mutations.push_back(Mutation{mutation, nullptr});
+
+    _queued.notify_all();
+
+    //wait for the batch to be committed
+    _committed.wait(lock, [&batch](){ return batch->committed; });
+
+    if(batch->mutations[index].error != nullptr)
+        std::rethrow_exception(batch->mutations[index].error);
+}
+
+/**
+ * method used by the committer thread: it waits for a mutation, then waits (at most group_commit_ms) for more
+ *  mutations to be queued (up to group_commit_rows) and executes them all in a single transaction, notifying the
+ *  threads waiting for them once the transaction is committed; until the database object is destroyed
+ */
+void server::Database::_commitLoop() {
+    std::unique_lock<std::mutex> lock(_queue_mutex);
+
+    while(true) {
+        //wait for a mutation
+        _queued.wait(lock, [this](){ return _stop || !_batch->mutations.empty(); });
+
+        if(_batch->mutations.empty())   //stopped and no mutation left
+            return;
+
+        //wait for more mutations to be queued, to commit them together
+        _queued.wait_for(lock, std::chrono::milliseconds(_groupCommitMs), [this](){
+            return _stop || _batch->mutations.size() >= _groupCommitRows;
+        });
+
+        //take the batch (the next mutations are added to a new one)
+        auto batch = std::move(_batch);
+        _batch = std::make_shared<Batch>();
+
+        lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> access(_access_mutex);  //lock guard on _access_mutex
+
+            std::exception_ptr error;   //error of the whole transaction (if any)
+
+            int rc = sqlite3_exec(_db.get(), "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+            if(rc == SQLITE_OK) {
+                //execute all the mutations (the failed ones do not prevent the others from being committed)
+                for(auto &m : batch->mutations) {
+                    try {
+                        m.apply();
+                    }
+                    catch (...) {
+                        m.error = std::current_exception();
+                    }
+                }
+
+                rc = sqlite3_exec(_db.get(), "END TRANSACTION", nullptr, nullptr, nullptr);
+            }
+
+            if(rc != SQLITE_OK) {
+                //the transaction was not committed (so none of the mutations is)
+                sqlite3_exec(_db.get(), "ROLLBACK", nullptr, nullptr, nullptr);
+
+                try {
+                    _handleSQLError(rc, SQLITE_OK, "Cannot commit the transaction: ", DatabaseError::finalize);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+
+                for(auto &m : batch->mutations)
+                    m.error = error;
+            }
+        }
+
+        lock.lock();
+
+        //notify the threads waiting for the mutations of the batch
+        batch->committed = true;
+        _committed.notify_all();
+    }
 }
\ No newline at end of file
@@ -9,8 +9,16 @@
 
 #include <sqlite3.h>
 #include <string>
+#include <cstdint>
 #include <functional>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <list>
+#include <exception>
 
 #include "../myLibraries/Directory_entry.h"
 
@@ -45,6 +53,16 @@ namespace server {
         void operator()(sqlite3 *p) const { sqlite3_close(p); }
     };
 
+    /**
+     * template specialization for the sqlite3_stmt class
+     *
+     * @author Michele Crepaldi s269551
+     */
+    template<>
+    struct DeleterOf<sqlite3_stmt> {
+        void operator()(sqlite3_stmt *p) const { sqlite3_finalize(p); }
+    };
+
     /*
      * definition of the UniquePtr construct, it is simply a unique_ptr object with the deleter for the
      * sqlite3Type template class redefined
@@ -85,7 +103,28 @@ namespace server {
         prepare,
 
         //cannot finalize sql statement
-        finalize
+        finalize,
+
+        //cannot migrate the database to the current schema
+        migrate
+    };
+
+    /*
+     * +-------------------------------------------------------------------------------------------------------------------+
+     * Stat struct
+     */
+
+    /**
+     * Stat struct. Stat tuple of the server copy of a saved file, stored (with its size) when the file is saved: if
+     *  the copy still has the same tuple it was not changed, so it does not need to be hashed again
+     */
+    struct Stat {
+        int64_t mtimeNs;    //last modification time (nanoseconds since epoch)
+        uint64_t inode;     //inode number
+
+        static Stat of(const std::string &path);
+        bool operator==(const Stat &other) const;
+        bool operator!=(const Stat &other) const;
     };
 
     /*
@@ -94,7 +133,12 @@ namespace server {
      */
 
     /**
-     * Database class. It represents an sqlite3 database (singleton)
+     * Database class. It represents an sqlite3 database (one for each user).
+     *
+     *  <p> The elements of each user are saved in a separate database file, with its own connection, lock and
+     *  committer thread, so the sessions of different users never wait for each other. The open databases are kept
+     *  in a registry: the most recently used ones (up to database_handles) stay open, the others are closed as soon as
+     *  no session is using them anymore
      *
      * @author Michele Crepaldi s269551
      */
@@ -104,50 +148,113 @@ namespace server {
         Database& operator=(const Database &) = delete;  //assignment deleted
         Database(Database &&) = delete; //move constructor deleted
         Database& operator=(Database &&) = delete;  //move assignment deleted
-        ~Database() = default;
+        ~Database();
 
         static void setPath(std::string path);
+        static void splitShared();
+        static std::vector<std::string> getUsers();
+        static bool exists(const std::string &username);
+
+        //(user) database instance getter
+        static std::shared_ptr<Database> getInstance(const std::string &username);
 
-        //singleton instance getter
-        static std::shared_ptr<Database> getInstance();
+        //(user) database instance getter which does not keep the database open (nor changes the recently used ones)
+        static std::shared_ptr<Database> getUncachedInstance(const std::string &username);
 
         //database methods
 
         void forAll(const std::string &username, const std::string &mac,
                     const std::function<void(const std::string&, const std::string&, uintmax_t,
-                            const std::string&, const std::string&)> &f);
+                            const std::string&, const std::string&, const Stat&)> &f);
+        unsigned int forAll(const std::string &username, const std::string &mac, const std::string &after,
+                            unsigned int limit,
+                            const std::function<void(const std::string&, const std::string&, uintmax_t,
+                                    const std::string&, const std::string&, const Stat&)> &f);
         void insert(const std::string &username, const std::string &mac, const std::string &path,
-                    const std::string &type, uintmax_t size, const std::string &lastWriteTime, const std::string &hash);
+                    const std::string &type, uintmax_t size, const std::string &lastWriteTime, const std::string &hash,
+                    const Stat &stat);
         void insert(const std::string &username, const std::string &mac, Directory_entry& d);
         void remove(const std::string &username, const std::string &mac, const std::string &path);
+        void removeDir(const std::string &username, const std::string &mac, const std::string &path);
         void removeAll(const std::string &username);
         void removeAll(const std::string &username, const std::string &mac);
         std::vector<std::string> getAllMacAddresses(const std::string &username);
         void update(const std::string &username, const std::string &mac, const std::string &path,
-                    const std::string &type, uintmax_t size, const std::string &lastWriteTime, const std::string &hash);
+                    const std::string &type, uintmax_t size, const std::string &lastWriteTime, const std::string &hash,
+                    const Stat &stat);
         void update(const std::string &username, const std::string &mac, Directory_entry &d);
+        void forUnverified(int64_t before, unsigned int limit,
+                           const std::function<void(const std::string&, const std::string&, const std::string&,
+                                   uintmax_t, const std::string&, const Stat&)> &f);
+        void setVerified(const std::string &username, const std::string &mac, const std::string &path,
+                         int64_t verifiedAt);
 
     protected:
-        //protected constructor
-        Database();
+        //protected constructor (with the path of the database file)
+        explicit Database(std::string path);
 
-        //mutex to synchronize threads during the first creation of the Singleton object
+        //mutex protecting the registry of the open databases
         static std::mutex mutex_;
 
-        //singleton instance
-        static std::shared_ptr<Database> database_;
+        //open databases (by username), also the ones closed by the registry but still used by some session
+        static std::unordered_map<std::string, std::weak_ptr<Database>> open_;
 
-        //path of the database file
+        //databases kept open by the registry (the most recently used first)
+        static std::list<std::shared_ptr<Database>> recent_;
+
+        //path of the (old) shared database file; the user databases are in the directory with ".d" appended
         static std::string path_;
 
     private:
+        std::string _path;  //path of the database file
+
+        //position in the list of the databases kept open (valid if cached), protected by the registry mutex
+        std::list<std::shared_ptr<Database>>::iterator _recent;
+        bool _cached = false;   //whether the registry keeps the database open
+
         //unique pointer to the actual database
         UniquePtr<sqlite3> _db;
 
         //access mutex to synchronize threads during database accesses
         std::mutex _access_mutex;
 
+        //prepared statements (by sql string), kept for the whole life of the database object
+        std::unordered_map<std::string, UniquePtr<sqlite3_stmt>> _statements;
+
+        /**
+         * Mutation struct. A mutation (insert, update or remove) waiting to be committed
+         */
+        struct Mutation {
+            std::function<void()> apply;    //function executing the mutation
+            std::exception_ptr error;       //exception thrown executing (or committing) the mutation, if any
+        };
+
+        /**
+         * Batch struct. The mutations committed together (in the same transaction)
+         */
+        struct Batch {
+            std::vector<Mutation> mutations;    //mutations of the batch
+            bool committed = false;             //whether the batch was committed (or it failed)
+        };
+
+        std::mutex _queue_mutex;            //mutex protecting the batch being filled
+        std::condition_variable _queued;    //notified when a mutation is queued (or the committer has to stop)
+        std::condition_variable _committed; //notified when a batch is committed
+        std::shared_ptr<Batch> _batch = std::make_shared<Batch>();  //batch being filled
+        bool _stop = false;                 //whether the committer thread has to stop
+        unsigned int _groupCommitMs;        //maximum time (milliseconds) a mutation waits for the others
+        unsigned int _groupCommitRows;      //maximum number of mutations committed together
+        std::thread _committer;             //committer thread
+
         void _open(); //database open function
+        void _createTable(const std::string &name);  //(savedFiles) table creation function
+        void _createIndex(); //(savedFiles by last verification time) index creation function
+        void _migrate(int version); //database (old schema) migration function
+        static std::string _pathOf(const std::string &username);    //user database path getter function
+        static std::string _directory();    //user databases directory getter function
+        sqlite3_stmt *_statement(const std::string &sql);   //(cached) prepared statement getter function
+        void _commit(const std::function<void()> &mutation);    //mutation (group) commit function
+        void _commitLoop(); //committer thread function
         void _handleSQLError(int rc, int check, std::string &&message, DatabaseError err);   //error handler function
     };
 
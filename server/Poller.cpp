@@ -0,0 +1,355 @@
+#include "Poller.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+
+#include "../myLibraries/Message.h"
+
+#define MAX_EVENTS 256
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Connection class methods
+ */
+
+/**
+ * Connection constructor
+ *
+ * @param address address of the client
+ * @param socket client socket
+ * @param ver protocol version
+ * @param disk disk/database stage where to complete the operations
+ */
+server::Connection::Connection(std::string address, Socket socket, int ver, Stage &disk) :
+        address(std::move(address)), socket(std::move(socket)), drain(disk.getQueueSize()),
+        pm(this->socket, this->address, ver, disk, drain) {
+}
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Poller class methods
+ */
+
+/**
+ * Poller constructor; it creates the epoll instance (and the eventfd used to wake it up)
+ *
+ * @param ready queue where to push the connections ready to be served
+ * @param waitSeconds maximum time to wait for events (before checking the stop condition and the timeouts)
+ * @param timeoutSeconds time after which idle connections are closed
+ *
+ * @throw SocketException in case the epoll instance (or the eventfd) cannot be created
+ */
+server::Poller::Poller(TS_Circular_vector<std::shared_ptr<Connection>> &ready, unsigned int waitSeconds,
+                       unsigned int timeoutSeconds) :
+        _ready(ready), _waitSeconds(waitSeconds), _timeoutSeconds(timeoutSeconds) {
+
+    _epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if(_epollfd < 0)
+        throw SocketException("Cannot create epoll instance", SocketError::create);
+
+    _wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(_wakefd < 0) {
+        close(_epollfd);
+        throw SocketException("Cannot create eventfd", SocketError::create);
+    }
+
+    struct epoll_event event{};     //eventfd read event
+    event.events = EPOLLIN;
+    event.data.fd = _wakefd;
+    epoll_ctl(_epollfd, EPOLL_CTL_ADD, _wakefd, &event);
+}
+
+/**
+ * Poller destructor; it closes the epoll instance and the eventfd (the connections still registered are closed when
+ *  their last reference is released)
+ */
+server::Poller::~Poller() {
+    close(_wakefd);
+    close(_epollfd);
+}
+
+/**
+ * Poller add method. Used to register a new connection (it will be pushed into the ready queue as soon as the
+ *  client sends something)
+ *
+ * @param connection connection to register
+ *
+ * @throw SocketException in case the connection socket cannot be watched
+ */
+void server::Poller::add(const std::shared_ptr<Connection> &connection) {
+    int fd = connection->socket.getSockfd();    //connection socket file descriptor
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _connections[fd] = Entry{connection, std::chrono::steady_clock::now(), false};
+    _watch(EPOLL_CTL_ADD, fd);
+}
+
+/**
+ * Poller rearm method. Used by the server threads to give a connection back to the poller once they are done with
+ *  it (the poller will watch it again, or push it into the ready queue directly if its socket has already buffered
+ *  the next message or if it was woken up in the meantime)
+ *
+ * @param connection connection to give back
+ *
+ * @throw SocketException in case the connection socket cannot be watched
+ */
+void server::Poller::rearm(const std::shared_ptr<Connection> &connection) {
+    int fd = connection->socket.getSockfd();    //connection socket file descriptor
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _connections.find(fd);
+    if(it == _connections.end())
+        return;
+
+    it->second.lastActivity = std::chrono::steady_clock::now();
+
+    //epoll would not see the messages already buffered by the socket, so wake the poller up to hand it out again
+    //(the same if there are replies queued while it was being served)
+    bool pending = connection->socket.pending() > 0;    //whether the socket has already buffered messages
+    if(pending || it->second.wake) {
+        it->second.wake = false;
+        connection->readable = pending;
+        _handOut(connection);
+        return;
+    }
+
+    it->second.busy = false;
+    _watch(EPOLL_CTL_MOD, fd);
+}
+
+/**
+ * Poller wake method. Used by the disk/database stage to have a connection handed out to a server thread (to send
+ *  the replies queued for it, or to post the operations parked): if the connection is being served it will be
+ *  handed out again when given back, otherwise it is handed out now
+ *
+ * @param connection connection to wake up
+ *
+ * @return true if the connection is registered, false if it was closed in the meantime
+ */
+bool server::Poller::wake(const std::shared_ptr<Connection> &connection) {
+    int fd = connection->socket.getSockfd();    //connection socket file descriptor
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _connections.find(fd);
+    if(it == _connections.end())
+        return false;
+
+    //the client is waiting for the replies, it is not idle
+    it->second.lastActivity = std::chrono::steady_clock::now();
+
+    if(it->second.busy) {
+        it->second.wake = true;
+        return true;
+    }
+
+    //stop watching the socket (until the connection is given back), so it is not handed out twice
+    struct epoll_event event{};     //no event to watch
+    event.events = EPOLLONESHOT;
+    event.data.fd = fd;
+    epoll_ctl(_epollfd, EPOLL_CTL_MOD, fd, &event);
+
+    it->second.busy = true;
+    connection->readable = false;
+    _handOut(connection);
+    return true;
+}
+
+/**
+ * Poller park method. Used by the server threads to give back a connection whose operations cannot be posted yet
+ *  (the stage is full): its socket is not watched, so nothing more is read from it until it is woken up
+ *
+ * @param connection connection to give back
+ */
+void server::Poller::park(const std::shared_ptr<Connection> &connection) {
+    int fd = connection->socket.getSockfd();    //connection socket file descriptor
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _connections.find(fd);
+    if(it == _connections.end())
+        return;
+
+    it->second.lastActivity = std::chrono::steady_clock::now();
+
+    //if it was woken up in the meantime hand it out again (just to send the replies and post what it can)
+    if(it->second.wake) {
+        it->second.wake = false;
+        connection->readable = false;
+        _handOut(connection);
+        return;
+    }
+
+    it->second.busy = false;
+}
+
+/**
+ * Poller remove method. Used by the server threads to unregister a connection which has to be closed (the socket
+ *  is closed when the last reference to the connection is released)
+ *
+ * @param connection connection to unregister
+ */
+void server::Poller::remove(const std::shared_ptr<Connection> &connection) {
+    int fd = connection->socket.getSockfd();    //connection socket file descriptor
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    epoll_ctl(_epollfd, EPOLL_CTL_DEL, fd, nullptr);
+    _connections.erase(fd);
+}
+
+/**
+ * Poller run method. It is the poller thread function: it waits for events on the registered connections and
+ *  pushes the ready ones into the ready queue until told to stop; at every wait timeout it also closes the idle
+ *  connections and releases the idle sessions expired (so they are released even when no client authenticates)
+ *
+ * @param stop atomic boolean used to stop the poller
+ */
+void server::Poller::run(std::atomic<bool> &stop) {
+    struct epoll_event events[MAX_EVENTS];  //events returned by epoll_wait
+    std::vector<std::shared_ptr<Connection>> ready; //connections ready to be served
+    auto lastReport = std::chrono::steady_clock::now(); //time of the last report
+    auto lastSweep = std::chrono::steady_clock::now();  //time of the last sessions sweep
+    auto sessions = SessionManager::getInstance();      //session manager instance
+
+    while(!stop.load()){
+        int n = epoll_wait(_epollfd, events, MAX_EVENTS, static_cast<int>(_waitSeconds * 1000));
+
+        if(n < 0 && errno != EINTR) {
+            //I should never get here
+            Message::print(std::cerr, "ERROR", "Epoll error");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            //mark the ready connections as busy (the one-shot events disabled them until they are rearmed)
+            for(int i = 0; i < n; i++){
+                if(events[i].data.fd == _wakefd) {
+                    uint64_t count; //eventfd counter (just reset it)
+                    read(_wakefd, &count, sizeof(count));
+                    continue;
+                }
+
+                auto it = _connections.find(events[i].data.fd);
+
+                //skip the connections not registered anymore, and the ones woken up in the meantime (their socket
+                //will be watched again when they are given back)
+                if(it == _connections.end() || it->second.busy)
+                    continue;
+
+                it->second.busy = true;
+                it->second.connection->readable = true;
+                ready.push_back(it->second.connection);
+            }
+
+            //the connections given back with buffered messages (or woken up) are busy, just hand them out
+            for(auto &connection : _woken)
+                ready.push_back(std::move(connection));
+            _woken.clear();
+        }
+
+        //periodic close of the idle connections and release of the idle sessions (expired, or over the memory budget)
+        if(std::chrono::steady_clock::now() - lastSweep >= std::chrono::seconds(_waitSeconds)) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closeIdle();
+            }
+
+            sessions->sweep();
+            lastSweep = std::chrono::steady_clock::now();
+        }
+
+        //periodic report (queues depths)
+        if(_report && _reportSeconds != 0 &&
+                std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(_reportSeconds)) {
+            _report();
+            lastReport = std::chrono::steady_clock::now();
+        }
+
+        //hand the ready connections to the server threads (outside the lock, the push can block if the queue is full)
+        for(auto &connection : ready)
+            if(!_ready.push(std::move(connection), stop))
+                return;
+
+        ready.clear();
+    }
+}
+
+/**
+ * Poller clear method. Used to unregister (and so close) all the connections
+ */
+void server::Poller::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(auto &entry : _connections)
+        epoll_ctl(_epollfd, EPOLL_CTL_DEL, entry.first, nullptr);
+
+    _connections.clear();
+    _woken.clear();
+}
+
+/**
+ * Poller set report method. Used to set a function to be called periodically by the poller thread
+ *  (to be called before starting the poller thread)
+ *
+ * @param seconds seconds between 2 subsequent calls
+ * @param report function to call
+ */
+void server::Poller::setReport(unsigned int seconds, std::function<void()> report) {
+    _reportSeconds = seconds;
+    _report = std::move(report);
+}
+
+/**
+ * Poller watch method. Used to (re)enable the one-shot read event of a socket
+ *
+ * @param op epoll_ctl operation (EPOLL_CTL_ADD or EPOLL_CTL_MOD)
+ * @param fd socket file descriptor
+ *
+ * @throw SocketException in case the socket cannot be watched
+ */
+void server::Poller::_watch(int op, int fd) {
+    struct epoll_event event{};     //event to watch
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    if(epoll_ctl(_epollfd, op, fd, &event) < 0)
+        throw SocketException("Cannot watch socket", SocketError::create);
+}
+
+/**
+ * Poller hand out method. Used to have a (busy) connection pushed into the ready queue by the poller thread, waking
+ *  it up (to be called with the mutex held)
+ *
+ * @param connection connection to hand out
+ */
+void server::Poller::_handOut(const std::shared_ptr<Connection> &connection) {
+    _woken.push_back(connection);
+
+    uint64_t one = 1;   //eventfd increment
+    write(_wakefd, &one, sizeof(one));
+}
+
+/**
+ * Poller closeIdle method. Used to close the connections idle for more than the timeout (to be called with the
+ *  mutex held); the connections with operations still waiting or being completed are not idle (they are parked, or
+ *  their replies are still to be sent)
+ */
+void server::Poller::_closeIdle() {
+    auto now = std::chrono::steady_clock::now();    //current time
+    auto timeout = std::chrono::seconds(_timeoutSeconds);   //idle timeout
+
+    for(auto it = _connections.begin(); it != _connections.end();){
+        if(!it->second.busy && now - it->second.lastActivity >= timeout && it->second.connection->drain.idle()) {
+            Message::print(std::cout, "INFO", "Disconnecting client ", it->second.connection->address);
+
+            epoll_ctl(_epollfd, EPOLL_CTL_DEL, it->first, nullptr);
+            it = _connections.erase(it);
+        }
+        else
+            ++it;
+    }
+}
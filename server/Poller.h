@@ -0,0 +1,123 @@
+#ifndef SERVER_POLLER_H
+#define SERVER_POLLER_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+
+#include "../myLibraries/Socket.h"
+#include "../myLibraries/Circular_vector.h"
+
+#include "ProtocolManager.h"
+#include "Stage.h"
+
+
+/**
+ * PDS_Backup server namespace
+ */
+namespace server {
+    /*
+     * +---------------------------------------------------------------------------------------------------------------+
+     * Connection class
+     */
+
+    /**
+     * Connection class. It contains the state of a client connection (socket and protocol manager), so that it can
+     *  be served by any server thread, by one thread at a time
+     */
+    class Connection {
+    public:
+        Connection(const Connection &) = delete;                //copy constructor deleted
+        Connection& operator=(const Connection &) = delete;     //copy assignment deleted
+        Connection(Connection &&) = delete;                     //move constructor deleted
+        Connection& operator=(Connection &&) = delete;          //move assignment deleted
+        ~Connection() = default;    //default destructor
+
+        Connection(std::string address, Socket socket, int ver, Stage &disk);   //constructor
+
+        const std::string address;  //address of the client
+        Socket socket;              //client socket
+        Drain drain;                //order of the operations of this connection posted to the stages
+        ProtocolManager pm;         //protocol manager for this connection
+        bool authenticated = false; //whether the client has already been authenticated
+        bool readable = false;      //whether the connection was handed out to read (or only to send the replies)
+    };
+
+    /*
+     * +---------------------------------------------------------------------------------------------------------------+
+     * Poller class
+     */
+
+    /**
+     * Poller class. It waits (with epoll) for messages on all the client connections at once, and pushes the
+     *  connections which have something to read into the ready queue, where the server threads take them from.
+     *
+     *  <p> Every connection is registered as one-shot: after it is handed to a server thread it is not watched
+     *  anymore until the thread gives it back (rearm), so a connection is never served by two threads at once; if the
+     *  connection socket has already buffered the next message(s) it is pushed into the ready queue again directly.
+     *  The disk/database stage wakes a connection up when it has replies to send (the connection is then handed out
+     *  as soon as it is not being served, just to send them). A connection whose operations cannot be posted yet (the
+     *  stage is full) is parked: it is not watched until the stage wakes it up.
+     *  Connections idle for more than the timeout (and not being served) are closed by the poller; the ones being
+     *  served do not wait for the client (the receives do not wait for the rest of a message, and the sends fail after
+     *  the socket timeout).
+     */
+    class Poller {
+    public:
+        Poller(const Poller &) = delete;                //copy constructor deleted
+        Poller& operator=(const Poller &) = delete;     //copy assignment deleted
+        Poller(Poller &&) = delete;                     //move constructor deleted
+        Poller& operator=(Poller &&) = delete;          //move assignment deleted
+
+        //constructor with the ready queue, the epoll timeout and the idle connections timeout
+        Poller(TS_Circular_vector<std::shared_ptr<Connection>> &ready, unsigned int waitSeconds,
+               unsigned int timeoutSeconds);
+        ~Poller();  //destructor
+
+        void add(const std::shared_ptr<Connection> &connection);
+        void rearm(const std::shared_ptr<Connection> &connection);
+        bool wake(const std::shared_ptr<Connection> &connection);
+        void park(const std::shared_ptr<Connection> &connection);
+        void remove(const std::shared_ptr<Connection> &connection);
+        void run(std::atomic<bool> &stop);
+        void clear();
+        void setReport(unsigned int seconds, std::function<void()> report);
+
+    private:
+        /**
+         * Entry struct. A connection registered in the poller
+         */
+        struct Entry {
+            std::shared_ptr<Connection> connection;             //registered connection
+            std::chrono::steady_clock::time_point lastActivity; //time of the last message (or registration)
+            bool busy = false;                                  //whether a server thread is serving it
+            bool wake = false;      //whether it has to be handed out again (to send the replies) once given back
+        };
+
+        int _epollfd;   //epoll file descriptor
+        int _wakefd;    //eventfd used to wake the poller up (when a connection given back has buffered messages)
+        TS_Circular_vector<std::shared_ptr<Connection>> &_ready;    //queue of connections ready to be served
+        unsigned int _waitSeconds;      //maximum time to wait for events (before checking stop and timeouts)
+        unsigned int _timeoutSeconds;   //time after which idle connections are closed
+
+        std::mutex _mutex;  //mutex protecting the connections map
+        std::unordered_map<int, Entry> _connections;   //registered connections (by socket file descriptor)
+        //connections given back with buffered messages (or woken up to send the replies)
+        std::vector<std::shared_ptr<Connection>> _woken;
+
+        unsigned int _reportSeconds = 0;    //seconds between 2 subsequent reports (0 means no report)
+        std::function<void()> _report;      //report function (called periodically by the poller thread)
+
+        void _watch(int op, int fd);
+        void _handOut(const std::shared_ptr<Connection> &connection);
+        void _closeIdle();
+    };
+}
+
+
+#endif //SERVER_POLLER_H
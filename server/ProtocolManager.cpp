@@ -8,12 +8,16 @@
 
 #include <fstream>
 #include <regex>
+#include <optional>
 
+#include "../myLibraries/FileReader.h"
 #include "../myLibraries/Message.h"
-#include "../myLibraries/RandomNumberGenerator.h"
+#include "../myLibraries/PartialFile.h"
 #include "../myLibraries/Validator.h"
 #include "Config.h"
 
+#define RETR_BATCH 256  //number of elements read from the db at a time when retrieving them
+
 
 /*
  * +-------------------------------------------------------------------------------------------------------------------+
@@ -26,42 +30,51 @@
  * @param socket socket associated to this thread
  * @param address address of the connected client
  * @param ver version of the protocol tu use
+ * @param disk disk/database stage where to complete the operations
+ * @param drain drain of the connection (where to add the file writes)
  *
  * @author Michele Crepaldi s269551
  */
-server::ProtocolManager::ProtocolManager(Socket &socket, std::string address, int ver) :
+server::ProtocolManager::ProtocolManager(Socket &socket, std::string address, int ver, Stage &disk, Drain &drain) :
         _s(socket), //set socket
+        _disk(disk),    //set disk/database stage
+        _drain(drain),  //set connection drain
         _address(std::move(address)),   //set client address
         _protocolVersion(ver),  //set protocol version
-        _recovered(false){  //set recovered member variable to false
+        _stream(0){ //no stream yet
 
     auto config = Config::getInstance();    //config object instance
     _basePath = config->getServerBasePath();    //get server base path
     _temporaryPath = config->getTempPath();     //get server temporary path
-    _tempNameSize = config->getTmpFileNameSize();       //get temporary file name size
     _maxDataChunkSize = config->getMaxDataChunkSize();  //get max data chunk size
+    _readAheadBuffers = config->getReadAheadBuffers();  //get number of read ahead buffers
+    _maxPresentDigests = config->getMaxPresentDigests();    //get max number of present digests of a retrieve
 
     _password_db = Database_pwd::getInstance(); //get database_pwd instance
-    _db = Database::getInstance();              //get database instance
+    _sessions = SessionManager::getInstance();  //get session manager instance
 }
 
 /**
  * ProtocolManager recover from database method.
  *  It is used to recover all the elements (for the current user-mac pair) in the server db and populate
- *  the elements map
+ *  the elements map.
+ *  <p> A file is hashed again only if its server copy does not have the size and the stat tuple (modification time
+ *  and inode) stored in the db; otherwise it is trusted to be the same as described in the db
  *
  * @author Michele Crepaldi s269551
  */
 void server::ProtocolManager::recoverFromDB() {
     std::vector<Directory_entry> toUpdate;  //list of all Directory_entry elements to update
+    std::vector<Directory_entry> toRestat;  //list of all Directory_entry elements whose stat tuple changed
     std::vector<Directory_entry> toDelete;  //list of all Directory_entry elements to delete
 
     //function to be used for each element of the db
     std::function<void (const std::string &, const std::string &, uintmax_t, const std::string &,
-                        const std::string &)> f;
+                        const std::string &, const Stat &)> f;
 
-    f = [this, &toUpdate, &toDelete](const std::string &path, const std::string &type, uintmax_t size,
-                                     const std::string &lastWriteTime, const std::string& hash){
+    f = [this, &toUpdate, &toRestat, &toDelete](const std::string &path, const std::string &type, uintmax_t size,
+                                                const std::string &lastWriteTime, const std::string& hash,
+                                                const Stat &stat){
 
         //current Directory_entry element
         auto current = Directory_entry(_userPath, path, size, type, lastWriteTime, Hash(hash));
@@ -75,9 +88,21 @@ void server::ProtocolManager::recoverFromDB() {
         }
         //otherwise
 
-        //if the file exists, check if it corresponds to the one described by the database
+        //if the file exists and its size and stat tuple are the ones stored in the db, its content was not changed
+        if(current.getType() == Directory_entry_TYPE::file &&
+           std::filesystem::is_regular_file(current.getAbsolutePath()) &&
+           std::filesystem::file_size(current.getAbsolutePath()) == current.getSize() &&
+           Stat::of(current.getAbsolutePath()) == stat){
+
+            //add it to the elements map (without hashing it)
+            _session->add(std::move(current));
+
+            return;
+        }
+
+        //otherwise check if it corresponds to the one described by the database
 
-        //effective Directory_entry element on filesystem
+        //effective Directory_entry element on filesystem (files are hashed)
         auto effective = Directory_entry(_userPath, current.getAbsolutePath());
 
         //if the effective element found on filesystem is different from the current one
@@ -95,8 +120,16 @@ void server::ProtocolManager::recoverFromDB() {
 
         //if the file exists and it is the same as described in the db
 
+        //a file with a different stat tuple (for example copied back with the same content) only needs its stat
+        //tuple to be updated in the db
+        if(effective.getType() == Directory_entry_TYPE::file) {
+            toRestat.push_back(std::move(effective));
+
+            return;
+        }
+
         //add it to the elements map
-        _elements.emplace(path, std::move(current));
+        _session->add(std::move(current));
     };
 
     //apply the function for all the user's (and mac) elements in the db
@@ -111,7 +144,16 @@ void server::ProtocolManager::recoverFromDB() {
         _db->update(_username, _mac, el);
 
         //insert the element into the elements map
-        _elements.emplace(el.getRelativePath(), std::move(el));
+        _session->add(std::move(el));
+    }
+
+    //for all the elements whose stat tuple changed
+    for(auto el: toRestat){
+        //update the element (its stat tuple) on database
+        _db->update(_username, _mac, el);
+
+        //insert the element into the elements map
+        _session->add(std::move(el));
     }
 
     //for all the elements to delete
@@ -122,14 +164,15 @@ void server::ProtocolManager::recoverFromDB() {
         //delete the element from database
         _db->remove(_username, _mac, el.getRelativePath());
     }
-
-    //set _recovered boolean member variable to inform that the recovery has been completed
-    _recovered = true;
 }
 
 /**
  * ProtocolManager authenticate method.
- *  It is used to authenticate a client (username-mac)
+ *  It is used to authenticate a client (username-mac), with the session token got in a previous connection (if it is
+ *  still valid) or with the password; the client then gets a new session token. It does not wait for the client: if
+ *  the authentication message has not completely arrived yet it returns (to be called again when it has)
+ *
+ * @return true if the client was authenticated, false if the authentication message has not completely arrived
  *
  * @throws ProtocolManagerException:
  *  <b>version</b> if the client message uses a different version
@@ -142,11 +185,14 @@ void server::ProtocolManager::recoverFromDB() {
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::authenticate() {
-    //receive a message from client
+bool server::ProtocolManager::authenticate() {
+    bool resumed;   //whether the client was authenticated with a session token
+
+    //receive a message from client (if it has already completely arrived)
 
-    std::string message = _s.recvString();      //client message
-    _clientMessage.ParseFromString(message);    //get clientMessage protobuf parsing the clinet message
+    if(!_s.tryRecvString(_messageBuffer))   //client message
+        return false;
+    _clientMessage.ParseFromString(_messageBuffer); //get clientMessage protobuf parsing the clinet message
 
     //check clientMessage version
     if(_protocolVersion != _clientMessage.version()) {
@@ -167,6 +213,8 @@ void server::ProtocolManager::authenticate() {
         _username = _clientMessage.username();  //get username from clientMessage
         _mac = _clientMessage.macaddress();     //get mac address from clientMessage
         std::string password = _clientMessage.password();   //get password from clientMessage
+        std::string token = _clientMessage.token();         //get session token from clientMessage
+        resumed = !token.empty();   //whether the client presented a session token
 
         //it is more efficient to clear the clientMessage protobuf than creating a new one
         _clientMessage.Clear();
@@ -180,49 +228,65 @@ void server::ProtocolManager::authenticate() {
         if(!Validator::validateMacAddress(_mac))
             throw ProtocolManagerException("Mac address validation failed", ProtocolManagerError::client);
 
-        //validate last write time got from clientMessage
-        if(!Validator::validatePassword(password))
-            throw ProtocolManagerException("Password validation failed", ProtocolManagerError::client);
+        //if the client presented a valid session token (issued after a previous authentication of the same
+        //username-mac) there is no need to check the password again
+        if(!resumed || !_sessions->check(token, _username, _mac)) {
+            //otherwise authenticate the user with the password
+            resumed = false;
 
+            //validate last write time got from clientMessage
+            if(!Validator::validatePassword(password))
+                throw ProtocolManagerException("Password validation failed", ProtocolManagerError::client);
 
-        //initialize hash maker with the password
-        HashMaker hm{password};
 
-        //get the salt and password hash for the current user
+            //initialize hash maker with the password
+            HashMaker hm{password};
 
-        //(salt,hash) pair for the current user
-        auto pair = _password_db->getHash(_username);
+            //get the salt and password hash for the current user
 
-        //user's salt
-        std::string salt = pair.first;
+            //(salt,hash) pair for the current user
+            auto pair = _password_db->getHash(_username);
 
-        //update the hash maker with the user's salt (effectively appending the salt to the password)
-        hm.update(salt);
+            //user's salt
+            std::string salt = pair.first;
 
-        //computed password hash
-        auto pwdHash = hm.get();
+            //update the hash maker with the user's salt (effectively appending the salt to the password)
+            hm.update(salt);
 
-        //compare the computed password hash with the user hash
-        if(pwdHash != pair.second){
-            //if they are different then the password is not correct (authentication error)
+            //computed password hash
+            auto pwdHash = hm.get();
 
-            //send error message with cause to the client
-            _send_ERR(ErrCode::auth);
+            //compare the computed password hash with the user hash
+            if(pwdHash != pair.second){
+                //if they are different then the password is not correct (authentication error)
 
-            throw ProtocolManagerException("Authentication Error", ProtocolManagerError::auth);
+                //send error message with cause to the client
+                _send_ERR(ErrCode::auth, _stream);
+
+                throw ProtocolManagerException("Authentication Error", ProtocolManagerError::auth);
+            }
         }
 
         //the authentication was successful
 
+        //get the user's database instance
+        _db = Database::getInstance(_username);
+
+        //attach to the session of this username-mac (if it is still resident its elements map is already loaded)
+        _session = _sessions->attach(_username, _mac);
+
+        //issue a new session token for the client (keeping the session resident until it expires)
+        _token = _sessions->issue(_username, _mac);
+
         //send ok message to the client
-        _send_OK(OkCode::authenticated);
+        _send_OK(OkCode::authenticated, _stream);
     }
     else{   //if the clientMessage type is not AUTH
 
         //error, message not expected
 
         //send error message with cause to the client
-        _send_ERR(ErrCode::unexpected);
+        _send_ERR(ErrCode::unexpected, _stream);
 
         //throw exception
         throw ProtocolManagerException("Message Error, not expected.", ProtocolManagerError::unexpected);
@@ -234,77 +298,267 @@ void server::ProtocolManager::authenticate() {
     tmp << _basePath << "/" << _username << "_" << std::regex_replace(_mac, std::regex(":"), "-");
     _userPath = tmp.str();
 
-    Message::print(std::cout, "EVENT", _address, "authenticated as " + _username + "@" + _mac);
+    Message::print(std::cout, "EVENT", _address, (resumed ? "resumed session as " : "authenticated as ") +
+                    _username + "@" + _mac);
+    return true;
 }
 
 /**
  * ProtocolManager receive method.
- *  It is used to receive a message from the client
+ *  It is used to receive the messages from the client; this is the network part of the message handling, the
+ *  operations which only use the disk and the database are returned, to be completed (calling complete()) on the
+ *  disk/database stage; a retrieve is returned too (as the last operation), to be done (calling retrieve()) on the
+ *  retrieve stage. Every message belongs to a stream (operation) and the reply carries the same stream id, so
+ *  the DATA messages of the files being received (one for each STOR stream) can be interleaved with each other and
+ *  with the other messages, and the operations can be completed out of order. All the messages already arrived are
+ *  handled; as soon as the next one has not completely arrived the method returns, without waiting for the client
+ *  (the part received so far is kept by the socket), so a slow client does not hold a server thread
+ *
+ * @return operations to be completed on the disk/database stage
  *
  * @throws ProtocolManagerException:
  *  <b>version</b> if the client message uses a different version
  * @throws ProtocolManagerException:
- *  <b>unexpected</b> if an unexpected client message was received
- * @throws ProtocolManagerException:
  *  <b>internal</b> if there is some un-handled exception
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::receive(){
-    //receive a message from client
+std::vector<server::ProtocolManager::Operation> server::ProtocolManager::receive(){
+    std::vector<Operation> operations;  //operations to complete on the disk/database stage
+    bool retrieving = false;            //whether a retrieve was requested (the following messages wait for it)
 
-    std::string message = _s.recvString();      //client message
-    _clientMessage.ParseFromString(message);    //get clientMessage protobuf parsing the message
+    try {
+        //receive the messages from client, as long as they have already (completely) arrived: the socket does not
+        //wait for the rest of a message, it keeps the part received so far until the connection is served again
+        while(!retrieving && _s.tryRecvString(_messageBuffer)) {
+            _clientMessage.ParseFromString(_messageBuffer); //get clientMessage protobuf parsing the message
+
+            _stream = _clientMessage.stream();  //stream of the message (the reply will carry it)
+
+            //check clientMessage version
+            _checkVersion();
+
+            _handle([this, &operations, &retrieving](){
+                //switch on client message type
+                switch (_clientMessage.type()) {
+                    case messages::ClientMessage_Type_PROB:
+                    case messages::ClientMessage_Type_DELE:
+                    case messages::ClientMessage_Type_MKD:
+                    case messages::ClientMessage_Type_RMD: {
+                        //these messages only need the disk and the database, they are completed on the
+                        //disk/database stage (the operations on the same path are completed in order)
+                        Operation operation(_clientMessage.type(), _stream, _pathKey(_clientMessage.path()));
+
+                        //keep the clientMessage until then (swapping it with the empty one of the operation)
+                        operation.message.Swap(&_clientMessage);
+
+                        operations.push_back(std::move(operation));
+                        break;
+                    }
+
+                    case messages::ClientMessage_Type_STOR:
+                        //start receiving the file (its DATA messages are handled as they arrive)
+                        _receiveFile();
+                        break;
+
+                    case messages::ClientMessage_Type_DATA:
+                    case messages::ClientMessage_Type_CANCEL: {
+                        //DATA (or CANCEL) message of one of the files being received
+                        auto transfer = _receiveData();
+
+                        //if the whole file was received it has to be stored on the disk/database stage
+                        if(transfer != nullptr) {
+                            Operation operation(messages::ClientMessage_Type_STOR, _stream, transfer->key);
+                            operation.transfer = std::move(transfer);
+
+                            operations.push_back(std::move(operation));
+                        }
+                        break;
+                    }
+
+                    case messages::ClientMessage_Type_RETR: {
+                        //digests of the files the client already has (they come with more RETR messages when they
+                        //are many); they are kept until the last RETR message, so there is a limit to them: a
+                        //retrieve with more digests is refused (and its following RETR messages are ignored)
+                        if(!_presentRefused &&
+                                _present.size() + _clientMessage.present_size() > _maxPresentDigests) {
+                            std::unordered_set<uint64_t>().swap(_present);  //release the digests memory
+                            _presentRefused = true;
+
+                            //send the error message with cause to the client
+                            _send_ERR(ErrCode::retrieve, _stream);
+                        }
+
+                        if(!_presentRefused)
+                            _present.insert(_clientMessage.present().begin(), _clientMessage.present().end());
+
+                        //if other RETR messages follow (with more digests) just wait for them
+                        if(!_clientMessage.last()) {
+                            //it is more efficient to clear the clientMessage protobuf than creating a new one
+                            _clientMessage.Clear();
+                            break;
+                        }
+
+                        //if the retrieve was refused there is nothing to do (the client was already told)
+                        if(_presentRefused) {
+                            _presentRefused = false;
+                            _clientMessage.Clear();
+
+                            throw ProtocolManagerException("Too many present digests in the retrieve",
+                                                           ProtocolManagerError::client);
+                        }
+
+                        //the retrieve (all the user's files are sent) is done on the retrieve stage, which serves
+                        //the connection until it is finished: stop receiving
+                        Operation operation(messages::ClientMessage_Type_RETR, _stream, 0);
+                        operation.message.Swap(&_clientMessage);
+
+                        operations.push_back(std::move(operation));
+                        retrieving = true;
+                        break;
+                    }
+
+                    case messages::ClientMessage_Type_NOOP:
+                        //heartbeat of a client keeping the connection alive: just answer it
+                        _clientMessage.Clear();
+                        _send_NOOP();
+                        break;
+
+                    case messages::ClientMessage_Type_AUTH:
+                    default:
+                        //unexpected message types
+
+                        //send error message with cause to the client
+                        _send_ERR(ErrCode::unexpected, _stream);
+
+                        throw ProtocolManagerException("Unexpected message type", ProtocolManagerError::unexpected);
+                }
+            }, _stream);
+        }
+    }
+    //in case of socket exceptions while transferring files I keep the temporary files (with the chunks
+    //received so far), so that the client can resume the transfers later
+    catch (SocketException &e) {
+        //close the temporary files
+        _closeTransfers();
 
-    //check clientMessage version
-    if(_protocolVersion != _clientMessage.version()) {
-        //it is more efficient to clear the clientMessage protobuf than creating a new one
-        _clientMessage.Clear();
+        //re-throw the exception
+        throw;
+    }
 
-        //send version message to the client
-        _send_VER();
+    return operations;
+}
 
-        throw ProtocolManagerException("Client is using a different version", ProtocolManagerError::version);
-    }
+/**
+ * ProtocolManager complete method.
+ *  It is used to complete an operation (the part of the message handling which only uses the disk and the
+ *  database), queueing the reply for the client; it is meant to be called on the disk/database stage, where the
+ *  operations with different keys are completed concurrently
+ *
+ * @param operation operation to complete
+ *
+ * @throws ProtocolManagerException:
+ *  <b>internal</b> if there is some un-handled exception
+ *
+ * @author Michele Crepaldi s269551
+ */
+void server::ProtocolManager::complete(Operation &operation){
+    _handle([this, &operation](){
+        //recover user data from database (if not already done previously)
+        std::call_once(_session->recovered, &ProtocolManager::recoverFromDB, this);
 
-    try {
-        //switch on client message type
-        switch (_clientMessage.type()) {
+        //path of the operation
+        const std::string &path = operation.type == messages::ClientMessage_Type_STOR ?
+                operation.transfer->expected.getRelativePath() : operation.message.path();
+
+        //lock the path of the operation (the other connections of this username-mac may be working on it);
+        //the operations adding or removing an element change its parent directory too
+        Session::PathLock lock(*_session, _userPath, path, operation.type != messages::ClientMessage_Type_PROB);
+
+        //switch on the type of the operation
+        switch (operation.type) {
             case messages::ClientMessage_Type_PROB:
-                _probe();   //probe elements map for the file in client message
+                _probe(operation);  //probe elements map for the file in client message
                 break;
 
             case messages::ClientMessage_Type_STOR:
-                _storeFile();   //store file in the server filesystem, db and elements map
+                _storeFile(operation);  //store file in the server filesystem, db and elements map
                 break;
 
             case messages::ClientMessage_Type_DELE:
-                _removeFile();  //remove file from server filesystem, db and elements map
+                _removeFile(operation); //remove file from server filesystem, db and elements map
                 break;
 
             case messages::ClientMessage_Type_MKD:
-                _makeDir(); //create directory on server filesystem, db and elements map
+                _makeDir(operation);    //create directory on server filesystem, db and elements map
                 break;
 
             case messages::ClientMessage_Type_RMD:
-                _removeDir();   //remove directory from server filesystem, db and elements map
+                _removeDir(operation);  //remove directory from server filesystem, db and elements map
                 break;
 
-            case messages::ClientMessage_Type_RETR:
-                _retrieveUserData();    //retrieve the user's backed-up files and send it to client
+            default:
+                //the other messages are completely handled by receive
                 break;
+        }
+    }, operation.stream);
+}
 
-            case messages::ClientMessage_Type_NOOP:
-            case messages::ClientMessage_Type_DATA:
-            case messages::ClientMessage_Type_AUTH:
-            default:
-                //unexpected message types
+/**
+ * ProtocolManager retrieve method.
+ *  It is used to send the user's backed-up files to the client (as requested by the RETR messages); it is meant to
+ *  be called on the retrieve stage, which serves the connection (it is the only one using the socket) until the
+ *  retrieve is finished, so that a long retrieve does not hold a network thread
+ *
+ * @param operation retrieve operation (returned by receive)
+ * @param stop atomic boolean telling that the server is stopping (the retrieve is then interrupted)
+ *
+ * @throws ProtocolManagerException:
+ *  <b>internal</b> if there is some un-handled exception
+ *
+ * @author Michele Crepaldi s269551
+ */
+void server::ProtocolManager::retrieve(Operation &operation, const std::atomic<bool> &stop){
+    _handle([this, &operation, &stop](){
+        //retrieve the user's backed-up files and send them to client
+        _retrieveUserData(operation.message, stop);
+    }, operation.stream);
+}
 
-                //send error message with cause to the client
-                _send_ERR(ErrCode::unexpected);
+/**
+ * ProtocolManager flush method.
+ *  It is used to send the queued replies to the client; it is meant to be called by the thread serving the
+ *  connection (a network thread, or the retrieve stage during a retrieve: the only one using the socket)
+ *
+ * @throws SocketException if the replies could not be sent
+ */
+void server::ProtocolManager::flush(){
+    std::deque<std::string> replies;    //replies to send
 
-                throw ProtocolManagerException("Unexpected message type", ProtocolManagerError::unexpected);
-        }
+    //take the queued replies (the disk/database stage can go on queueing while these are sent)
+    {
+        std::lock_guard<std::mutex> lock(_sendMutex);
+        replies.swap(_replies);
+    }
+
+    for(auto &reply : replies)
+        _s.sendString(reply);
+}
+
+/**
+ * ProtocolManager handle method.
+ *  It is used to execute (part of) the handling of a message, dealing with its errors: the errors related only to
+ *  the current message are reported and the message is skipped, the others are re-thrown
+ *
+ * @param operation operation to execute
+ * @param stream stream of the message (the error replies carry it)
+ *
+ * @throws ProtocolManagerException:
+ *  <b>internal</b> if there is some un-handled exception
+ */
+void server::ProtocolManager::_handle(const std::function<void()> &operation, uint64_t stream){
+    try {
+        operation();
     }
     catch (ProtocolManagerException &e) {
         //switch on error code
@@ -335,7 +589,7 @@ void server::ProtocolManager::receive(){
         //re-throw exception (I don't want the general std::exception catch to catch it)
 
         //send error message with cause to the client
-        _send_ERR(ErrCode::exception);
+        _send_ERR(ErrCode::exception, stream);
 
         throw;
     }
@@ -343,7 +597,7 @@ void server::ProtocolManager::receive(){
         //re-throw exception (I don't want the general std::exception catch to catch it)
 
         //send error message with cause to the client
-        _send_ERR(ErrCode::exception);
+        _send_ERR(ErrCode::exception, stream);
 
         throw;
     }
@@ -351,7 +605,7 @@ void server::ProtocolManager::receive(){
         //re-throw exception (I don't want the general std::exception catch to catch it)
 
         //send error message with cause to the client
-        _send_ERR(ErrCode::exception);
+        _send_ERR(ErrCode::exception, stream);
 
         throw;
     }
@@ -359,56 +613,182 @@ void server::ProtocolManager::receive(){
         //internal server error
 
         //send error message with cause to the client
-        _send_ERR(ErrCode::exception);
+        _send_ERR(ErrCode::exception, stream);
 
         throw ProtocolManagerException(e.what(),server::ProtocolManagerError::internal);
     }
 }
 
 
+
+/**
+ * ProtocolManager check version method.
+ *  It is used to check the version of the last received clientMessage (if some files were being received their
+ *  partial files are closed)
+ *
+ * @throws ProtocolManagerException:
+ *  <b>version</b> if the client message uses a different version
+ */
+void server::ProtocolManager::_checkVersion(){
+    if(_protocolVersion == _clientMessage.version())
+        return;
+
+    //it is more efficient to clear the clientMessage protobuf than creating a new one
+    _clientMessage.Clear();
+
+    //close the temporary files (if any)
+    _closeTransfers();
+
+    //send version message to the client
+    _send_VER();
+
+    throw ProtocolManagerException("Client is using a different version", ProtocolManagerError::version);
+}
+
+/**
+ * ProtocolManager abort transfer method.
+ *  It is used to stop receiving the file of a stream, closing and deleting its partial file
+ *
+ * @param stream stream of the file transfer
+ */
+void server::ProtocolManager::_abortTransfer(uint64_t stream){
+    auto it = _transfers.find(stream);
+    if(it == _transfers.end())
+        return;
+
+    //the partial file is deleted by the same disk/database thread which writes it (after the chunks already posted)
+    unsigned int key = it->second->key; //key of the operations on the file
+    _drain.add(_disk, key, Drain::Order::keyed, [transfer = std::move(it->second)](){
+        transfer->file.remove();
+    });
+    _transfers.erase(it);
+}
+
+/**
+ * ProtocolManager close transfers method.
+ *  It is used to stop receiving all the files being received, closing (and keeping) their partial files so that the
+ *  transfers can be resumed later
+ */
+void server::ProtocolManager::_closeTransfers(){
+    for(auto &transfer : _transfers) {
+        unsigned int key = transfer.second->key;    //key of the operations on the file
+        _drain.add(_disk, key, Drain::Order::keyed, [transfer = std::move(transfer.second)](){
+            transfer->file.close();
+        });
+    }
+
+    _transfers.clear();
+}
+
 /**
  * ProtocolManager send serverMessage method.
- *  It will send the serverMessage and then clear it
+ *  It will send the serverMessage (with the stream of the last received message) and then clear it;
+ *  it is only used by the network thread (to be called with the send mutex held)
  *
  * @author Michele Crepaldi s269551
  */
 void server::ProtocolManager::_send_serverMessage(){
-    //string representation of the serverMessage protobuf
-    std::string tmp = _serverMessage.SerializeAsString();
+    //the message belongs to the same stream of the last received message
+    _serverMessage.set_stream(_stream);
+
+    //string representation of the serverMessage protobuf (reusing the message buffer memory)
+    _serverMessage.SerializeToString(&_messageBuffer);
 
     //send response message
-    _s.sendString(tmp);
+    _s.sendString(_messageBuffer);
 
     //it is more efficient to clear the serverMessage protobuf than creating a new one
     _serverMessage.Clear();
 }
 
+/**
+ * ProtocolManager queue serverMessage method.
+ *  It will queue the serverMessage (a reply, to be sent by flush) and then clear it
+ *  (to be called with the send mutex held)
+ *
+ * @param stream stream of the message the reply is for
+ */
+void server::ProtocolManager::_queue_serverMessage(uint64_t stream){
+    //the reply belongs to the same stream of the message it replies to
+    _serverMessage.set_stream(stream);
+
+    //string representation of the serverMessage protobuf
+    _replies.emplace_back();
+    _serverMessage.SerializeToString(&_replies.back());
+
+    //it is more efficient to clear the serverMessage protobuf than creating a new one
+    _serverMessage.Clear();
+}
+
+/**
+ * ProtocolManager partial key method.
+ *  It is used to get the key of the partial file used to receive a file (it identifies the user-mac pair and the
+ *  path, so that an interrupted transfer of the same file can be resumed)
+ *
+ * @param path relative path of the file
+ *
+ * @return key of the partial file
+ */
+std::string server::ProtocolManager::_partialKey(const std::string &path){
+    return _username + "@" + _mac + ":" + path;
+}
+
+/**
+ * ProtocolManager path key method.
+ *  It is used to get the key of the disk/database operations on a path: the operations on the same path have the
+ *  same key, so they are done in order (the ones on different paths are done concurrently; a directory removal is
+ *  ordered with the earlier and later operations of the connection by its drain, and with the operations of the
+ *  other connections on the paths in it by the path locks)
+ *
+ * @param path relative path of the element
+ *
+ * @return key of the operations on the path
+ */
+unsigned int server::ProtocolManager::_pathKey(const std::string &path){
+    return Session::pathKey(_userPath, path);
+}
+
 /**
  * ProtocolManager send OK message method.
- *  It will set the serverMessage protobuf version, type and code and then send it
+ *  It will set the serverMessage protobuf version, type and code and then queue it
  *
  * @param code OK code
+ * @param stream stream of the message the reply is for
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_send_OK(OkCode code){
+void server::ProtocolManager::_send_OK(OkCode code, uint64_t stream){
+    std::lock_guard<std::mutex> lock(_sendMutex);
+
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_OK);
 
     //set ok code
     _serverMessage.set_code(static_cast<int>(code));
 
-    _send_serverMessage();
+    //the authentication OK carries the session token
+    if(code == OkCode::authenticated)
+        _serverMessage.set_token(_token);
+
+    _queue_serverMessage(stream);
 }
 
 /**
  * ProtocolManager send SEND message method.
- *  It will set the serverMessage protobuf version, type, path and hash and then send it
+ *  It will set the serverMessage protobuf version, type, path, hash and offset and then queue it
  *  (path and hash are taken from last received clientMessage)
  *
+ * @param path relative path of the file to send
+ * @param hash hash of the file to send
+ * @param offset offset from which the client has to send the file (size of the partial file already received)
+ * @param stream stream of the message the reply is for
+ *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_send_SEND(const std::string &path, const std::string &hash){
+void server::ProtocolManager::_send_SEND(const std::string &path, const std::string &hash, uintmax_t offset,
+                                          uint64_t stream){
+    std::lock_guard<std::mutex> lock(_sendMutex);
+
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_SEND);
 
@@ -416,41 +796,62 @@ void server::ProtocolManager::_send_SEND(const std::string &path, const std::str
     _serverMessage.set_path(path);
     _serverMessage.set_hash(hash);
 
-    _send_serverMessage();
+    //set the offset from which to resume the transfer
+    _serverMessage.set_offset(offset);
+
+    _queue_serverMessage(stream);
 }
 
 /**
  * ProtocolManager send ERR message method.
- *  It will set the serverMessage protobuf version, type and code and then send it
+ *  It will set the serverMessage protobuf version, type and code and then queue it
  *
  * @param code protocolManagerError code
+ * @param stream stream of the message the reply is for
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_send_ERR(ErrCode code){
+void server::ProtocolManager::_send_ERR(ErrCode code, uint64_t stream){
+    std::lock_guard<std::mutex> lock(_sendMutex);
+
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_ERR);
 
     //set error code
     _serverMessage.set_code(static_cast<int>(code));
 
-    _send_serverMessage();
+    _queue_serverMessage(stream);
 }
 
 /**
  * ProtocolManager send VER message method.
- *  It will set the serverMessage protobuf version, type and new version and then send it
+ *  It will set the serverMessage protobuf version, type and new version and then queue it
  *
  * @author Michele Crepaldi s269551
  */
 void server::ProtocolManager::_send_VER(){
+    std::lock_guard<std::mutex> lock(_sendMutex);
+
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_VER);
 
     //set new version as the one supported by the protocol manager
     _serverMessage.set_newversion(_protocolVersion);
 
-    _send_serverMessage();
+    _queue_serverMessage(_stream);
+}
+
+/**
+ * ProtocolManager send NOOP message method.
+ *  It will set the serverMessage protobuf version and type and then queue it (response to a client heartbeat)
+ */
+void server::ProtocolManager::_send_NOOP(){
+    std::lock_guard<std::mutex> lock(_sendMutex);
+
+    _serverMessage.set_version(_protocolVersion);
+    _serverMessage.set_type(messages::ServerMessage_Type_NOOP);
+
+    _queue_serverMessage(_stream);
 }
 
 /**
@@ -464,17 +865,13 @@ void server::ProtocolManager::_send_VER(){
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_probe() {
-    //recover user data from database (if not already done previously)
-    if(!_recovered)
-        recoverFromDB();
-
-    std::string path = _clientMessage.path();                   //file relative path
-    std::string lastWriteTime = _clientMessage.lastwritetime(); //file last write time
-    Hash h = Hash(_clientMessage.hash());                       //file hash
+void server::ProtocolManager::_probe(Operation &operation) {
+    std::string path = operation.message.path();                   //file relative path
+    std::string lastWriteTime = operation.message.lastwritetime(); //file last write time
+    Hash h = Hash(operation.message.hash());                       //file hash
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
-    _clientMessage.Clear();
+    operation.message.Clear();
 
 
     //validate path got from clientMessage
@@ -489,75 +886,69 @@ void server::ProtocolManager::_probe() {
     Message::print(std::cout, "PROB", _address + " (" + _username + "@" + _mac + ")", path);
 
     //(string, Directory_entry) pair corresponding to the relative path
-    auto el = _elements.find(path);
+    auto el = _session->find(path);
 
     //if i cannot find the element
-    if(el == _elements.end()) {
+    if(el == nullptr) {
+
+        //partial file of a previous (interrupted) transfer of the same file, if any
+        PartialFile partial{_temporaryPath, _partialKey(path), h};
 
-        //tell the client to send it
-        _send_SEND(path, h.str());
+        //tell the client to send it (from where the previous transfer was interrupted)
+        _send_SEND(path, h.str(), partial.recover(), operation.stream);
         return;
     }
     //otherwise
 
     //if the element is not a file
-    if(!el->second.is_regular_file()) {
+    if(!el->is_regular_file()) {
         //there is something with the same name which is not a file -> send error message with cause
-        _send_ERR(ErrCode::notAFile);
+        _send_ERR(ErrCode::notAFile, operation.stream);
         throw ProtocolManagerException("Probed something which is not a file.", ProtocolManagerError::client);
     }
 
     //if the file hash does not correspond -> a file with the same name exists but it is different
-    if(el->second.getHash() != h) {
+    if(el->getHash() != h) {
 
-        //we want to overwrite it so tell the client to send it
-        _send_SEND(path, h.str());
+        //partial file of a previous (interrupted) transfer of the same file, if any
+        PartialFile partial{_temporaryPath, _partialKey(path), h};
+
+        //we want to overwrite it so tell the client to send it (from where the previous transfer was interrupted)
+        _send_SEND(path, h.str(), partial.recover(), operation.stream);
         return;
     }
 
     //if the file last write time does not correspond
     //-> the file exists and it is the same, but it has a different last write time
     //(maybe on client it was just 'touched')
-    if(el->second.getLastWriteTime() != lastWriteTime){
+    if(el->getLastWriteTime() != lastWriteTime){
 
         //update the last write time to be as the one found in clientMessage
-        el->second.set_time_to_file(lastWriteTime);
+        el->set_time_to_file(lastWriteTime);
     }
 
     //the file has been found and is the same -> send OK message
-    _send_OK(OkCode::found);
+    _send_OK(OkCode::found, operation.stream);
 }
 
 /**
- * ProfocolManager file store method.
- *  Used to interpret the STOR message got from client and to get all the DATA messages for a file;
- *  it stores the file in a temporary directory with a temporary random name, and when the file transfer is done
- *  then it checks the file was correctly saved and moves it to the final destination
- *  (overwriting any old existing file); then it updates the server db and elements map
+ * ProfocolManager file receive method.
+ *  Used to interpret the STOR message got from client and to start receiving the file: the file is saved in a
+ *  temporary directory as a partial file (named after user, mac and path, so that an interrupted transfer can be
+ *  resumed from the offset confirmed in the SEND message) by the disk/database stage. The DATA messages (or the
+ *  CANCEL message, if the client canceled the transfer) of the same stream are then handled by _receiveData
  *
  * @throws ProtocolManagerException:
- *  <b>version</b> if the DATA message version is not supported (should not happen, but it checks it anyway)
- * @throws ProtocolManagerException:
  *  <b>client</b> if there were errors in the client message (validation failed)
  * @throws ProtocolManagerException:
- *  <b>unexpected</b> if the DATA transfer was unexpectedly interrupted by another message type
- * @throws ProtocolManagerException:
- *  <b>client</b> if the transferred file is different from its description found in STOR message (so if either its
- *  size or hash is different)
- * @throws ProtocolManagerException:
- *  <b>internal</b> if an error occurred in creating the file
- *
- * @author Michele Crepaldi s269551
+ *  <b>unexpected</b> if a file is already being received on the same stream
  */
-void server::ProtocolManager::_storeFile(){
-    //recover user data from database (if not already done previously)
-    if(!_recovered)
-        recoverFromDB();
-
+void server::ProtocolManager::_receiveFile(){
     std::string path = _clientMessage.path();                   //file relative path
     uintmax_t size = _clientMessage.filesize();                 //file size
     std::string lastWriteTime = _clientMessage.lastwritetime(); //file last write time
     Hash h = Hash(_clientMessage.hash());                       //file hash
+    uintmax_t offset = _clientMessage.offset();                 //offset from which the client sends the file
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
     _clientMessage.Clear();
@@ -576,197 +967,242 @@ void server::ProtocolManager::_storeFile(){
     Directory_entry expected{_userPath, path, size, "file", lastWriteTime, h};
 
     Message::print(std::cout, "STOR", _address + " (" + _username + "@" + _mac + ")",
-                   expected.getRelativePath());
-
-    //create a random temporary name for the file
+                   expected.getRelativePath() + (offset != 0 ? " (resumed at " + std::to_string(offset) + ")" : ""));
 
-    RandomNumberGenerator rng;  //random number generator
-    std::string tmpFileName = "/" + rng.getHexString(_tempNameSize) + ".tmp";   //temporary file name
-
-    //check if the temporary folder already exists
-    bool tmpPathExists = std::filesystem::exists(_temporaryPath);
+    //there can only be one file being received on each stream
+    if(_transfers.count(_stream) != 0) {
+        //send error message with cause to client
+        _send_ERR(ErrCode::unexpected, _stream);
 
-    //if the temporary directory does not already exist
-    if(!tmpPathExists)
-        //create all the directories (that do not already exist) up to the temporary path
-        std::filesystem::create_directories(_temporaryPath);
+        throw ProtocolManagerException("Unexpected message, a file is already being received on this stream.",
+                                       ProtocolManagerError::unexpected);
+    }
 
-    std::ofstream temporaryFile; //temporary file
+    //file being received: partial (temporary) file, named after user, mac and path
+    auto transfer = std::make_shared<Transfer>(Transfer{std::move(expected),
+                                                        PartialFile{_temporaryPath, _partialKey(path), h}, offset,
+                                                        _pathKey(path)});
+    _transfers[_stream] = transfer;
+
+    //all the operations on the partial file (and then the store operation) are done in order, by the same
+    //disk/database thread of the other operations on the path
+    //create (or re-open at offset) the temporary file
+    _drain.add(_disk, transfer->key, Drain::Order::keyed, [transfer, temporaryPath = _temporaryPath](){
+        //if the temporary directory does not already exist
+        if(!std::filesystem::exists(temporaryPath))
+            //create all the directories (that do not already exist) up to the temporary path
+            std::filesystem::create_directories(temporaryPath);
+
+        //if the client is resuming a previous transfer, the data up to the offset must still be there
+        if(transfer->offset != 0 && transfer->file.recover() < transfer->offset) {
+            //the partial file is not there anymore (or it is shorter), the client has to send the file from scratch
+            transfer->file.remove();
+            transfer->resumable = false;
+            return;
+        }
 
-    //create the temporary file
-    temporaryFile.open(_temporaryPath + tmpFileName, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-    if(temporaryFile.is_open()){
-        try {
-            bool loop = true;
-            while(loop){
-                //receive message from client
+        transfer->opened = transfer->file.open(transfer->offset);
+    });
+}
 
-                std::string message = _s.recvString();      //message got from client
+/**
+ * ProfocolManager data receive method.
+ *  Used to handle a DATA message (or the CANCEL message) of one of the files being received (the one of the same
+ *  stream); the chunks are written to the partial file by the disk/database stage while the next ones are received.
+ *  When the transfer is done the file is checked and moved to its final destination by _storeFile (on the
+ *  disk/database stage)
+ *
+ * @return the file received if the whole file was received (and it has to be stored by _storeFile), nullptr
+ *  otherwise
+ *
+ * @throws ProtocolManagerException:
+ *  <b>unexpected</b> if no file is being received on the message stream
+ */
+std::shared_ptr<server::ProtocolManager::Transfer> server::ProtocolManager::_receiveData(){
+    auto it = _transfers.find(_stream); //file being received on this stream
 
-                //convert message to clientMessage protobuf
-                _clientMessage.ParseFromString(message);
+    //if there is no file being received on this stream (no STOR message was sent before), error!
+    if(it == _transfers.end()) {
+        //it is more efficient to clear the clientMessage protobuf than creating a new one
+        _clientMessage.Clear();
 
-                //check message version
-                if (_clientMessage.version() != _protocolVersion) { //if the version is different
-                    //it is more efficient to clear the clientMessage protobuf than creating a new one
-                    _clientMessage.Clear();
+        //send error message with cause to client
+        _send_ERR(ErrCode::unexpected, _stream);
 
-                    //send the version message
-                    _send_VER();
+        throw ProtocolManagerException("Unexpected message, no file is being received on this stream.",
+                                       ProtocolManagerError::unexpected);
+    }
 
-                    //close the temporary file
-                    temporaryFile.close();
+    //check if the client canceled the transfer (the file was modified while it was being sent)
+    if (_clientMessage.type() == messages::ClientMessage_Type_CANCEL) {
+        //it is more efficient to clear the clientMessage protobuf than creating a new one
+        _clientMessage.Clear();
 
-                    //delete the temporary file
-                    std::filesystem::remove(_temporaryPath + tmpFileName);
+        Message::print(std::cout, "CANCEL", _address + " (" + _username + "@" + _mac + ")",
+                       it->second->expected.getRelativePath());
 
-                    throw ProtocolManagerException("Client is using a different version",
-                                                   ProtocolManagerError::version);
-                }
+        //close and delete the temporary file (the client will send the new version of the file)
+        _abortTransfer(_stream);
 
-                //check message type, it has to be DATA type
-                if (_clientMessage.type() != messages::ClientMessage_Type_DATA) {   //if it is not of type DATA
-                    //it is more efficient to clear the clientMessage protobuf than creating a new one
-                    _clientMessage.Clear();
+        //send ok message to client
+        _send_OK(OkCode::canceled, _stream);
+        return nullptr;
+    }
 
-                    //close the temporary file
-                    temporaryFile.close();
+    bool last = _clientMessage.last();  //is this the last data packet?
 
-                    //delete the temporary file
-                    std::filesystem::remove(_temporaryPath + tmpFileName);
+    //write the data (chunk) to temporary file (moving it out of the clientMessage, no copy)
+    _drain.add(_disk, it->second->key, Drain::Order::keyed,
+                [transfer = it->second, data = std::move(*_clientMessage.mutable_data())](){
+        if(transfer->opened)
+            transfer->file.write(data.data(), data.size());
+    });
 
-                    //no DATA message with "last" boolean set was encountered before this message, error!
+    //it is more efficient to clear the clientMessage protobuf than creating a new one
+    _clientMessage.Clear();
 
-                    //send error message with cause to client
-                    _send_ERR(ErrCode::unexpected);
+    //if it was the last one the file has to be stored (by complete), it is not being received anymore
+    if(!last)
+        return nullptr;
 
-                    throw ProtocolManagerException("Unexpected message, DATA transfer was not done.",
-                                                   ProtocolManagerError::unexpected);
-                }
+    auto transfer = std::move(it->second);  //file received
+    _transfers.erase(it);
 
-                //is this the last data packet? if yes stop the loop
-                loop = !_clientMessage.last();
+    return transfer;
+}
 
-                //data got from the clientMessage protobuf
-                std::string data = _clientMessage.data();
+/**
+ * ProfocolManager file store method.
+ *  Used to store the file just received (by _receiveData); it is called on the disk/database stage after all the
+ *  chunks were written into the partial file: it checks the file was correctly saved and moves it to the final
+ *  destination (overwriting any old existing file); then it updates the server db and elements map
+ *
+ * @throws ProtocolManagerException:
+ *  <b>client</b> if the transferred file is different from its description found in STOR message (so if either its
+ *  size or hash is different)
+ * @throws ProtocolManagerException:
+ *  <b>client</b> if the resume offset is not available (anymore) on the server
+ * @throws ProtocolManagerException:
+ *  <b>internal</b> if an error occurred in creating the file
+ *
+ * @author Michele Crepaldi s269551
+ */
+void server::ProtocolManager::_storeFile(Operation &operation){
+    auto &transfer = operation.transfer;    //file received
 
-                //write the data to temporary file
-                temporaryFile.write(data.data(), data.size());
+    Directory_entry &expected = transfer->expected;     //expected Directory entry element
+    PartialFile &temporaryFile = transfer->file;        //partial (temporary) file
 
-                //it is more efficient to clear the clientMessage protobuf than creating a new one
-                _clientMessage.Clear();
-            }
-        }
-        //in case of socket exceptions while transferring the file I need to delete the temporary file
-        catch (SocketException &e) {
-            //close the temporary file
-            temporaryFile.close();
+    //if the client resumed a previous transfer, but the data up to the offset was not available anymore
+    if(!transfer->resumable) {
+        //send error message with cause to client
+        _send_ERR(ErrCode::store, operation.stream);
 
-            //delete the temporary file
-            std::filesystem::remove(_temporaryPath + tmpFileName);
+        throw ProtocolManagerException("Resume offset not available.", ProtocolManagerError::client);
+    }
 
-            //re-throw the exception
-            throw;
-        }
+    //if the temporary file could not be created
+    if(!transfer->opened) {
+        //send error message with cause to client
+        _send_ERR(ErrCode::exception, operation.stream);
 
-        //close the temporary file
-        temporaryFile.close();
+        throw ProtocolManagerException("Could not open file or something else happened.",
+                                       ProtocolManagerError::internal);
+    }
 
-        //Directory entry which represents the newly created file
-        Directory_entry newFile{_temporaryPath, std::filesystem::directory_entry(_temporaryPath + tmpFileName)};
+    //close the temporary file (and check all the data was written)
+    bool written = temporaryFile.close();
 
-        //change last write time for the temporary file to what was expected
-        newFile.set_time_to_file(expected.getLastWriteTime());
+    //Directory entry which represents the newly created file (its size and hash were computed while receiving
+    //the data, so there is no need to read the file again)
+    Directory_entry newFile{_temporaryPath, "/" + std::filesystem::path(temporaryFile.getPath()).filename().string(),
+                            temporaryFile.getSize(), "file", "", temporaryFile.getDataHash()};
 
-        //temporary file hash
-        Hash hash = newFile.getHash();
+    //change last write time for the temporary file to what was expected
+    newFile.set_time_to_file(expected.getLastWriteTime());
 
-        //check if the newly created (temporary) file properties match the expected ones
-        if(newFile.getSize() != expected.getSize() || hash != expected.getHash() ||
-                newFile.getLastWriteTime() != expected.getLastWriteTime()) {
+    //temporary file hash
+    Hash hash = newFile.getHash();
 
-            //if the temporary file is not as we expected
+    //check if the newly created (temporary) file properties match the expected ones
+    if(!written || newFile.getSize() != expected.getSize() || hash != expected.getHash() ||
+            newFile.getLastWriteTime() != expected.getLastWriteTime()) {
 
-            //delete the temporary file
-            std::filesystem::remove(_temporaryPath + tmpFileName);
+        //if the temporary file is not as we expected
 
-            //send error message with cause to client
-            _send_ERR(ErrCode::store);
+        //delete the temporary file
+        temporaryFile.remove();
 
-            throw ProtocolManagerException("Stored file is different than expected.",
-                                           ProtocolManagerError::client);
-        }
+        //send error message with cause to client
+        _send_ERR(ErrCode::store, operation.stream);
 
-        //get the file parent path from the expected file name
+        throw ProtocolManagerException("Stored file is different than expected.",
+                                       ProtocolManagerError::client);
+    }
 
-        //file parent path
-        std::filesystem::path parentPath = std::filesystem::path(expected.getAbsolutePath()).parent_path();
+    //get the file parent path from the expected file name
 
-        //check if the parent folder already exists
-        bool parentExists = std::filesystem::exists(parentPath);
+    //file parent path
+    std::filesystem::path parentPath = std::filesystem::path(expected.getAbsolutePath()).parent_path();
 
-        //if the parent directory does not exist
-        if(!parentExists)
-            //create all the directories (that do not already exist) up to the parent path
-            std::filesystem::create_directories(parentPath);
+    //check if the parent folder already exists
+    bool parentExists = std::filesystem::exists(parentPath);
 
-        //save the lastWriteTime of the destination folder (parent directory) before moving the file,
-        //any lastWriteTime modification to that directory will be requested explicitly by the client,
-        //so we want to keep the same time before and after the file move
+    //if the parent directory does not exist
+    if(!parentExists)
+        //create all the directories (that do not already exist) up to the parent path
+        std::filesystem::create_directories(parentPath);
 
-        //Directory entry representing the file parent directory
-        Directory_entry parent;
+    //save the lastWriteTime of the destination folder (parent directory) before moving the file,
+    //any lastWriteTime modification to that directory will be requested explicitly by the client,
+    //so we want to keep the same time before and after the file move
 
-        //only if the parent path is different from server base path get parent Directory entry (otherwise we
-        //have problems getting relative path
-        if(parentPath.string() != _userPath)
-            parent = Directory_entry{_userPath, parentPath.string()};
+    //Directory entry representing the file parent directory
+    Directory_entry parent;
 
-        //If we are here then the file was successfully transferred and its copy on the server is as expected
-        //it can be moved to the final destination
-        std::filesystem::rename(_temporaryPath + tmpFileName, expected.getAbsolutePath());
+    //only if the parent path is different from server base path get parent Directory entry (otherwise we
+    //have problems getting relative path
+    if(parentPath.string() != _userPath)
+        parent = Directory_entry{_userPath, parentPath.string()};
 
-        //if the parent directory is not the server base path
-        if(parentPath.string() != _userPath)
-            //reset the parent directory lastWriteTime
-            parent.set_time_to_file(parent.getLastWriteTime());
+    //If we are here then the file was successfully transferred and its copy on the server is as expected
+    //it can be moved to the final destination
+    std::filesystem::rename(temporaryFile.getPath(), expected.getAbsolutePath());
 
-        Message::print(std::cout, "DATA", _address + " (" + _username + "@" + _mac + ")",
-                       expected.getRelativePath());
+    //the transfer is complete, remove what is left of the partial file (its checksums)
+    temporaryFile.remove();
 
-        //update the elements map and db
+    //if the parent directory is not the server base path
+    if(parentPath.string() != _userPath)
+        //reset the parent directory lastWriteTime
+        parent.set_time_to_file(parent.getLastWriteTime());
 
-        //(string,Directory_entry) pair corresponding to the expected relative path
-        auto el = _elements.find(expected.getRelativePath());
+    Message::print(std::cout, "DATA", _address + " (" + _username + "@" + _mac + ")",
+                   expected.getRelativePath());
 
-        //if the element was not found
-        if(el == _elements.end()) {
-            //add the expected file to the db
-            _db->insert(_username, _mac, expected);
+    //update the elements map and db
 
-            //add the expected file to the elements map
-            _elements.emplace(expected.getRelativePath(), std::move(expected));
-        }
-        else{
-            //update into db
-            _db->update(_username, _mac, expected);
+    //(string,Directory_entry) pair corresponding to the expected relative path
+    auto el = _session->find(expected.getRelativePath());
 
-            //update the expected file element in the elements map
-            el->second = std::move(expected);
-        }
+    //if the element was not found
+    if(el == nullptr) {
+        //add the expected file to the db
+        _db->insert(_username, _mac, expected);
 
-        //send ok message to client
-        _send_OK(OkCode::created);
-        return;
+        //add the expected file to the elements map
+        _session->add(std::move(expected));
     }
+    else{
+        //update into db
+        _db->update(_username, _mac, expected);
 
-    //if I am here some error occurred
-
-    //send error message with cause to client
-    _send_ERR(ErrCode::exception);
+        //update the expected file element in the elements map
+        *el = std::move(expected);
+    }
 
-    throw ProtocolManagerException("Could not open file or something else happened.",
-                                   ProtocolManagerError::internal);
+    //send ok message to client
+    _send_OK(OkCode::created, operation.stream);
 }
 
 /**
@@ -784,16 +1220,12 @@ void server::ProtocolManager::_storeFile(){
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_removeFile(){
-    //recover user data from database (if not already done previously)
-    if(!_recovered)
-        recoverFromDB();
-
-    std::string path = _clientMessage.path();     //file relative path
-    Hash h{_clientMessage.hash()};                      //file Hash
+void server::ProtocolManager::_removeFile(Operation &operation){
+    std::string path = operation.message.path();     //file relative path
+    Hash h{operation.message.hash()};                      //file Hash
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
-    _clientMessage.Clear();
+    operation.message.Clear();
 
 
     //validate path got from clientMessage
@@ -804,36 +1236,36 @@ void server::ProtocolManager::_removeFile(){
     Message::print(std::cout, "DELE", _address + " (" + _username + "@" + _mac + ")", path);
 
     //(string,Directory_entry) pair corresponding to the relative path got from clientMessage
-    auto el = _elements.find(path);
+    auto el = _session->find(path);
 
     //if i cannot find the element, i don't have to remove it (the result is the same)
-    if(el == _elements.end()) {
+    if(el == nullptr) {
 
         //send ok message to client
-        _send_OK(OkCode::notThere);
+        _send_OK(OkCode::notThere, operation.stream);
         return;
     }
     //otherwise
 
     //if the file does not exist on filesystem, i don't have to remove it (the result is the same)
-    if(!el->second.exists()){
+    if(!el->exists()){
         //remove the file from db
-        _db->remove(_username, _mac, el->second.getRelativePath());
+        _db->remove(_username, _mac, el->getRelativePath());
 
         //remove the file from the elements map
-        _elements.erase(el->second.getRelativePath());
+        _session->remove(el->getRelativePath());
 
         //send ok message to client
-        _send_OK(OkCode::notThere);
+        _send_OK(OkCode::notThere, operation.stream);
         return;
     }
     //otherwise
 
     //if it is not a file OR if the file hash does not correspond
-    if(!el->second.is_regular_file() || el->second.getHash() != h){
+    if(!el->is_regular_file() || el->getHash() != h){
 
         //send error message with cause to client
-        _send_ERR(ErrCode::remove);
+        _send_ERR(ErrCode::remove, operation.stream);
 
         throw ProtocolManagerException("Tried to remove something which is not a file or file hash does"
                                        "not correspond.", ProtocolManagerError::client);
@@ -842,7 +1274,7 @@ void server::ProtocolManager::_removeFile(){
     //get the file parent path
 
     //file parent path
-    std::filesystem::path parentPath = std::filesystem::path(el->second.getAbsolutePath()).parent_path();
+    std::filesystem::path parentPath = std::filesystem::path(el->getAbsolutePath()).parent_path();
 
     //save the lastWriteTime of the destination folder (parent directory) before removing the file,
     //any lastWriteTime modification to that directory will be requested explicitly by the client,
@@ -857,7 +1289,7 @@ void server::ProtocolManager::_removeFile(){
         parent = Directory_entry{_userPath, parentPath.string()};
 
     //remove the file
-    if(!std::filesystem::remove(el->second.getAbsolutePath()))
+    if(!std::filesystem::remove(el->getAbsolutePath()))
         //if it could not remove the file throw an exception
         throw ProtocolManagerException("Could not remove a file", ProtocolManagerError::internal);
 
@@ -867,13 +1299,13 @@ void server::ProtocolManager::_removeFile(){
         parent.set_time_to_file(parent.getLastWriteTime());
 
     //remove the file from db
-    _db->remove(_username, _mac, el->second.getRelativePath());
+    _db->remove(_username, _mac, el->getRelativePath());
 
     //remove the file from the elements map
-    _elements.erase(el->second.getRelativePath());
+    _session->remove(el->getRelativePath());
 
     //send ok message to client
-    _send_OK(OkCode::removed);
+    _send_OK(OkCode::removed, operation.stream);
 }
 
 /**
@@ -888,16 +1320,12 @@ void server::ProtocolManager::_removeFile(){
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_makeDir(){
-    //recover user data from database (if not already done previously)
-    if(!_recovered)
-        recoverFromDB();
-
-    std::string path = _clientMessage.path();                     //dir relative path
-    std::string lastWriteTime = _clientMessage.lastwritetime();   //dir last write time
+void server::ProtocolManager::_makeDir(Operation &operation){
+    std::string path = operation.message.path();                     //dir relative path
+    std::string lastWriteTime = operation.message.lastwritetime();   //dir last write time
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
-    _clientMessage.Clear();
+    operation.message.Clear();
 
 
     //validate path got from clientMessage
@@ -912,13 +1340,13 @@ void server::ProtocolManager::_makeDir(){
     Message::print(std::cout, "MKD", _address + " (" + _username + "@" + _mac + ")", path);
 
     //(string,Directory_entry) pair corresponding to the relative path got from clientMessage
-    auto el = _elements.find(path);
+    auto el = _session->find(path);
 
     //if I found the element AND the element exists AND the element has the same last write time as expected
-    if(el != _elements.end() && el->second.exists() && el->second.getLastWriteTime() == lastWriteTime){
+    if(el != nullptr && el->exists() && el->getLastWriteTime() == lastWriteTime){
 
         //send ok message to client
-        _send_OK(OkCode::created);
+        _send_OK(OkCode::created, operation.stream);
         return;
     }
     //otherwise
@@ -950,7 +1378,7 @@ void server::ProtocolManager::_makeDir(){
     if(!std::filesystem::is_directory(_userPath + path)){
 
         //send error message with cause to client
-        _send_ERR(ErrCode::notADir);
+        _send_ERR(ErrCode::notADir, operation.stream);
 
         throw ProtocolManagerException("Tried to modify something which is not a directory.",
                                        ProtocolManagerError::client);
@@ -968,23 +1396,23 @@ void server::ProtocolManager::_makeDir(){
         parent.set_time_to_file(parent.getLastWriteTime());
 
     //if I could not find the directory in the elements map
-    if(el == _elements.end()) {
+    if(el == nullptr) {
         //add the newly created directory to the db
         _db->insert(_username, _mac, newDir);
 
         //add the newly created directory to the elements map
-        _elements.emplace(newDir.getRelativePath(), std::move(newDir));
+        _session->add(std::move(newDir));
     }
     else{
         //update the directory in the db
         _db->update(_username, _mac, newDir);
 
         //update the directory in the elements map
-        el->second = std::move(newDir);
+        *el = std::move(newDir);
     }
 
     //send ok message to client
-    _send_OK(OkCode::created);
+    _send_OK(OkCode::created, operation.stream);
 }
 
 /**
@@ -1000,15 +1428,11 @@ void server::ProtocolManager::_makeDir(){
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_removeDir(){
-    //recover user data from database (if not already done previously)
-    if(!_recovered)
-        recoverFromDB();
-
-    std::string path = _clientMessage.path();   //dir relative path
+void server::ProtocolManager::_removeDir(Operation &operation){
+    std::string path = operation.message.path();   //dir relative path
 
     //it is more efficient to clear the clientMessage protobuf than creating a new one
-    _clientMessage.Clear();
+    operation.message.Clear();
 
 
     //validate path got from clientMessage
@@ -1019,43 +1443,43 @@ void server::ProtocolManager::_removeDir(){
     Message::print(std::cout, "RMD", _address + " (" + _username + "@" + _mac + ")", path);
 
     //(string,Directory_entry) pair corresponding to the relative path got from clientMessage
-    auto el = _elements.find(path);
+    auto el = _session->find(path);
 
     //if i cannot find the element, I don't have to remove it (the result is the same)
-    if(el == _elements.end()) {
+    if(el == nullptr) {
 
         //send ok message to client
-        _send_OK(OkCode::notThere);
+        _send_OK(OkCode::notThere, operation.stream);
         return;
     }
     //otherwise
 
     //if the directory does not exist in filesystem, I don't have to remove it (the result is the same)
-    if(!el->second.exists()) {
-        //remove element from db
-        _db->remove(_username, _mac, el->second.getRelativePath());
+    if(!el->exists()) {
+        //remove the directory and everything in it from db
+        _db->removeDir(_username, _mac, path);
 
-        //remove the element from the elements map
-        _elements.erase(el->second.getRelativePath());
+        //remove the directory and everything in it from the elements map
+        _session->removeDir(path);
 
         //send ok message to client
-        _send_OK(OkCode::notThere);
+        _send_OK(OkCode::notThere, operation.stream);
         return;
     }
     //otherwise
 
     //if it is not a directory
-    if(!el->second.is_directory()){
+    if(!el->is_directory()){
 
         //send error message with cause to client
-        _send_ERR(ErrCode::notADir);
+        _send_ERR(ErrCode::notADir, operation.stream);
 
         throw ProtocolManagerException("Tried to remove something which is not a directory.",
                                        ProtocolManagerError::client);
     }
     //otherwise
 
-    auto dirToRemove = el->second;
+    auto dirToRemove = *el;
 
     //get the dir parent path
 
@@ -1074,34 +1498,13 @@ void server::ProtocolManager::_removeDir(){
     if(parentPath.string() != _userPath)
         parent = Directory_entry{_userPath, parentPath.string()};
 
-    //recursive directory iterator for the directory to remove
-    std::filesystem::recursive_directory_iterator iter{dirToRemove.getAbsolutePath()};
-
-    //vector of all elements to remove
-    std::vector<Directory_entry> elementsToRemove;
-
-    //save the elements in a vector before removing them in order to be sure to remove them all
-    for(auto i: iter)
-        elementsToRemove.emplace_back(_userPath, i);
-
     //remove the directory (and all its subdirectories and files) from filesystem
     if(std::filesystem::remove_all(dirToRemove.getAbsolutePath()) == 0)
         throw ProtocolManagerException("Could not remove an element.", ProtocolManagerError::internal);
 
-    //then remove each sub element from both the db and elements map
-    for(auto i: elementsToRemove){
-        //remove element from the db
-        _db->remove(_username, _mac, i.getRelativePath());
-
-        //remove the element from the elements map
-        _elements.erase(i.getRelativePath());
-    }
-
-    //remove the directory from the db
-    _db->remove(_username, _mac, dirToRemove.getRelativePath());
-
-    //remove the directory from the elements map
-    _elements.erase(dirToRemove.getRelativePath());
+    //then remove the directory and everything in it (a range of paths) from both the db and elements map
+    _db->removeDir(_username, _mac, dirToRemove.getRelativePath());
+    _session->removeDir(dirToRemove.getRelativePath());
 
     //if the parent directory is not the base path
     if(parentPath.string() != _userPath)
@@ -1109,7 +1512,7 @@ void server::ProtocolManager::_removeDir(){
         parent.set_time_to_file(parent.getLastWriteTime());
 
     //send ok message to client
-    _send_OK(OkCode::removed);
+    _send_OK(OkCode::removed, operation.stream);
 }
 
 /**
@@ -1121,6 +1524,7 @@ void server::ProtocolManager::_removeDir(){
  * @author Michele Crepaldi s269551
  */
 void server::ProtocolManager::_send_MKD(const std::string &path, Directory_entry &e){
+    std::lock_guard<std::mutex> lock(_sendMutex);
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_MKD);
 
@@ -1133,106 +1537,100 @@ void server::ProtocolManager::_send_MKD(const std::string &path, Directory_entry
 
 /**
  * ProtocolManager send STOR message method.
- *  It will set the serverMessage protobuf version, type, path, file size, last write time and hash and then send it
+ *  It will set the serverMessage protobuf version, type, path, file size, last write time, hash and offset and then
+ *  send it
  *
  * @param path relative path of the file on client (with respect to the client base path)
  * @param element Directory_entry element (file) to store on client
+ * @param offset offset from which the file will be sent (size of the partial file the client already has)
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_send_STOR(const std::string &path, Directory_entry &element){
+void server::ProtocolManager::_send_STOR(const std::string &path, Directory_entry &element, uintmax_t offset){
+    std::lock_guard<std::mutex> lock(_sendMutex);
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_STOR);
 
-    //set the path, filesize, last write time and hash
+    //set the path, filesize, last write time, hash and offset
     _serverMessage.set_path(path);
     _serverMessage.set_filesize(element.getSize());
     _serverMessage.set_lastwritetime(element.getLastWriteTime());
     _serverMessage.set_hash(element.getHash().get().first, element.getHash().get().second);
+    _serverMessage.set_offset(offset);
 
     _send_serverMessage();
 }
 
 /**
  * ProtocolManager send DATA message method.
- *  It will set the serverMessage protobuf version, type, data and then send it
+ *  It will set the serverMessage protobuf version, type, data and last then send it
  *
  * @param buff buffer to the data to send
  * @param len length of the data to send
+ * @param last whether it is the last data block of the file
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_send_DATA(char *buff, uint64_t len){
+void server::ProtocolManager::_send_DATA(const char *buff, uint64_t len, bool last){
+    std::lock_guard<std::mutex> lock(_sendMutex);
     _serverMessage.set_version(_protocolVersion);
     _serverMessage.set_type(messages::ServerMessage_Type_DATA);
 
-    //set the data
+    //set the data and whether it is the last block
     _serverMessage.set_data(buff, len);
+    _serverMessage.set_last(last);
 
     _send_serverMessage();
 }
 
 /**
  * ProtocolManager retrieve user data method.
- *  It is used to retrieve the user's requested data and send it to the client
+ *  It is used to retrieve the user's requested data and send it to the client; the elements are read from the db
+ *  a batch at a time (in path order, so every directory is sent before its content), so the sending starts
+ *  immediately and the db is not locked while sending. The files the client already has (whose digests it sent with
+ *  the RETR messages, which can be more than one when they are many) are not sent again
+ *
+ * @param message (last) RETR message received
+ * @param stop atomic boolean telling that the server is stopping (the retrieve is then interrupted, the client
+ *  resumes it later)
  *
  * @throws ProtocolManagerException:
  *  <b>client</b> if there were errors in the client message (validation failed)
  *
  * @author Michele Crepaldi s269551
  */
-void server::ProtocolManager::_retrieveUserData(){
+void server::ProtocolManager::_retrieveUserData(messages::ClientMessage &message, const std::atomic<bool> &stop){
+
+    //digests of the files the client already has (all of them now)
+    std::unordered_set<uint64_t> present;
+    present.swap(_present);
+
+    //whether the digests include the files hashes
+    bool hashed = message.hashed();
 
     //client macAddress (if present, otherwise a default "" value is passed)
-    std::string macAddr = _clientMessage.macaddress();
+    std::string macAddr = message.macaddress();
 
-    bool retrAll = _clientMessage.all(); //retrieve all boolean
+    bool retrAll = message.all(); //retrieve all boolean
 
-    //it is more efficient to clear the clientMessage protobuf than creating a new one
-    _clientMessage.Clear();
+    //files partially received by the client in a previous RETR (path -> (hash, offset)), they will be resumed
+    std::unordered_map<std::string, std::pair<Hash, uintmax_t>> resume;
+    for(auto &r : message.resume())
+        resume.emplace(r.path(), std::make_pair(Hash(r.hash()), r.offset()));
 
+    //the message is not needed anymore
+    message.Clear();
 
-    //vector with all the elements to send
-    std::vector<std::pair<std::string, Directory_entry>> toSend{};
+
+    //mac addresses whose elements have to be sent
+    std::vector<std::string> macs;
 
     //if retrieve all boolean is true, the user requested all its files (independently from the machine mac address)
     if(retrAll){
 
         Message::print(std::cout, "RETR", _address + " (" + _username + "@" + _mac + ")", "All files");
 
-        auto macs = _db->getAllMacAddresses(_username);   //all the user's mac addresses
-
-        //for all the mac addresses
-        for(const auto& m: macs){
-
-            //compose the relative root directory name from username and mac; this will be the folder in which the
-            //files and directories associated to this username-mac pair will be saved on client
-
-            std::stringstream tmp;
-            tmp << "/" << _username << "_" << std::regex_replace(m, std::regex(":"), "-");
-
-            //relative root directory name (from username-mac pair)
-            std::string relativeRoot = tmp.str();
-
-            //function to be used for each user's element in the db (for mac address m)
-            std::function<void(const std::string &, const std::string &, uintmax_t, const std::string &,
-                    const std::string &)> f;
-
-            f = [this, &toSend, &relativeRoot, &m](const std::string &path, const std::string &type, uintmax_t size,
-                    const std::string &lastWriteTime, const std::string& hash){
-
-                //current element
-                auto current = Directory_entry(_basePath + relativeRoot, path, size, type,
-                                               lastWriteTime, Hash(hash));
-
-                //pre-append the relative root (username_mac) to the element relative path
-                //and insert the pair into the toSend map
-                toSend.emplace_back(m, std::move(current));
-            };
-
-            //perform the function f on all the user elements (with mac m)
-            _db->forAll(_username, m, f);
-        }
+        macs = _db->getAllMacAddresses(_username);   //all the user's mac addresses
     }
     else{   //if retrieve all boolean is false, macAddress will contain the specific mac address to use
 
@@ -1240,7 +1638,7 @@ void server::ProtocolManager::_retrieveUserData(){
         if(macAddr.empty()){
 
             //send the error message with cause to the client
-            _send_ERR(ErrCode::retrieve);
+            _send_ERR(ErrCode::retrieve, _stream);
 
             throw ProtocolManagerException("Error in client message", ProtocolManagerError::client);
         }
@@ -1252,80 +1650,102 @@ void server::ProtocolManager::_retrieveUserData(){
         Message::print(std::cout, "RETR", _address + " (" + _username + "@" + _mac + ")", "mac = "
                         + macAddr);
 
+        macs.push_back(macAddr);
+    }
+
+    uintmax_t skipped = 0;  //number of files the client already has (not sent)
+
+    //for all the mac addresses
+    for(auto &currentMac: macs){
+
         //compose the relative root directory name from username and mac; this will be the folder in which the
         //files and directories associated to this username-mac pair will be saved on client
 
         std::stringstream tmp;
-        tmp << "/" << _username << "_" << std::regex_replace(macAddr, std::regex(":"), "-");
+        tmp << "/" << _username << "_" << std::regex_replace(currentMac, std::regex(":"), "-");
 
         //relative root directory name (from username-mac pair)
         std::string relativeRoot = tmp.str();
 
-        //function to be used for each user's element in the db (for mac address m)
+        //batch of elements to send, with their stat tuples (read from the db, which is not locked while they are sent)
+        std::vector<std::pair<Directory_entry, Stat>> batch;
+        batch.reserve(RETR_BATCH);
+
+        //function to be used for each user's element in the db (for mac address currentMac)
         std::function<void(const std::string &, const std::string &, uintmax_t, const std::string &,
-                           const std::string &)> f;
+                           const std::string &, const Stat &)> f;
 
-        f = [this, &toSend, &relativeRoot, &macAddr](const std::string &path, const std::string &type, uintmax_t size,
-                                           const std::string &lastWriteTime, const std::string& hash){
+        f = [this, &batch, &relativeRoot](const std::string &path, const std::string &type, uintmax_t size,
+                                          const std::string &lastWriteTime, const std::string& hash,
+                                          const Stat &stat){
 
             //current element
-            auto current = Directory_entry(_basePath + relativeRoot, path, size, type, lastWriteTime, Hash(hash));
-
-            //pre-append the relative root (username_mac) to the element relative path
-            //and insert the pair into the toSend map
-            toSend.emplace_back(macAddr, std::move(current));
+            batch.emplace_back(Directory_entry(_basePath + relativeRoot, path, size, type, lastWriteTime, Hash(hash)),
+                               stat);
         };
 
-        //perform the function f on all the user-macAddress elements
-        _db->forAll(_username, macAddr, f);
-    }
+        std::string after;  //path of the last element read (the next batch starts after it)
+        unsigned int count; //number of elements of the last batch
 
-    //now, in toSend map I will have all the elements to send to the client
+        //read the elements a batch at a time (in path order, so every directory is sent before its content)
+        do {
+            //if the server is stopping, interrupt the retrieve (the client will resume it)
+            if(stop.load())
+                return;
 
-    //for all the pairs in the toSend map
-    for(auto pair: toSend){
-        std::string currentMac = pair.first;
-        Directory_entry current = std::move(pair.second);
+            batch.clear();
+            count = _db->forAll(_username, currentMac, after, RETR_BATCH, f);
 
-        //if the file to transfer does not exist anymore in the filesystem
-        if(!std::filesystem::exists(current.getAbsolutePath())) {
+            if(!batch.empty())
+                after = batch.back().first.getRelativePath();
 
-            //remove it from the db and just go to the next element (return)
-            _db->remove(_username, currentMac, current.getRelativePath());
+            for(auto &pair: batch){
+                Directory_entry &current = pair.first;  //current element
 
-            //print a warning and skip it
-            Message::print(std::cerr, "WARNING",_address + " (" + _username + "@" + _mac + ")",
-                           current.getRelativePath() + " was removed offline. It will not be sent");
-            continue;
-        }
+                //if the client already has this same file, skip it
+                if(current.is_regular_file() && present.count(Directory_entry::digest(
+                        relativeRoot + current.getRelativePath(), current.getSize(), current.getLastWriteTime(),
+                        hashed ? current.getHash().str() : "")) != 0){
+                    skipped++;
+                    continue;
+                }
 
-        //if it is a directory
-        if(current.is_directory()){
-            //compose the relative root directory name from username and mac; this will be the folder in which the
-            //files and directories associated to this username-mac pair will be saved on client
+                //if the file to transfer does not exist anymore in the filesystem
+                if(!std::filesystem::exists(current.getAbsolutePath())) {
 
-            std::stringstream tmp;
-            tmp << "/" << _username << "_" << std::regex_replace(currentMac, std::regex(":"), "-");
+                    //remove it from the db and just go to the next element (return)
+                    _db->remove(_username, currentMac, current.getRelativePath());
 
-            //relative root directory name (from username-mac pair)
-            std::string relativeRoot = tmp.str();
+                    //print a warning and skip it
+                    Message::print(std::cerr, "WARNING",_address + " (" + _username + "@" + _mac + ")",
+                                   current.getRelativePath() + " was removed offline. It will not be sent");
+                    continue;
+                }
 
-            Message::print(std::cout, "RETR-MKD", _address + " (" + _username + "@" + _mac + ")",
-                           relativeRoot + current.getRelativePath());
+                //if it is a directory
+                if(current.is_directory()){
+                    Message::print(std::cout, "RETR-MKD", _address + " (" + _username + "@" + _mac + ")",
+                                   relativeRoot + current.getRelativePath());
 
-            //send MKD message to client
-            _send_MKD(relativeRoot + current.getRelativePath(), current);
-        }
-        //if it is a file
-        else if(current.is_regular_file()) {
-            //send the file to the client
-            _sendFile(current, currentMac);
-        }
-        //else the element is not supported so just skip it
+                    //send MKD message to client
+                    _send_MKD(relativeRoot + current.getRelativePath(), current);
+                }
+                //if it is a file
+                else if(current.is_regular_file()) {
+                    //send the file to the client
+                    _sendFile(current, pair.second, currentMac, resume);
+                }
+                //else the element is not supported so just skip it
+            }
+        } while(count == RETR_BATCH);
     }
 
+    if(skipped != 0)
+        Message::print(std::cout, "RETR", _address + " (" + _username + "@" + _mac + ")",
+                       std::to_string(skipped) + " files already present on the client were not sent");
+
     //send ok message to the client, this will signal the end of transmissions
-    _send_OK(OkCode::retrieved);
+    _send_OK(OkCode::retrieved, _stream);
 }
 
 /**
@@ -1333,16 +1753,15 @@ void server::ProtocolManager::_retrieveUserData(){
  *  It is used to send a single file to the client
  *
  * @param element Directory_entry element to send
+ * @param stat stat tuple of the server copy of the element stored in the db
  * @param macAddr macAddress related to this element (together with _username)
+ * @param resume files partially received by the client (path -> (hash, offset)), to be resumed from offset
  *
  * @throws ProtocolManagerException:
  *  <b>internal</b> if the file could not be opened
  */
-void server::ProtocolManager::_sendFile(Directory_entry &element,
-                                        std::string &macAddr) {
-
-    std::ifstream file;             //input file
-    char buff[_maxDataChunkSize];   //buffer used to read from file and send to socket
+void server::ProtocolManager::_sendFile(Directory_entry &element, const Stat &stat, std::string &macAddr,
+                                        std::unordered_map<std::string, std::pair<Hash, uintmax_t>> &resume) {
 
     //compose the relative root directory name from username and mac; this will be the folder in which the
     //files and directories associated to this username-mac pair will be saved on client
@@ -1353,43 +1772,78 @@ void server::ProtocolManager::_sendFile(Directory_entry &element,
     //relative root directory name (from username-mac pair)
     std::string relativeRoot = tmp.str();
 
-    //directory entry representing the effective file present on filesystem (with same name)
-    Directory_entry effective{_basePath + relativeRoot, element.getAbsolutePath()};
+    std::string absolutePath = element.getAbsolutePath();  //absolute path of the server copy of the file
+    Stat current = Stat::of(absolutePath);  //stat tuple of the server copy of the file (before hashing it)
 
-    //if the file hash got from db is different from the one of the file present in the filesystem
-    if(element.getHash() != effective.getHash()){
-        //the file was modified on server!
+    //if the file still has the size and stat tuple stored in the db it is trusted (its content is verified in the
+    //background by the scrubber, and by the client when receiving it), otherwise it is hashed before sending it
+    if(std::filesystem::file_size(absolutePath) != element.getSize() || current != stat) {
 
-        //remove it from the db, since the file saved does not exist anymore
-        _db->remove(_username, macAddr, element.getRelativePath());
+        //directory entry representing the effective file present on filesystem (with same name)
+        Directory_entry effective{_basePath + relativeRoot, absolutePath};
 
-        //print a warning and skip it
-        Message::print(std::cerr, "WARNING",_address + " (" + _username + "@" + _mac + ")",
-                       element.getRelativePath() + " was modified offline. It will not be sent");
+        //lock the path (a connection of the user-mac pair may be working on it)
+        auto session = _sessions->find(_username, macAddr); //session of the user-mac pair (if loaded)
+        std::optional<Session::PathLock> lock;
+        if(session != nullptr)
+            lock.emplace(*session, _basePath + relativeRoot, element.getRelativePath(), true);
 
-        return;
+        //if the file was changed (or saved again) while it was being hashed the db is left as it is
+        bool unchanged = Stat::of(absolutePath) == current; //whether the file is the one just hashed
+
+        //if the file hash got from db is different from the one of the file present in the filesystem
+        if(element.getHash() != effective.getHash()){
+            //the file was modified on server!
+
+            //remove it from the db (and from the elements map), since the file saved does not exist anymore
+            if(unchanged) {
+                _db->remove(_username, macAddr, element.getRelativePath());
+
+                if(session != nullptr)
+                    session->remove(element.getRelativePath());
+            }
+
+            //print a warning and skip it
+            Message::print(std::cerr, "WARNING",_address + " (" + _username + "@" + _mac + ")",
+                           element.getRelativePath() + " was modified offline. It will not be sent");
+
+            return;
+        }
+
+        //a file with a different stat tuple but the same content (for example copied back) only needs its stat tuple
+        //to be updated in the db (so it is not hashed again by the next retrieve)
+        if(unchanged)
+            _db->update(_username, macAddr, element.getRelativePath(), "file", element.getSize(),
+                        element.getLastWriteTime(), element.getHash().str(), current);
     }
 
+    uintmax_t offset = 0;   //offset from which to send the file
+
+    //if the client already has part of this same file, resume the transfer from there
+    auto r = resume.find(relativeRoot + element.getRelativePath());
+    if(r != resume.end() && r->second.first == element.getHash() && r->second.second <= element.getSize())
+        offset = r->second.second;
+
     Message::print(std::cout, "RETR-STOR", _address + " (" + _username + "@" + _mac + ")",
-                   relativeRoot + element.getRelativePath());
+                   relativeRoot + element.getRelativePath() +
+                   (offset != 0 ? " (resumed at " + std::to_string(offset) + ")" : ""));
 
     //send STOR message to the client
-    _send_STOR(relativeRoot + element.getRelativePath(), element);
+    _send_STOR(relativeRoot + element.getRelativePath(), element, offset);
 
-    //open input file
-    file.open(element.getAbsolutePath(), std::ios::in | std::ios::binary);
+    //open input file (skipping the part of the file the client already has), the next blocks are read ahead while
+    //the current one is sent
+    FileReader file{absolutePath, _maxDataChunkSize, _readAheadBuffers, offset};
 
     if(file.is_open()){
+        const char *block;  //current block
+        size_t len;         //current block length
 
         //read file in maxDataChunkSize-wide blocks
-        while(file.read(buff, _maxDataChunkSize))
-            _send_DATA(buff, file.gcount());    //send the block
-
-        _serverMessage.set_last(true);  //mark the last data block
-
-        _send_DATA(buff, file.gcount()); //send the last block
+        while(file.read(block, len))
+            _send_DATA(block, len, false);  //send the block
 
-        file.close();   //close the input file
+        _send_DATA(block, len, true);   //send the last block (marked as such)
     }
     else    //if file could not be opened
         throw ProtocolManagerException("Could not open file", ProtocolManagerError::internal);
@@ -8,11 +8,21 @@
 #ifndef SERVER_PROTOCOLMANAGER_H
 #define SERVER_PROTOCOLMANAGER_H
 
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+
 #include "../myLibraries/Socket.h"
 #include "../myLibraries/Directory_entry.h"
+#include "../myLibraries/PartialFile.h"
 #include "messages.pb.h"
 #include "Database.h"
 #include "Database_pwd.h"
+#include "Session.h"
+#include "Stage.h"
 
 
 /**
@@ -96,7 +106,10 @@ namespace server {
         authenticated,
 
         //all the user requested data was sent
-        retrieved
+        retrieved,
+
+        //file transfer canceled by the client (the file was modified while it was being sent)
+        canceled
     };
 
     /*
@@ -108,6 +121,11 @@ namespace server {
      * ProtocolManager class. It manages the communication with the client interpreting the messages,
      *  executing the related actions and responding back to the client.
      *
+     *  <p> The messages are received by a network thread; the ones which need the disk and the database become
+     *  operations completed on the disk/database stage, concurrently when they are about independent paths (in order
+     *  otherwise), so their replies can be sent out of order (each reply carries the stream of its message). The
+     *  replies are queued and sent by the network thread (flush), so the socket is only used by one thread at a time.
+     *
      * @author Michele Crepaldi s269551
      */
     class ProtocolManager {
@@ -118,21 +136,62 @@ namespace server {
         ProtocolManager& operator=(ProtocolManager &&) = delete;        //move assignment deleted
         ~ProtocolManager() = default;   //default destructor
 
-        //constructor with the socket, client address, protocol version
-        ProtocolManager(Socket &s, std::string address, int ver);
+        //constructor with the socket, client address, protocol version, disk/database stage and connection drain
+        ProtocolManager(Socket &s, std::string address, int ver, Stage &disk, Drain &drain);
+
+        /**
+         * Transfer struct. A file being received from the client: its chunks are written into the partial file by
+         *  the disk/database stage while the next ones are received
+         */
+        struct Transfer {
+            Directory_entry expected;   //expected file (described by the STOR message)
+            PartialFile file;           //partial (temporary) file
+            uintmax_t offset;           //offset from which the client sends the file
+            unsigned int key;           //key of the disk/database operations on the file
+            bool resumable = true;      //whether the data up to the offset is still available
+            bool opened = false;        //whether the partial file was opened
+        };
+
+        /**
+         * Operation struct. A received message to be completed on the disk/database stage (the operations with the
+         *  same key are completed in order, the others concurrently)
+         */
+        struct Operation {
+            //constructor with the type, stream and key of the operation (message and transfer are set afterwards)
+            Operation(messages::ClientMessage_Type type, uint64_t stream, unsigned int key):
+                    type(type), stream(stream), key(key){
+            }
+
+            messages::ClientMessage_Type type;  //type of the operation
+            uint64_t stream;                    //stream of the message (the reply carries it)
+            unsigned int key;                   //key of the operation (derived from the path)
+            messages::ClientMessage message;    //received message (PROB, DELE, MKD, RMD, RETR)
+            std::shared_ptr<Transfer> transfer; //file received (STOR)
+        };
 
         void recoverFromDB();   //recover from database method
-        void authenticate();    //authenticate method
-        void receive();         //receive message from client method
+        bool authenticate();    //authenticate method
+        std::vector<Operation> receive();       //receive messages from client method
+        void complete(Operation &operation);    //complete an operation (on the disk/database stage) method
+        //retrieve the user's files (on the retrieve stage) method
+        void retrieve(Operation &operation, const std::atomic<bool> &stop);
+        void flush();           //send the queued replies method
 
     private:
         Socket &_s;  //socket associated to the protocol manager
+        Stage &_disk;   //disk/database stage (where the file writes and the operations are completed)
+        Drain &_drain;  //drain of the connection (ordering the file writes with its other operations)
 
-        std::shared_ptr<Database> _db;              //shared pointer to the Database object
+        std::shared_ptr<Database> _db;              //shared pointer to the (user's) Database object
         std::shared_ptr<Database_pwd> _password_db; //shared pointer to the Database_pwd object
+        std::shared_ptr<SessionManager> _sessions;  //shared pointer to the SessionManager object
 
         messages::ClientMessage _clientMessage; //protocol buffer message to use to get messages from client
         messages::ServerMessage _serverMessage; //protocol buffer message to use to reply to client
+        std::string _messageBuffer;             //(serialized) message buffer, reused for every message
+
+        std::mutex _sendMutex;              //mutex protecting the serverMessage and the replies queue
+        std::deque<std::string> _replies;   //(serialized) replies waiting to be sent by the network thread
 
         std::string _username;      //username of the connected user
         std::string _mac;           //mac address of the connected client's machine
@@ -140,18 +199,36 @@ namespace server {
         std::string _basePath;      //base server path
         std::string _userPath;      //user base server path (where to put backed-up data for the current user)
         std::string _temporaryPath; //temporary server path where to put temporary files
+        std::string _token;         //session token issued to the client (sent with the authentication OK)
 
         int _protocolVersion;       //server's protocol version
 
-        unsigned int _tempNameSize;          //size of the temporary files name
         unsigned int _maxDataChunkSize;      //maximum size of sent data chunk
+        unsigned int _readAheadBuffers;      //number of file blocks read ahead while sending a file
+        unsigned int _maxPresentDigests;     //maximum number of digests of the files present on the client
+
+        uint64_t _stream;   //stream of the last received message (the replies carry it)
+
+        //files being received, by stream (shared with the disk/database stage)
+        std::unordered_map<uint64_t, std::shared_ptr<Transfer>> _transfers;
 
-        bool _recovered;    //whether the protocol manager already recovered data from database or not
+        //digests of the files the client already has (collected from the RETR messages until the last one)
+        std::unordered_set<uint64_t> _present;
+        bool _presentRefused = false;   //whether the current retrieve was refused (too many digests)
 
-        //map of saved directory entries for this username-mac
-        std::unordered_map<std::string, Directory_entry> _elements;
+        //session of this username-mac (map of saved directory entries), shared with the other connections of the
+        //same username-mac and kept loaded for some time after the last of them is closed
+        std::shared_ptr<Session> _session;
 
+        //execute an operation (of a stream) handling its errors method
+        void _handle(const std::function<void()> &operation, uint64_t stream);
+        void _checkVersion();       //check the received clientMessage version method
+        void _abortTransfer(uint64_t stream);   //abort the file being received on a stream method
+        void _closeTransfers();     //close all the files being received method
         void _send_serverMessage(); //send serverMessage method
+        void _queue_serverMessage(uint64_t stream); //queue serverMessage (reply) method
+        std::string _partialKey(const std::string &path);   //key of the partial (upload) file of a path
+        unsigned int _pathKey(const std::string &path);     //key of the disk/database operations on a path
 
         /*
          * +-----------------------------------------------------------------------------------------------------------+
@@ -159,17 +236,21 @@ namespace server {
          */
 
         //send message methods for the normal usage
-        void _send_OK(OkCode code);     //send OK message method
-        void _send_SEND(const std::string &path, const std::string &hash);  //send SEND message method
-        void _send_ERR(ErrCode code);   //send ERR message method
+        void _send_OK(OkCode code, uint64_t stream);    //send OK message method
+        //send SEND message method
+        void _send_SEND(const std::string &path, const std::string &hash, uintmax_t offset, uint64_t stream);
+        void _send_ERR(ErrCode code, uint64_t stream);  //send ERR message method
         void _send_VER();               //send VER message method
+        void _send_NOOP();              //send NOOP (heartbeat response) message method
 
         //server action performing methods
-        void _probe();      //probe file method
-        void _storeFile();  //store file method
-        void _removeFile(); //remove file method
-        void _makeDir();    //make directory method
-        void _removeDir();  //remove directory method
+        void _probe(Operation &operation);      //probe file method
+        void _receiveFile();    //start receiving file method
+        std::shared_ptr<Transfer> _receiveData();   //receive file data method
+        void _storeFile(Operation &operation);  //store file method
+        void _removeFile(Operation &operation); //remove file method
+        void _makeDir(Operation &operation);    //make directory method
+        void _removeDir(Operation &operation);  //remove directory method
 
         /*
          * +-----------------------------------------------------------------------------------------------------------+
@@ -178,13 +259,15 @@ namespace server {
 
         //send message methods for the special case of client retrieving data from server
         void _send_MKD(const std::string &path, Directory_entry &element);  //send MKD message method
-        void _send_STOR(const std::string &path, Directory_entry &element); //send STOR message method
-        void _send_DATA(char *buff, uint64_t len);                      //send DATA message method
+        void _send_STOR(const std::string &path, Directory_entry &element, uintmax_t offset); //send STOR message method
+        void _send_DATA(const char *buff, uint64_t len, bool last);     //send DATA message method
 
         //special action performing methods for the special case of client retrieving data from server
-        void _retrieveUserData();   //user data retrieve method
+        //user data retrieve method
+        void _retrieveUserData(messages::ClientMessage &message, const std::atomic<bool> &stop);
         //send file to client method
-        void _sendFile(Directory_entry &element, std::string &macAddr);
+        void _sendFile(Directory_entry &element, const Stat &stat, std::string &macAddr,
+                       std::unordered_map<std::string, std::pair<Hash, uintmax_t>> &resume);
     };
 
     /*
@@ -0,0 +1,273 @@
+#include "Scrubber.h"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <regex>
+#include <ctime>
+#include <algorithm>
+#include <optional>
+
+#include "../myLibraries/Hash.h"
+#include "../myLibraries/Message.h"
+
+#define SCRUB_BATCH 256             //number of files of a user read from the database at a time
+#define SCRUB_CHUNK_SIZE 65536      //size (in bytes) of the chunks in which the files are read
+#define SCRUB_IDLE_SECONDS 60       //seconds to wait when there is nothing to verify
+#define SCRUB_USERS 16              //maximum number of users whose database is checked in a round
+#define SCRUB_USER_IDLE_SECONDS 3600    //seconds a user with nothing to verify is not checked again
+#define QUARANTINE_DIR ".quarantine"    //name of the quarantine directory (in the server base path)
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Scrubber class methods
+ */
+
+/**
+ * Scrubber constructor; it starts the scrubber thread
+ *
+ * @param basePath server base path
+ * @param mbPerSecond maximum rate (in MiB/s) at which the files are read
+ * @param intervalHours hours after which a file is verified again
+ */
+server::Scrubber::Scrubber(std::string basePath, unsigned int mbPerSecond, unsigned int intervalHours) :
+        _basePath(std::move(basePath)),
+        _bytesPerSecond(static_cast<uint64_t>(std::max(mbPerSecond, 1u)) * 1024 * 1024),
+        _interval(std::chrono::hours(intervalHours)),
+        _sessions(SessionManager::getInstance()),
+        _stop(false) {
+
+    _thread = std::thread(&Scrubber::_run, this);
+}
+
+/**
+ * Scrubber destructor; it stops the scrubber thread
+ */
+server::Scrubber::~Scrubber() {
+    stop();
+}
+
+/**
+ * Scrubber stop method. Used to stop and join the scrubber thread (a file being verified is verified again later)
+ */
+void server::Scrubber::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+
+    if(_thread.joinable())
+        _thread.join();
+}
+
+/**
+ * Scrubber run method. It is the scrubber thread function: it verifies the files of the users (some at a time for
+ *  each user), waiting when there is nothing to verify, until stopped.
+ *
+ *  <p> Each round checks at most SCRUB_USERS databases, going on from the user after the last one checked, and the
+ *  users which had nothing to verify are not checked again for SCRUB_USER_IDLE_SECONDS (so the databases are not
+ *  opened over and over)
+ */
+void server::Scrubber::_run() {
+    while(true) {
+        bool verified = false;  //whether some file was verified in this round
+
+        try {
+            auto now = std::chrono::steady_clock::now();    //current time
+
+            //forget the users which can be checked again
+            for(auto it = _idle.begin(); it != _idle.end();) {
+                if(it->second <= now)
+                    it = _idle.erase(it);
+                else
+                    ++it;
+            }
+
+            //go on from the user after the last one checked (wrapping around)
+            auto users = Database::getUsers();  //users with a database
+            std::sort(users.begin(), users.end());
+            std::rotate(users.begin(), std::upper_bound(users.begin(), users.end(), _lastUser), users.end());
+
+            unsigned int checked = 0;   //number of users checked in this round
+            for(auto &username : users) {
+                if(checked == SCRUB_USERS)
+                    break;
+
+                if(_idle.count(username) != 0)
+                    continue;
+
+                checked++;
+                _lastUser = username;
+
+                if(_scrub(username))
+                    verified = true;
+                else
+                    _idle[username] = now + std::chrono::seconds(SCRUB_USER_IDLE_SECONDS);
+            }
+        }
+        catch (std::exception &e) {
+            //errors (for example on a database) must not stop the scrubber, it will try again later
+            Message::print(std::cerr, "ERROR", "Scrubber exception", e.what());
+        }
+
+        //wait if there was nothing to verify (or if something went wrong)
+        if(!verified && !_wait(std::chrono::steady_clock::now() + std::chrono::seconds(SCRUB_IDLE_SECONDS)))
+            return;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_stop)
+            return;
+    }
+}
+
+/**
+ * Scrubber scrub method. Used to verify the files of a user which were verified the least recently (and not in the
+ *  last interval)
+ *
+ * @param username username of the user
+ *
+ * @return true if some file was verified, false if there was nothing to verify (or the scrubber was stopped)
+ *
+ * @throws DatabaseException in case of database errors
+ */
+bool server::Scrubber::_scrub(const std::string &username) {
+    //user's server database instance (not kept open by the registry, the scrubber is not a user of it)
+    auto db = Database::getUncachedInstance(username);
+
+    //file to verify
+    struct Row {
+        std::string mac;    //mac address of the client host
+        std::string path;   //relative path of the file
+        std::string hash;   //hash of the file
+    };
+
+    //get the files to verify (they are verified outside the database lock)
+    std::vector<Row> rows;
+    auto before = static_cast<int64_t>(std::time(nullptr)) - _interval.count(); //verification time limit
+    db->forUnverified(before, SCRUB_BATCH, [&rows](const std::string &, const std::string &mac,
+            const std::string &path, uintmax_t, const std::string &hash, const Stat &){
+        rows.push_back(Row{mac, path, hash});
+    });
+
+    for(auto &row : rows) {
+        //base path of the user-mac pair elements
+        std::string userPath = _basePath + "/" + username + "_" + std::regex_replace(row.mac, std::regex(":"), "-");
+        std::string absolutePath = userPath + row.path;     //absolute path of the file
+
+        Stat stat = Stat::of(absolutePath);     //stat tuple of the file before its verification
+        bool matches = false;   //whether the content of the file matches its hash
+
+        if(std::filesystem::is_regular_file(absolutePath) && !_verify(absolutePath, row.hash, matches))
+            return false;   //stopped
+
+        if(matches)
+            db->setVerified(username, row.mac, row.path, std::time(nullptr));
+        else
+            _quarantine(*db, username, row.mac, row.path, stat);
+    }
+
+    return !rows.empty();
+}
+
+/**
+ * Scrubber verify method. Used to verify the content of a file against its hash, reading it at (at most) the
+ *  maximum rate
+ *
+ * @param path absolute path of the file
+ * @param hash expected hash of the file
+ * @param matches set to true if the content of the file matches the hash, false otherwise
+ *
+ * @return true if the file was verified, false if the scrubber was stopped
+ */
+bool server::Scrubber::_verify(const std::string &path, const std::string &hash, bool &matches) {
+    std::ifstream file;
+    file.open(path, std::ifstream::in | std::ifstream::binary);     //open the file
+
+    if(!file.is_open()) {
+        matches = false;
+        return true;
+    }
+
+    HashMaker hm;   //hash of the content
+    std::vector<char> buff(SCRUB_CHUNK_SIZE);   //buffer
+
+    while(file) {
+        file.read(buff.data(), buff.size());    //get bytes from file
+        hm.update(buff.data(), file.gcount());  //update the hash
+
+        //wait until reading these bytes is allowed by the maximum rate (the rate is kept across the files)
+        auto now = std::chrono::steady_clock::now();    //current time
+        _next = std::max(_next, now) + std::chrono::microseconds(file.gcount() * 1000000 / _bytesPerSecond);
+
+        if(!_wait(_next))
+            return false;
+    }
+
+    matches = hm.get().str() == hash;
+    return true;
+}
+
+/**
+ * Scrubber quarantine method. Used to move a file which failed its verification (or is missing) into the quarantine
+ *  directory, and to forget it (from the database and from the session of its user-mac pair, if it is loaded); it is
+ *  done holding the path lock of the session, and only if the file was not changed while it was being verified
+ *
+ * @param db user's server database
+ * @param username username of the user
+ * @param mac mac address of the client host
+ * @param path relative path of the file
+ * @param stat stat tuple of the file before its verification
+ *
+ * @throws DatabaseException in case of database errors
+ */
+void server::Scrubber::_quarantine(Database &db, const std::string &username, const std::string &mac,
+                                   const std::string &path, const Stat &stat) {
+    //directory of the user-mac pair elements (relative to the server base path)
+    std::string userDir = "/" + username + "_" + std::regex_replace(mac, std::regex(":"), "-");
+    std::string absolutePath = _basePath + userDir + path;  //absolute path of the file
+
+    //lock the path (a connection of the user-mac pair may be working on it)
+    auto session = _sessions->find(username, mac);  //session of the user-mac pair (if loaded)
+    std::optional<Session::PathLock> lock;
+    if(session != nullptr)
+        lock.emplace(*session, _basePath + userDir, path, true);
+
+    //if the file was changed (or saved again) in the meantime it will be verified again later
+    if(Stat::of(absolutePath) != stat)
+        return;
+
+    if(std::filesystem::exists(absolutePath)) {
+        //quarantined copy of the file (with the time it was quarantined)
+        std::filesystem::path quarantined{_basePath + "/" + QUARANTINE_DIR + userDir + path + "." +
+                                          std::to_string(std::time(nullptr))};
+
+        std::filesystem::create_directories(quarantined.parent_path());
+        std::filesystem::rename(absolutePath, quarantined);
+
+        Message::print(std::cerr, "WARNING", path + " in " + _basePath + userDir,
+                       "failed verification, moved to " + quarantined.string());
+    }
+    else
+        Message::print(std::cerr, "WARNING", path + " in " + _basePath + userDir, "is missing!");
+
+    //forget the file, so the client will send it again
+    db.remove(username, mac, path);
+
+    if(session != nullptr)
+        session->remove(path);
+}
+
+/**
+ * Scrubber wait method. Used to wait until a time (or until the scrubber is stopped)
+ *
+ * @param until time until which to wait
+ *
+ * @return true if the time was reached, false if the scrubber was stopped
+ */
+bool server::Scrubber::_wait(std::chrono::steady_clock::time_point until) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    return !_cv.wait_until(lock, until, [this](){ return _stop; });
+}
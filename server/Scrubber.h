@@ -0,0 +1,70 @@
+#ifndef SERVER_SCRUBBER_H
+#define SERVER_SCRUBBER_H
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+
+#include "Database.h"
+#include "Session.h"
+
+
+/**
+ * PDS_Backup server namespace
+ */
+namespace server {
+    /**
+     * Scrubber class. It verifies the content of the saved files against their hashes in the background, so the
+     *  request path never has to (it only checks the files stat tuples).
+     *
+     *  <p> The scrubber thread goes through the user databases verifying the files not verified for some time (the
+     *  least recently verified first), reading them at a limited rate, and records when each file was verified. A
+     *  file whose content does not match its hash (or which is missing) is moved into the quarantine directory (in the
+     *  server base path) and forgotten, from the database and from the session of its user-mac pair if it is loaded,
+     *  so the client will send it again.
+     */
+    class Scrubber {
+    public:
+        Scrubber(const Scrubber &) = delete;                //copy constructor deleted
+        Scrubber& operator=(const Scrubber &) = delete;     //copy assignment deleted
+        Scrubber(Scrubber &&) = delete;                     //move constructor deleted
+        Scrubber& operator=(Scrubber &&) = delete;          //move assignment deleted
+
+        //constructor with the server base path, the maximum read rate and the verification interval
+        Scrubber(std::string basePath, unsigned int mbPerSecond, unsigned int intervalHours);
+        ~Scrubber();    //destructor
+
+        void stop();
+
+    private:
+        std::string _basePath;      //server base path
+        uint64_t _bytesPerSecond;   //maximum read rate (in bytes per second)
+        std::chrono::seconds _interval;     //time after which a file is verified again
+        std::chrono::steady_clock::time_point _next;    //time from which the next bytes can be read (rate limit)
+
+        std::shared_ptr<SessionManager> _sessions;  //shared pointer to the SessionManager object
+
+        std::string _lastUser;  //last user checked (the next round goes on from the following one)
+        //users which had nothing to verify (and when they can be checked again)
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> _idle;
+
+        std::mutex _mutex;              //mutex protecting the stop flag
+        std::condition_variable _cv;    //condition variable used to wake the scrubber thread up when stopped
+        bool _stop;                     //boolean used to stop the scrubber thread
+        std::thread _thread;            //scrubber thread
+
+        void _run();
+        bool _scrub(const std::string &username);
+        bool _verify(const std::string &path, const std::string &hash, bool &matches);
+        void _quarantine(Database &db, const std::string &username, const std::string &mac, const std::string &path,
+                         const Stat &stat);
+        bool _wait(std::chrono::steady_clock::time_point until);
+    };
+}
+
+
+#endif //SERVER_SCRUBBER_H
@@ -0,0 +1,419 @@
+#include "Session.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "../myLibraries/Hash.h"
+#include "Config.h"
+
+#define SECRET_SIZE 32      //size (in bytes) of the secret used to sign the tokens
+#define NONCE_SIZE 16       //size (in bytes) of the random part of the tokens
+#define HMAC_BLOCK_SIZE 64  //SHA256 block size (used by the HMAC construction)
+#define NODE_OVERHEAD 32    //approximate overhead (in bytes) of a node of the elements map (pointers and color)
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Session::PathLock class methods
+ */
+
+/**
+ * PathLock constructor. It locks the path exclusively and its ancestor directories (the base path excluded) shared,
+ *  and the parent directory exclusively if requested; it waits for the operations holding conflicting locks
+ *
+ * @param session session of the path
+ * @param userPath base path of the user-mac pair elements
+ * @param path relative path to lock
+ * @param parent whether to lock the parent directory exclusively too (the operation changes it)
+ */
+server::Session::PathLock::PathLock(Session &session, const std::string &userPath, const std::string &path,
+                                    bool parent) {
+    //locks to take (by index) and whether to take them exclusively; ordered by index, so they are always taken in
+    //the same order
+    std::map<unsigned int, bool> locks;
+
+    //the path itself
+    locks[pathKey(userPath, path) % PATH_LOCKS] = true;
+
+    //its ancestor directories
+    for(size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        bool exclusive = parent && path.find('/', pos + 1) == std::string::npos;  //whether it is the parent
+
+        //(different paths may share a lock: then it is taken exclusively if any of them needs it)
+        bool &current = locks[pathKey(userPath, path.substr(0, pos)) % PATH_LOCKS];
+        current = current || exclusive;
+    }
+
+    _locks.reserve(locks.size());
+    for(auto &[index, exclusive] : locks) {
+        std::shared_mutex &mutex = session._pathMutexes[index]; //lock to take
+
+        if(exclusive)
+            mutex.lock();
+        else
+            mutex.lock_shared();
+
+        _locks.emplace_back(&mutex, exclusive);
+    }
+}
+
+/**
+ * PathLock destructor. It releases the locks (in reverse order)
+ */
+server::Session::PathLock::~PathLock() {
+    for(auto lock = _locks.rbegin(); lock != _locks.rend(); ++lock) {
+        if(lock->second)
+            lock->first->unlock();
+        else
+            lock->first->unlock_shared();
+    }
+}
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Session class methods
+ */
+
+/**
+ * Session find method. Used to find an element in the elements map (the element stays valid until it is removed,
+ *  and only the operations holding its path lock can remove it)
+ *
+ * @param path relative path of the element
+ *
+ * @return pointer to the element, nullptr if it is not in the map
+ */
+Directory_entry *server::Session::find(const std::string &path) {
+    std::shared_lock<std::shared_mutex> lock(_elementsMutex);
+
+    auto el = _elements.find(path);
+    return el == _elements.end() ? nullptr : &el->second;
+}
+
+/**
+ * Session add method. Used to add an element to the elements map (if there is not already an element with the same
+ *  relative path)
+ *
+ * @param element element to add
+ */
+void server::Session::add(Directory_entry element) {
+    size_t size = _sizeOf(element);     //memory used by the element
+    std::string path = element.getRelativePath();   //relative path of the element
+
+    std::unique_lock<std::shared_mutex> lock(_elementsMutex);
+    if(_elements.emplace(std::move(path), std::move(element)).second)
+        _size += size;
+}
+
+/**
+ * Session remove method. Used to remove an element from the elements map
+ *
+ * @param path relative path of the element
+ */
+void server::Session::remove(const std::string &path) {
+    std::unique_lock<std::shared_mutex> lock(_elementsMutex);
+
+    auto el = _elements.find(path);
+    if(el == _elements.end())
+        return;
+
+    _size -= _sizeOf(el->second);
+    _elements.erase(el);
+}
+
+/**
+ * Session remove directory method. Used to remove a directory and everything in it from the elements map (the
+ *  elements in it are a single range of the map)
+ *
+ * @param path relative path of the directory
+ */
+void server::Session::removeDir(const std::string &path) {
+    std::unique_lock<std::shared_mutex> lock(_elementsMutex);
+
+    //range of the elements in the directory (the paths starting with the directory path followed by '/'; '0' is
+    //the character after '/')
+    auto first = _elements.lower_bound(path + "/");
+    auto last = _elements.lower_bound(path + "0");
+
+    for(auto el = first; el != last; ++el)
+        _size -= _sizeOf(el->second);
+    _elements.erase(first, last);
+
+    //then remove the directory itself
+    auto el = _elements.find(path);
+    if(el == _elements.end())
+        return;
+
+    _size -= _sizeOf(el->second);
+    _elements.erase(el);
+}
+
+/**
+ * Session path key method. Used to get the key of the operations on a path (also used to spread the paths among the
+ *  path locks)
+ *
+ * @param userPath base path of the user-mac pair elements
+ * @param path relative path of the element
+ *
+ * @return key of the operations on the path
+ */
+unsigned int server::Session::pathKey(const std::string &userPath, const std::string &path) {
+    return static_cast<unsigned int>(std::hash<std::string>{}(userPath + path));
+}
+
+/**
+ * Session size getter
+ *
+ * @return approximate memory used by the elements map (in bytes)
+ */
+size_t server::Session::size() const {
+    return _size.load();
+}
+
+/**
+ * Session size of method. Used to estimate the memory used by an element of the elements map (the map node and the
+ *  strings, key included)
+ *
+ * @param element element of the map
+ *
+ * @return approximate memory used by the element (in bytes)
+ */
+size_t server::Session::_sizeOf(Directory_entry &element) {
+    return sizeof(std::pair<const std::string, Directory_entry>) + NODE_OVERHEAD +
+           2 * element.getRelativePath().size() + element.getAbsolutePath().size() +
+           element.getLastWriteTime().size();
+}
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * SessionManager class methods
+ */
+
+//static variable definition
+std::shared_ptr<server::SessionManager> server::SessionManager::sessionManager_;
+std::mutex server::SessionManager::mutex_;
+
+/**
+ * SessionManager class singleton instance getter method
+ *
+ * @return SessionManager instance
+ */
+std::shared_ptr<server::SessionManager> server::SessionManager::getInstance() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(sessionManager_ == nullptr) //first time, or when it was released from everybody
+        sessionManager_ = std::shared_ptr<SessionManager>(new SessionManager());  //create the session manager object
+    return sessionManager_;
+}
+
+/**
+ * SessionManager constructor; it generates the (random) secret used to sign the tokens, so the tokens issued by a
+ *  previous server process are not valid anymore
+ *
+ * @throw RngException in case the secret cannot be generated
+ */
+server::SessionManager::SessionManager() {
+    _secret = _rng.getRandomString(SECRET_SIZE);
+    auto config = Config::getInstance();    //configuration
+    _tokenSeconds = config->getSessionTokenSeconds();
+    _idleSeconds = config->getSessionIdleSeconds();
+    _budget = static_cast<size_t>(config->getSessionCacheMb()) * 1024 * 1024;
+}
+
+/**
+ * SessionManager issue method. Used to issue a new session token for a (just authenticated) user-mac pair
+ *
+ * @param username username of the user
+ * @param mac mac address of the client's machine
+ *
+ * @return session token
+ *
+ * @throw RngException in case the token nonce cannot be generated
+ */
+std::string server::SessionManager::issue(const std::string &username, const std::string &mac) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    //expiry time of the token (seconds since epoch)
+    auto expiry = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() + _tokenSeconds;
+
+    //token payload: expiry time and nonce (so 2 tokens are never the same)
+    std::string payload = std::to_string(expiry) + "." + _rng.getHexString(NONCE_SIZE);
+
+    return payload + "." + _sign(username, mac, payload);
+}
+
+/**
+ * SessionManager check method. Used to check whether a session token is valid for a user-mac pair (it was issued
+ *  by this server process for that pair and it has not expired yet)
+ *
+ * @param token session token presented by the client
+ * @param username username of the user
+ * @param mac mac address of the client's machine
+ *
+ * @return true if the token is valid, false otherwise
+ */
+bool server::SessionManager::check(const std::string &token, const std::string &username, const std::string &mac) {
+    auto pos = token.rfind('.');    //position of the signature separator
+    if(pos == std::string::npos)
+        return false;
+
+    std::string payload = token.substr(0, pos);     //token payload (expiry time and nonce)
+    std::string signature = token.substr(pos + 1);  //token signature
+
+    std::string expected;   //expected signature
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        expected = _sign(username, mac, payload);
+    }
+
+    //compare the signatures in constant time (not to tell how much of the signature is right)
+    if(signature.size() != expected.size())
+        return false;
+
+    unsigned char diff = 0;     //differences between the signatures
+    for(size_t i = 0; i < expected.size(); i++)
+        diff |= static_cast<unsigned char>(signature[i] ^ expected[i]);
+
+    if(diff != 0)
+        return false;
+
+    //the token was issued by this server, now check its expiry time
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();   //current time (seconds since epoch)
+
+    return std::stoll(payload.substr(0, payload.find('.'))) > now;
+}
+
+/**
+ * SessionManager attach method. Used to get the session of a user-mac pair: the loaded one (used by some other
+ *  connection, or idle) if any, a new one otherwise; the session is kept loaded for some time after its last use
+ *
+ * @param username username of the user
+ * @param mac mac address of the client's machine
+ *
+ * @return session of the user-mac pair
+ */
+std::shared_ptr<server::Session> server::SessionManager::attach(const std::string &username, const std::string &mac) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    //release the sessions idle for too long (or over the memory budget) first
+    _sweep();
+
+    auto &resident = _sessions[username + "@" + mac];   //session of the user-mac pair
+    auto session = resident.live.lock();
+
+    if(session == nullptr) {
+        //the session is not loaded, create a new (empty) one; the elements map will be recovered from the database
+        session = std::make_shared<Session>();
+        resident.live = session;
+    }
+
+    resident.pinned = session;
+    resident.lastUse = std::chrono::steady_clock::now();
+
+    return session;
+}
+
+/**
+ * SessionManager find method. Used to get the session of a user-mac pair only if it is loaded (used by some
+ *  connection, or idle)
+ *
+ * @param username username of the user
+ * @param mac mac address of the client's machine
+ *
+ * @return session of the user-mac pair, nullptr if it is not loaded
+ */
+std::shared_ptr<server::Session> server::SessionManager::find(const std::string &username, const std::string &mac) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _sessions.find(username + "@" + mac);
+    if(it == _sessions.end())
+        return nullptr;
+
+    return it->second.live.lock();
+}
+
+/**
+ * SessionManager sweep method. Used (periodically) to release the sessions idle for too long, and the least recently
+ *  used idle ones while the memory used by the idle sessions exceeds the budget
+ */
+void server::SessionManager::sweep() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sweep();
+}
+
+/**
+ * SessionManager sign method. Used to compute the signature of a token (HMAC-SHA256 of the user-mac pair and of the
+ *  token payload, with the secret as key); to be called with the mutex held
+ *
+ * @param username username of the user
+ * @param mac mac address of the client's machine
+ * @param payload token payload
+ *
+ * @return signature (as hex string)
+ */
+std::string server::SessionManager::_sign(const std::string &username, const std::string &mac,
+                                          const std::string &payload) {
+    std::string ipad(HMAC_BLOCK_SIZE, '\x36');  //inner padded key
+    std::string opad(HMAC_BLOCK_SIZE, '\x5c');  //outer padded key
+
+    for(size_t i = 0; i < _secret.size(); i++) {
+        ipad[i] ^= _secret[i];
+        opad[i] ^= _secret[i];
+    }
+
+    //inner hash (the fields are separated by a character which can not be in any of them)
+    HashMaker inner{ipad};
+    inner.update(username + "\n" + mac + "\n" + payload);
+
+    //outer hash
+    HashMaker outer{opad};
+    outer.update(inner.get().str());
+
+    return RandomNumberGenerator::string_to_hex(outer.get().str());
+}
+
+/**
+ * SessionManager sweep method. Used to release the sessions idle (not used by any connection) for too long, and the
+ *  least recently used idle ones while the memory used by the idle sessions exceeds the budget; the sessions not
+ *  used anymore by any connection are forgotten. To be called with the mutex held
+ */
+void server::SessionManager::_sweep() {
+    auto now = std::chrono::steady_clock::now();    //current time
+    size_t idleSize = 0;    //memory used by the idle sessions (in bytes)
+    std::vector<std::pair<std::chrono::steady_clock::time_point, Resident *>> idle;    //idle sessions
+
+    for(auto it = _sessions.begin(); it != _sessions.end();){
+        auto &resident = it->second;    //session
+
+        if(resident.pinned != nullptr) {
+            if(resident.pinned.use_count() > 1)     //the session is still used by some connection
+                resident.lastUse = now;
+            else if(now - resident.lastUse >= std::chrono::seconds(_idleSeconds))
+                resident.pinned.reset();    //idle for too long
+            else {
+                idleSize += resident.pinned->size();
+                idle.emplace_back(resident.lastUse, &resident);
+            }
+        }
+
+        if(resident.pinned == nullptr && resident.live.expired())
+            it = _sessions.erase(it);
+        else
+            ++it;
+    }
+
+    if(idleSize <= _budget)
+        return;
+
+    //over budget: release the least recently used idle sessions first
+    std::sort(idle.begin(), idle.end(), [](const auto &a, const auto &b){ return a.first < b.first; });
+
+    for(auto &i : idle) {
+        if(idleSize <= _budget)
+            break;
+
+        idleSize -= i.second->pinned->size();
+        i.second->pinned.reset();   //the session is destroyed (it is forgotten on the next sweep)
+    }
+}
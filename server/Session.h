@@ -0,0 +1,168 @@
+#ifndef SERVER_SESSION_H
+#define SERVER_SESSION_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <map>
+#include <vector>
+
+#include "../myLibraries/Directory_entry.h"
+#include "../myLibraries/RandomNumberGenerator.h"
+
+#define PATH_LOCKS 64   //number of path locks of a session
+
+
+/**
+ * PDS_Backup server namespace
+ */
+namespace server {
+    /*
+     * +---------------------------------------------------------------------------------------------------------------+
+     * Session class
+     */
+
+    /**
+     * Session class. Server side state of a user-mac pair (the map of its saved elements, recovered from the
+     *  database once), shared by the connections of the pair.
+     *
+     *  <p> The elements map can be read concurrently (the writers take it exclusively only while changing it); the
+     *  operations changing the saved elements lock the path they are about (see PathLock), so the operations on the
+     *  same path (or on a directory and the paths in it) coming from different connections are not interleaved.
+     */
+    class Session {
+    public:
+        Session() = default;
+        Session(const Session &) = delete;              //copy constructor deleted
+        Session& operator=(const Session &) = delete;   //copy assignment deleted
+        Session(Session &&) = delete;                   //move constructor deleted
+        Session& operator=(Session &&) = delete;        //move assignment deleted
+        ~Session() = default;
+
+        /**
+         * PathLock class. Hierarchical lock of a path of the session, held by the operations changing the saved
+         *  elements: the path is locked exclusively and its ancestor directories shared, so the operations on
+         *  different paths (even in the same directory) go on concurrently, while an operation on a directory (e.g.
+         *  its removal) excludes the ones on the paths in it. The operations adding or removing an entry of the parent
+         *  directory (and restoring its last write time) lock the parent exclusively too.
+         *
+         *  <p> The paths are spread among PATH_LOCKS locks by key, which are always taken in the same order (so 2
+         *  operations cannot wait for each other).
+         */
+        class PathLock {
+        public:
+            PathLock(const PathLock &) = delete;                //copy constructor deleted
+            PathLock& operator=(const PathLock &) = delete;     //copy assignment deleted
+            PathLock(PathLock &&) = delete;                     //move constructor deleted
+            PathLock& operator=(PathLock &&) = delete;          //move assignment deleted
+
+            //constructor with the session, the base path of its elements, the relative path to lock and whether to
+            //lock the parent directory exclusively too
+            PathLock(Session &session, const std::string &userPath, const std::string &path, bool parent);
+            ~PathLock();    //destructor (it releases the locks)
+
+        private:
+            std::vector<std::pair<std::shared_mutex *, bool>> _locks;  //locks taken (and whether exclusively)
+        };
+
+        Directory_entry *find(const std::string &path);
+        void add(Directory_entry element);
+        void remove(const std::string &path);
+        void removeDir(const std::string &path);
+        size_t size() const;
+
+        static unsigned int pathKey(const std::string &userPath, const std::string &path);
+
+        std::once_flag recovered;   //used to recover data from database only once
+
+    private:
+        //map of saved directory entries for this username-mac (ordered by path, so the elements in a directory are
+        //contiguous)
+        std::map<std::string, Directory_entry> _elements;
+        std::shared_mutex _elementsMutex;   //mutex protecting the elements map (readers share it)
+
+        std::array<std::shared_mutex, PATH_LOCKS> _pathMutexes; //path locks (the paths are spread among them by key)
+        std::atomic<size_t> _size{0};   //approximate memory used by the elements map (in bytes)
+
+        static size_t _sizeOf(Directory_entry &element);
+    };
+
+    /*
+     * +---------------------------------------------------------------------------------------------------------------+
+     * SessionManager class
+     */
+
+    /**
+     * SessionManager class. It issues and checks the session tokens, and keeps the sessions (server side states) of
+     *  the user-mac pairs (singleton).
+     *
+     *  <p> After a successful authentication the client gets a session token: presenting it (while it is still valid)
+     *  when reconnecting, the client is not authenticated with the password again. The token is signed
+     *  (HMAC-SHA256 with a random secret of this server process) and carries its expiry time, so the server does not
+     *  need to store it.
+     *
+     *  <p> The sessions are reference counted: a session is shared by all the connections of its user-mac pair, and
+     *  it is kept loaded for some time after the last of them is closed, so a client reconnecting in the meantime
+     *  finds its elements map already loaded. The idle sessions are released after that time, or earlier (the least
+     *  recently used first) when the memory they use exceeds the budget; this is checked periodically (see sweep)
+     *  and whenever a session is attached.
+     */
+    class SessionManager {
+    public:
+        SessionManager(const SessionManager &) = delete;                //copy constructor deleted
+        SessionManager& operator=(const SessionManager &) = delete;     //copy assignment deleted
+        SessionManager(SessionManager &&) = delete;                     //move constructor deleted
+        SessionManager& operator=(SessionManager &&) = delete;          //move assignment deleted
+        ~SessionManager() = default;
+
+        //singleton instance getter
+        static std::shared_ptr<SessionManager> getInstance();
+
+        std::string issue(const std::string &username, const std::string &mac);
+        bool check(const std::string &token, const std::string &username, const std::string &mac);
+        std::shared_ptr<Session> attach(const std::string &username, const std::string &mac);
+        std::shared_ptr<Session> find(const std::string &username, const std::string &mac);
+        void sweep();
+
+    protected:
+        //protected constructor
+        SessionManager();
+
+        //mutex to synchronize threads during the first creation of the Singleton object
+        static std::mutex mutex_;
+
+        //singleton instance
+        static std::shared_ptr<SessionManager> sessionManager_;
+
+    private:
+        /**
+         * Resident struct. A session known by the session manager
+         */
+        struct Resident {
+            std::shared_ptr<Session> pinned;    //session kept loaded (while idle), nullptr once released
+            std::weak_ptr<Session> live;        //session (while some connection still uses it)
+            std::chrono::steady_clock::time_point lastUse;  //last time the session was used by some connection
+        };
+
+        std::mutex _mutex;  //mutex protecting the sessions map and the random number generator
+
+        RandomNumberGenerator _rng;     //random number generator (for the secret and the tokens nonces)
+        std::string _secret;            //secret used to sign the tokens
+        unsigned int _tokenSeconds;     //seconds a token is valid
+        unsigned int _idleSeconds;      //seconds an idle session is kept loaded
+        size_t _budget;                 //memory budget (in bytes) of the idle sessions
+
+        std::unordered_map<std::string, Resident> _sessions;    //known sessions (by username@mac)
+
+        std::string _sign(const std::string &username, const std::string &mac, const std::string &payload);
+        void _sweep();
+    };
+}
+
+
+#endif //SERVER_SESSION_H
@@ -0,0 +1,288 @@
+#include "Stage.h"
+
+#include <algorithm>
+
+#include "../myLibraries/Message.h"
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Stage class methods
+ */
+
+/**
+ * Stage constructor; it creates the worker queues and starts the worker threads
+ *
+ * @param name name of the stage (used when printing its queue depth)
+ * @param nThreads number of worker threads
+ * @param queueSize maximum number of operations queued for each worker thread
+ */
+server::Stage::Stage(std::string name, unsigned int nThreads, unsigned int queueSize) :
+        _name(std::move(name)), _queueSize(queueSize), _stop(false) {
+
+    nThreads = std::max(nThreads, 1u);
+
+    _queues.reserve(nThreads);
+    for(unsigned int i = 0; i < nThreads; i++)
+        _queues.emplace_back(std::make_unique<TS_Circular_vector<std::function<void()>>>(queueSize));
+
+    _workers.reserve(nThreads);
+    for(unsigned int i = 0; i < nThreads; i++)
+        _workers.emplace_back(&Stage::_work, this, i);
+}
+
+/**
+ * Stage destructor; it stops the worker threads
+ */
+server::Stage::~Stage() {
+    stop();
+}
+
+/**
+ * Stage tryPost method. Used to queue an operation for the worker associated to the key, without waiting: if its
+ *  queue is full the operation is not queued and the resume function is kept, to be called (by a worker) as soon as
+ *  a queue has space again
+ *
+ * @param key key of the operation (operations with the same key are executed in order)
+ * @param operation operation to execute (moved from only if queued)
+ * @param resume function to call once the stage has space again (if the operation is not queued)
+ *
+ * @return true if the operation was queued, false otherwise
+ */
+bool server::Stage::tryPost(unsigned int key, std::function<void()> &operation, const std::function<void()> &resume) {
+    auto &queue = *_queues[key % _queues.size()];   //queue of the worker associated to the key
+
+    //only the posts push into the queues (holding this mutex), so a queue not full now is not full when pushing
+    std::lock_guard<std::mutex> lock(_postMutex);
+    if(queue.size() >= _queueSize) {
+        _parked.push_back(resume);
+        return false;
+    }
+
+    queue.push(std::move(operation), _stop);
+    return true;
+}
+
+/**
+ * Stage stop method. Used to stop and join all the worker threads; the operations still queued are discarded
+ */
+void server::Stage::stop() {
+    _stop.store(true);
+
+    //notify all the workers
+    for(auto &queue : _queues)
+        queue->notifyAll();
+
+    //then join on all the workers
+    for(auto &t : _workers)
+        if(t.joinable())
+            t.join();
+
+    //discard the operations left
+    for(auto &queue : _queues)
+        while(queue->canGet())
+            queue->pop();
+}
+
+/**
+ * Stage depth method. Used to get the number of operations queued (and not yet being executed) in the stage
+ *
+ * @return number of operations queued
+ */
+unsigned int server::Stage::depth() {
+    unsigned int depth = 0; //total number of operations queued
+
+    for(auto &queue : _queues)
+        depth += queue->size();
+
+    return depth;
+}
+
+/**
+ * Stage queue size getter
+ *
+ * @return maximum number of operations queued for each worker thread
+ */
+unsigned int server::Stage::getQueueSize() const {
+    return _queueSize;
+}
+
+/**
+ * Stage name getter
+ *
+ * @return name of the stage
+ */
+const std::string &server::Stage::getName() const {
+    return _name;
+}
+
+/**
+ * Stage work method. It is the worker thread function: it executes the operations of its queue (in order) until
+ *  the stage is stopped
+ *
+ * @param i index of the worker (and of its queue)
+ */
+void server::Stage::_work(unsigned int i) {
+    auto &queue = *_queues[i];  //queue of this worker
+
+    while(!_stop.load()){
+        //get the next operation (passively waiting for it)
+        auto optional = queue.tryGetUntil(_stop);
+
+        //if the optional does not have a value the stage was stopped
+        if(!optional.has_value())
+            return;
+
+        //a queue has space now, resume the posts refused
+        _resume();
+
+        try {
+            optional.value()();
+        }
+        catch (std::exception &e) {
+            //the operations are expected to handle their own errors
+            Message::print(std::cerr, "ERROR", _name + " stage exception", e.what());
+        }
+    }
+}
+
+
+/**
+ * Stage resume method. Used by the workers to call the resume functions of the posts refused (outside the lock, as
+ *  they can post again)
+ */
+void server::Stage::_resume() {
+    std::vector<std::function<void()>> parked;  //resume functions to call
+
+    {
+        std::lock_guard<std::mutex> lock(_postMutex);
+        if(_parked.empty())
+            return;
+
+        parked.swap(_parked);
+    }
+
+    for(auto &resume : parked) {
+        try {
+            resume();
+        }
+        catch (std::exception &e) {
+            Message::print(std::cerr, "ERROR", _name + " stage exception", e.what());
+        }
+    }
+}
+
+
+/*
+ * +-------------------------------------------------------------------------------------------------------------------+
+ * Drain class methods
+ */
+
+/**
+ * Drain constructor
+ *
+ * @param limit maximum number of operations waiting (over it the connection is parked until they are posted)
+ */
+server::Drain::Drain(unsigned int limit) : _limit(std::max(limit, 1u)) {
+}
+
+/**
+ * Drain add method. Used to add an operation of the connection (it is posted to its stage by the next dispatch,
+ *  once the operations it has to wait for are completed)
+ *
+ * @param stage stage where to post the operation
+ * @param key key of the operation (operations with the same key are executed in order)
+ * @param order how the operation is ordered with the other operations of the connection
+ * @param operation operation to execute
+ */
+void server::Drain::add(Stage &stage, unsigned int key, Order order, std::function<void()> operation) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _waiting.push_back(Waiting{&stage, key, order, std::move(operation)});
+}
+
+/**
+ * Drain dispatch method. Used to post (in order) the operations which can be started; it never waits: if a stage
+ *  is full, or too many operations are still waiting, the connection is parked and the resume function is called
+ *  once it can go on (by the stage when it has space again, or once an operation of the connection is completed)
+ *
+ * @param resume function resuming the connection (it also keeps the connection alive until its operations are
+ *  completed)
+ *
+ * @return state of the connection: ready to be read again, parked (not to be read until resumed) or taken over by
+ *  the operation just posted
+ */
+server::Drain::State server::Drain::dispatch(const std::function<void()> &resume) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    //post the operations in order, until an exclusive one has to wait for the ones posted before it
+    //(the posts do not wait, so they are done holding the lock and the dispatches of the connection do not overlap)
+    while(!_waiting.empty() && !_exclusive) {
+        Waiting &waiting = _waiting.front();    //operation to post
+        bool exclusive = waiting.order != Order::keyed; //whether it is exclusive
+        if(exclusive && _pending != 0)
+            break;
+
+        //the operation posted tells the drain once completed (resuming the connection if operations are waiting)
+        if(!waiting.wrapped) {
+            waiting.operation = [this, exclusive, resume, operation = std::move(waiting.operation)](){
+                try {
+                    operation();
+                }
+                catch (...) {
+                    if(_done(exclusive))
+                        resume();
+                    throw;
+                }
+
+                if(_done(exclusive))
+                    resume();
+            };
+            waiting.wrapped = true;
+        }
+
+        //the stage is full: park the connection (the stage resumes it)
+        if(!waiting.stage->tryPost(waiting.key, waiting.operation, resume))
+            return State::parked;
+
+        bool takeOver = waiting.order == Order::takeOver;   //whether the operation takes the connection over
+        _waiting.pop_front();
+        _pending++;
+        _exclusive = exclusive;
+
+        if(takeOver)
+            return State::takenOver;
+    }
+
+    //too many operations waiting, or a retrieve waiting to take the connection over: park the connection (it is
+    //resumed once an operation is completed)
+    if(_waiting.size() > _limit || (!_waiting.empty() && _waiting.front().order == Order::takeOver))
+        return State::parked;
+
+    return State::ready;
+}
+
+/**
+ * Drain idle method. Used to know whether the connection has no operations waiting or being executed
+ *
+ * @return true if the connection has no operations waiting or being executed, false otherwise
+ */
+bool server::Drain::idle() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending == 0 && _waiting.empty();
+}
+
+/**
+ * Drain done method. Used by the operations posted once they are completed
+ *
+ * @param exclusive whether the completed operation was an exclusive one
+ *
+ * @return true if some operations are waiting (the connection has to be resumed to post them), false otherwise
+ */
+bool server::Drain::_done(bool exclusive) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending--;
+    if(exclusive)
+        _exclusive = false;
+
+    return !_waiting.empty();
+}
@@ -0,0 +1,132 @@
+#ifndef SERVER_STAGE_H
+#define SERVER_STAGE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <deque>
+
+#include "../myLibraries/Circular_vector.h"
+
+
+/**
+ * PDS_Backup server namespace
+ */
+namespace server {
+    /**
+     * Stage class. It is a stage of the server pipeline: a pool of worker threads, each one with its own bounded queue
+     *  of operations to execute.
+     *
+     *  <p> The operations are posted with a key (for example derived from the path they are about) and all the
+     *  operations with the same key go to the same worker, so they are executed in the same order they were posted.
+     *  The post never waits: when the queue of the worker is full the operation is not posted, and the resume
+     *  function given with it is called (by a worker) as soon as a queue has space again, so that the caller can try
+     *  again (back-pressure towards the previous stage without holding its thread).
+     */
+    class Stage {
+    public:
+        Stage(const Stage &) = delete;              //copy constructor deleted
+        Stage& operator=(const Stage &) = delete;   //copy assignment deleted
+        Stage(Stage &&) = delete;                   //move constructor deleted
+        Stage& operator=(Stage &&) = delete;        //move assignment deleted
+
+        //constructor with the stage name, the number of worker threads and the size of their queues
+        Stage(std::string name, unsigned int nThreads, unsigned int queueSize);
+        ~Stage();   //destructor
+
+        bool tryPost(unsigned int key, std::function<void()> &operation, const std::function<void()> &resume);
+        void stop();
+        unsigned int depth();
+        unsigned int getQueueSize() const;
+        const std::string &getName() const;
+
+    private:
+        std::string _name;      //name of the stage
+        unsigned int _queueSize;    //maximum number of operations queued for each worker thread
+        std::atomic<bool> _stop;    //atomic boolean used to stop the worker threads
+
+        //queues of the workers (one for each worker thread)
+        std::vector<std::unique_ptr<TS_Circular_vector<std::function<void()>>>> _queues;
+        std::vector<std::thread> _workers;  //worker threads
+
+        std::mutex _postMutex;  //mutex held while posting (so the queues do not fill up between check and push)
+        std::vector<std::function<void()>> _parked; //resume functions of the posts refused (guarded by _postMutex)
+
+        void _work(unsigned int i);
+        void _resume();
+    };
+
+    /**
+     * Drain class. It orders the operations of a client connection posted to the stages: they are posted in the same
+     *  order they were added, the ones with the same key being executed in order by the stage and the others
+     *  concurrently; an exclusive operation (for example a directory removal) is posted only once all the operations
+     *  added before it are completed, and the ones added after it wait until it is completed. An operation can also
+     *  take the connection over (for example a retrieve, which serves the connection until it is done): it is
+     *  exclusive too, and once it is posted the connection belongs to it.
+     *
+     *  <p> Only the operations of the same connection wait for each other, the ones of the other connections go on.
+     *  The dispatch never waits: when the stage is full, or too many operations are waiting, the connection is parked
+     *  (it is not read until the resume function is called, by the stage when it has space or by the drain when an
+     *  operation is completed).
+     */
+    class Drain {
+    public:
+        Drain(const Drain &) = delete;              //copy constructor deleted
+        Drain& operator=(const Drain &) = delete;   //copy assignment deleted
+        Drain(Drain &&) = delete;                   //move constructor deleted
+        Drain& operator=(Drain &&) = delete;        //move assignment deleted
+        ~Drain() = default; //default destructor
+
+        //constructor with the maximum number of operations waiting
+        explicit Drain(unsigned int limit);
+
+        /**
+         * Order enum class: how an operation is ordered with the other operations of the connection
+         */
+        enum class Order {
+            keyed,      //in order with the operations with the same key
+            exclusive,  //after all the operations added before it (the following ones wait for it)
+            takeOver    //exclusive, and once posted it serves the connection (until it gives it back)
+        };
+
+        /**
+         * State enum class: state of the connection after a dispatch
+         */
+        enum class State {
+            ready,      //it can be read again
+            parked,     //it must not be read until resumed
+            takenOver   //it was taken over by an operation
+        };
+
+        void add(Stage &stage, unsigned int key, Order order, std::function<void()> operation);
+        State dispatch(const std::function<void()> &resume);
+        bool idle();
+
+    private:
+        /**
+         * Waiting struct. An operation added and not yet posted to its stage
+         */
+        struct Waiting {
+            Stage *stage;                       //stage where to post the operation
+            unsigned int key;                   //key of the operation
+            Order order;                        //order of the operation
+            std::function<void()> operation;    //operation to execute
+            bool wrapped = false;               //whether the operation was already wrapped to tell its completion
+        };
+
+        unsigned int _limit;            //maximum number of operations waiting (before the connection is parked)
+        std::mutex _mutex;              //mutex protecting the drain state
+        std::deque<Waiting> _waiting;   //operations not yet posted (in the order they were added)
+        unsigned int _pending = 0;      //number of operations posted and not yet completed
+        bool _exclusive = false;        //whether an exclusive operation is posted and not yet completed
+
+        bool _done(bool exclusive);
+    };
+}
+
+
+#endif //SERVER_STAGE_H
@@ -18,18 +18,23 @@
  * Thread_guard class constructor
  *
  * @param t vector of all threads to join on
+ * @param ready circular vector of the connections ready to be served
+ * @param poller poller containing all the connections
+ * @param disk disk/database stage
+ * @param retrieve retrieve stage
  * @param stop atomic boolean used to signal to the threads to stop
  *
  * @author Michele Crepaldi s269551
  */
-server::Thread_guard::Thread_guard(std::vector<std::thread> &t, TS_Circular_vector<std::pair<std::string,
-                                   Socket>> &sockets, std::atomic<bool> &stop) :
-                                        _tVector(t), _stop(stop), _sockets(sockets) {
+server::Thread_guard::Thread_guard(std::vector<std::thread> &t, TS_Circular_vector<std::shared_ptr<Connection>> &ready,
+                                   Poller &poller, Stage &disk, Stage &retrieve, std::atomic<bool> &stop) :
+                                        _tVector(t), _stop(stop), _ready(ready), _poller(poller), _disk(disk),
+                                        _retrieve(retrieve) {
 }
 
 /**
- * Thread_guard class destructor; it signals the threads to stop and waits for them
- *  (it also shuts down the protobuf library)
+ * Thread_guard class destructor; it signals the threads to stop and waits for them (and for the retrieve and
+ *  disk stages threads), then it closes all the connections left (it also shuts down the protobuf library)
  *
  * @author Michele Crepaldi s269551
  */
@@ -37,13 +42,23 @@ server::Thread_guard::~Thread_guard() {
     //tell the single server threads to stop
     _stop.store(true);
     //notify all threads
-    _sockets.notifyAll();
+    _ready.notifyAll();
 
     //then join on all threads
     for(auto &t : _tVector)
         if(t.joinable())
             t.join();
 
+    //stop the retrieve and disk stages (the server threads, which post to them, are stopped; the retrieves being
+    //served are interrupted by the stop boolean)
+    _retrieve.stop();
+    _disk.stop();
+
+    //close all the connections (before shutting down protobuf, their protocol managers contain protobuf messages)
+    while(_ready.canGet())
+        _ready.pop();
+    _poller.clear();
+
     //delete all global objects allocated by libprotobuf
     google::protobuf::ShutdownProtobufLibrary();
 }
@@ -12,7 +12,9 @@
 #include <vector>
 
 #include "../myLibraries/Circular_vector.h"
-#include "../myLibraries/Socket.h"
+
+#include "Poller.h"
+#include "Stage.h"
 
 
 /**
@@ -33,15 +35,18 @@ namespace server {
         Thread_guard(Thread_guard &&) = delete; //move constructor deleted
         Thread_guard& operator=(Thread_guard &&) = delete;  //move assignment deleted
 
-        Thread_guard(std::vector<std::thread> &t, TS_Circular_vector<std::pair<std::string, Socket>> &sockets,
-                     std::atomic<bool> &stop);   //constructor
+        Thread_guard(std::vector<std::thread> &t, TS_Circular_vector<std::shared_ptr<Connection>> &ready,
+                     Poller &poller, Stage &disk, Stage &retrieve, std::atomic<bool> &stop);  //constructor
 
         ~Thread_guard();    //destructor
 
     private:
         std::vector<std::thread> &_tVector;    //reference to the vector of threads
         std::atomic<bool> &_stop;   //reference to the atomic boolean used to stop the threads
-        TS_Circular_vector<std::pair<std::string, Socket>> &_sockets;  //sockets circular vector
+        TS_Circular_vector<std::shared_ptr<Connection>> &_ready;  //ready connections circular vector
+        Poller &_poller;    //poller containing all the connections
+        Stage &_disk;       //disk/database stage
+        Stage &_retrieve;   //retrieve stage
     };
 }
 
@@ -10,6 +10,9 @@
 #include <iostream>
 #include <thread>
 #include <regex>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <arpa/inet.h>
 
 #include "../myLibraries/Socket.h"
 #include "../myLibraries/Circular_vector.h"
@@ -24,9 +27,12 @@
 #include "Config.h"
 #include "ProtocolManager.h"
 #include "ArgumentsManager.h"
+#include "Poller.h"
+#include "Stage.h"
+#include "Scrubber.h"
 
 
-#define VERSION 1
+#define VERSION 2
 
 #define PORT 8081
 #define SOCKET_TYPE SocketType::TLS
@@ -34,8 +40,21 @@
 
 using namespace server;
 
+//function representing a server shard
+void shard(unsigned int, unsigned int, std::atomic<bool> &, std::atomic<bool> &);
+
 //function representing a single server thread
-void single_server(TS_Circular_vector<std::pair<std::string, Socket>> &, std::atomic<bool> &, std::atomic<bool> &);
+void single_server(TS_Circular_vector<std::shared_ptr<Connection>> &, Poller &, Stage &, Stage &,
+                   std::atomic<bool> &, std::atomic<bool> &);
+
+//function used to serve a client connection handling its errors
+bool serve(const std::shared_ptr<Connection> &, Poller &, std::atomic<bool> &, const std::function<void()> &);
+
+//function used to post the operations of a client connection which can be started
+Drain::State dispatch(const std::shared_ptr<Connection> &, Poller &);
+
+//function used to resume a client connection parked
+void resume(const std::shared_ptr<Connection> &, Poller &);
 
 /**
  * main function
@@ -61,7 +80,7 @@ int main(int argc, char** argv) {
 
         Database::setPath(config->getServerDatabasePath());         //set the database path
         Database_pwd::setPath(config->getPasswordDatabasePath());   //set the password database path
-        auto db = Database::getInstance();          //server database instance
+        Database::splitShared();                    //split the (old) shared server database (if any) by user
         auto pass_db = Database_pwd::getInstance(); //password database instance
 
         if(inputArgs.isAddSet()){   //if addUser option is set
@@ -90,11 +109,18 @@ int main(int argc, char** argv) {
 
             //now remove all the elements saved for the removed user from database and from filesystem
 
-            //all the mac addresses associated to the user
-            std::vector<std::string> macAddrs = db->getAllMacAddresses(inputArgs.getUsername());
+            std::vector<std::string> macAddrs;  //all the mac addresses associated to the user
 
-            //remove all backup elements related to the user from server database
-            db->removeAll(inputArgs.getUsername());
+            //a user without a database has no elements saved (do not create an empty database for it)
+            if(Database::exists(inputArgs.getUsername())) {
+                //user's server database instance
+                auto db = Database::getUncachedInstance(inputArgs.getUsername());
+
+                macAddrs = db->getAllMacAddresses(inputArgs.getUsername());
+
+                //remove all backup elements related to the user from server database
+                db->removeAll(inputArgs.getUsername());
+            }
 
             for(const auto& mac: macAddrs){    //for each mac address of that user
                 //compute the backup folder name
@@ -131,7 +157,10 @@ int main(int argc, char** argv) {
             if(inputArgs.isMacSet()){   //if a mac address is set
                 //delete all backup elements for the specified user and mac from server database
 
-                db->removeAll(inputArgs.getDelUsername(), inputArgs.getDelMac());
+                //a user without a database has no elements saved (do not create an empty database for it)
+                if(Database::exists(inputArgs.getDelUsername()))
+                    Database::getUncachedInstance(inputArgs.getDelUsername())->removeAll(inputArgs.getDelUsername(),
+                                                                                          inputArgs.getDelMac());
 
                 //compute the backup folder name
 
@@ -148,11 +177,18 @@ int main(int argc, char** argv) {
             else{   //otherwise
                 //delete all backup elements for the specified user (ALL OF THEM!)
 
-                //all the mac addresses associated to the user
-                std::vector<std::string> macAddrs = db->getAllMacAddresses(inputArgs.getDelUsername());
+                std::vector<std::string> macAddrs;  //all the mac addresses associated to the user
 
-                //remove all backup elements related to the user from server database
-                db->removeAll(inputArgs.getDelUsername());
+                //a user without a database has no elements saved (do not create an empty database for it)
+                if(Database::exists(inputArgs.getDelUsername())) {
+                    //user's server database instance
+                    auto db = Database::getUncachedInstance(inputArgs.getDelUsername());
+
+                    macAddrs = db->getAllMacAddresses(inputArgs.getDelUsername());
+
+                    //remove all backup elements related to the user from server database
+                    db->removeAll(inputArgs.getDelUsername());
+                }
 
                 //for each mac address
                 for(const auto& mac: macAddrs){
@@ -182,50 +218,35 @@ int main(int argc, char** argv) {
             ServerSocket::specifyCertificates(config->getCertificatePath(), config->getPrivateKeyPath(),
                                               config->getCaFilePath());
 
-            ServerSocket server_sock{PORT, config->getListenQueue(), SOCKET_TYPE};   //server socket
-
-            Message::print(std::cout, "INFO", "Server opened: available at", "["
-                            + std::string(server_sock.getIP()) + ":" + std::to_string(PORT) + "]");
+            //specify the maximum size of the messages the server will accept
+            Socket::setMaxFrameSize(config->getMaxFrameSize());
 
-            //thread safe circular vector of fixed size containing a list of sockets and their ip addresses
-            TS_Circular_vector<std::pair<std::string, Socket>> sockets{config->getSocketQueueSize()};
-
-            std::atomic<bool> server_threads_stop = false;  //atomic boolean used to force the server threads to stop
-            std::atomic<bool> main_stop = false;            //atomic boolean used to force the main thread to stop
-            std::vector<std::thread> threads;   //vector containing all server threads
-
-            //create NThreads threads and start them
-            threads.reserve(config->getNThreads());
-            for (int i = 0; i < config->getNThreads(); i++)
-                threads.emplace_back(single_server, std::ref(sockets), std::ref(server_threads_stop),
-                                     std::ref(main_stop));
-
-            //thread guard used to stop all the threads in the threads vector when the main returns
-            Thread_guard td{threads, sockets, server_threads_stop};
-
-            struct sockaddr_in addr{};  //client sockaddr_in structure
-            unsigned long addr_len = sizeof(addr);  //length of the sockaddr_in structure
+            //every client connection needs a file descriptor, so raise their limit to the maximum allowed
+            struct rlimit limit{};  //open file descriptors limit
+            if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
 
-            //loop until told to stop (by the server threads, in case of a Fatal exception)
-            while (!main_stop.load()) {
-                //accept a new client socket
+            unsigned int nShards = config->getShards();    //number of server shards
 
-                Socket s = server_sock.accept(&addr, &addr_len);    //socket of incoming client connection
+            std::atomic<bool> main_stop = false;    //atomic boolean used to force the shards to stop
+            std::atomic<bool> failed = false;       //atomic boolean set if a shard stopped because of an error
 
-                //if told to stop return -> the stopping server thread (the one that will set this variable)
-                //will also connect locally to this socket in order to exit from the accept
-                if(main_stop.load())
-                    return 0;
+            //verify the content of the saved files in the background (stopped when leaving this scope)
+            Scrubber scrubber{config->getServerBasePath(), config->getScrubMbPerSecond(),
+                              config->getScrubIntervalHours()};
 
-                //obtain ip address of newly connected client
+            //start all the shards (each one with its own listening socket, poller and threads) and wait for them
+            std::vector<std::thread> shards;    //vector containing the shards (accepting) threads
+            shards.reserve(nShards);
+            for (unsigned int i = 0; i < nShards; i++)
+                shards.emplace_back(shard, i, nShards, std::ref(main_stop), std::ref(failed));
 
-                std::stringstream tmp;
-                tmp << inet_ntoa(addr.sin_addr) << ":" << addr.sin_port;
-                std::string clientAddress = tmp.str();
+            for (auto &t : shards)
+                t.join();
 
-                //push the (address,socket) pair into the socket queue
-                sockets.push(std::make_pair(std::move(clientAddress),std::move(s)));
-            }
+            return failed.load() ? 1 : 0;
         }
     }
     catch (ArgumentsManagerException &e) {  //catch arguments manager exceptions
@@ -273,6 +294,7 @@ int main(int argc, char** argv) {
             case DatabaseError::read:
             case DatabaseError::update:
             case DatabaseError::remove:
+            case DatabaseError::migrate:
             default:
                 //print message and exit
 
@@ -364,336 +386,526 @@ int main(int argc, char** argv) {
     return 1;
 }
 
+/**
+ * shard function.
+ *  function representing a server shard: it opens its own listening socket (sharing the port with the other shards),
+ *  starts its own poller, server threads and disk/database stage, and then accepts the clients connecting to it
+ *  until told to stop; only the databases are shared between the shards
+ *
+ * @param id shard number
+ * @param nShards total number of shards
+ * @param main_stop atomic boolean to stop all the shards
+ * @param failed atomic boolean to set in case the shard stops because of an error
+ */
+void shard(unsigned int id, unsigned int nShards, std::atomic<bool> &main_stop, std::atomic<bool> &failed){
+    try {
+        auto config = Config::getInstance();    //config instance
+
+        std::string name = nShards > 1 ? " (shard " + std::to_string(id) + ")" : "";  //shard name (for messages)
+
+        //core where to pin the shard accepting thread and poller (only when there are more shards)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(id % std::max(std::thread::hardware_concurrency(), 1u), &cpus);
+
+        if(nShards > 1)
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        //server socket (if there are more shards the port is shared, and the kernel balances the clients among them)
+        ServerSocket server_sock{PORT, config->getListenQueue(), SOCKET_TYPE, nShards > 1};
+
+        Message::print(std::cout, "INFO", "Server opened" + name + ": available at", "["
+                        + std::string(server_sock.getIP()) + ":" + std::to_string(PORT) + "]");
+
+        //thread safe circular vector of fixed size containing the client connections ready to be served
+        TS_Circular_vector<std::shared_ptr<Connection>> ready{config->getSocketQueueSize()};
+
+        //poller waiting for messages on all the client connections (of this shard) at once
+        Poller poller{ready, config->getSelectTimeoutSeconds(), config->getTimeoutSeconds()};
+
+        //disk/database stage, where the file writes and the disk and database operations are done
+        Stage disk{"disk", config->getDiskThreads(), config->getDiskQueueSize()};
+
+        //retrieve stage, where the retrieves are served (each one until all the files are sent to the client)
+        //(as many can wait as connections can wait for a server thread)
+        Stage retrieve{"retrieve", config->getRetrieveThreads(), config->getSocketQueueSize()};
+
+        //periodically print the queues depths (connections waiting for a server thread, operations waiting
+        //for a disk/database thread and retrieves waiting for a retrieve thread)
+        poller.setReport(config->getStatsSeconds(), [&ready, &disk, &retrieve, name](){
+            Message::print(std::cout, "INFO", "Queues depth" + name, "network: " + std::to_string(ready.size()) +
+                            ", " + disk.getName() + ": " + std::to_string(disk.depth()) +
+                            ", " + retrieve.getName() + ": " + std::to_string(retrieve.depth()));
+        });
+
+        std::atomic<bool> server_threads_stop = false;  //atomic boolean used to force the server threads to stop
+        std::vector<std::thread> threads;   //vector containing the poller thread and all server threads
+
+        //start the poller thread (on the same core as this thread), then create NThreads server threads and start them
+        threads.reserve(config->getNThreads() + 1);
+        threads.emplace_back(&Poller::run, &poller, std::ref(server_threads_stop));
+        if(nShards > 1)
+            pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+
+        for (int i = 0; i < config->getNThreads(); i++)
+            threads.emplace_back(single_server, std::ref(ready), std::ref(poller), std::ref(disk), std::ref(retrieve),
+                                 std::ref(server_threads_stop), std::ref(main_stop));
+
+        //thread guard used to stop all the threads in the threads vector (and the stages) when the shard returns
+        Thread_guard td{threads, ready, poller, disk, retrieve, server_threads_stop};
+
+        struct sockaddr_in addr{};  //client sockaddr_in structure
+        unsigned long addr_len = sizeof(addr);  //length of the sockaddr_in structure
+        char ip[INET_ADDRSTRLEN];   //client ip address
+
+        //loop until told to stop (by the server threads, in case of a Fatal exception)
+        while (!main_stop.load()) {
+            //wait for a new client (checking periodically if told to stop, the other shards may have been told)
+            if(!server_sock.waitClient(config->getSelectTimeoutSeconds()))
+                continue;
+
+            //accept a new client socket
+
+            Socket s = server_sock.accept(&addr, &addr_len);    //socket of incoming client connection
+
+            //if told to stop return -> the stopping server thread (the one that will set this variable)
+            //will also connect locally to a server socket in order to exit from the wait
+            if(main_stop.load())
+                return;
+
+            //obtain ip address of newly connected client
+
+            std::stringstream tmp;
+            tmp << inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip)) << ":" << addr.sin_port;
+            std::string clientAddress = tmp.str();
+
+            //print ip address and port of the newly connected client
+            Message::print(std::cout, "EVENT", clientAddress, "New Connection");
+
+            //a client which does not read (or send) anything for more than the timeout while a thread is sending to
+            //it (or receiving from it) is disconnected, so it cannot hold the thread
+            s.setTimeout(config->getTimeoutSeconds());
+
+            //register the new connection in the poller (it will be served when the client sends something)
+            poller.add(std::make_shared<Connection>(std::move(clientAddress), std::move(s), VERSION, disk));
+        }
+    }
+    catch (std::exception &e) {
+        //print message and stop all the shards
+
+        Message::print(std::cerr, "ERROR", "Shard " + std::to_string(id) + " exception", e.what());
+
+        failed.store(true);
+        main_stop.store(true);
+    }
+}
+
 /**
  * single server function.
- *  function representing a single server thread. Used to manage the connection with a client
+ *  function representing a single server thread (network stage). Used to serve the client connections ready to be
+ *  served: the messages already arrived are received and the operations which need the disk and the database are
+ *  posted to the disk/database stage (the ones on independent paths are completed concurrently, so out of order);
+ *  then the queued replies are sent and the connection is given back to the poller. The disk/database stage wakes
+ *  the connection up once an operation is completed, so that a server thread sends its reply. A retrieve is handed
+ *  to the retrieve stage, which serves the connection until all the files are sent and then gives it back
  *
- * @param sockets list of (address,socket) pairs
+ * @param ready list of client connections ready to be served
+ * @param poller poller containing all the client connections
+ * @param disk disk/database stage
+ * @param retrieve retrieve stage
  * @param main_stop atomic boolean to stop the main thread
  * @param server_stop atomic boolean to stop the server threads
  *
  * @author Michele Crepaldi s269551
  */
-void single_server(TS_Circular_vector<std::pair<std::string, Socket>> &sockets, std::atomic<bool> &server_threads_stop,
-                   std::atomic<bool> &main_stop){
+void single_server(TS_Circular_vector<std::shared_ptr<Connection>> &ready, Poller &poller, Stage &disk,
+                   Stage &retrieve, std::atomic<bool> &server_threads_stop, std::atomic<bool> &main_stop){
 
     //loop until we are told to stop
     while(!server_threads_stop.load()){
 
-        //get the first socket in the socket queue (removing it from the queue);
+        //get the first connection in the ready queue (removing it from the queue);
         //if no element is present then passively wait until an element can be removed or the server_threads_stop
         //boolean becomes true (in such case returning a nullopt)
 
-        auto optional = sockets.tryGetUntil(server_threads_stop);   //optional (address,socket) pair
+        auto optional = ready.tryGetUntil(server_threads_stop);   //optional connection
 
         //if the optional does not have a value it means that the previous function returned
         //because of server_threads_stop being true, so I need to return
         if(!optional.has_value())
             return;
 
-        auto pair = std::move(optional.value());    //(address,socket) pair from optional
+        auto connection = std::move(optional.value());  //connection from optional
+
+        bool keep = serve(connection, poller, main_stop, [&connection, &poller, &disk, &retrieve,
+                                                          &server_threads_stop, &main_stop](){
+            if(!connection->authenticated)
+                //the first message has to be the authentication one
+                //(if it has not completely arrived yet the connection is served again when the rest arrives)
+                connection->authenticated = connection->pm.authenticate();
+            //receive the client messages (if the connection was handed out to read) and complete their operations
+            //on the disk/database stage, which will then wake the connection up to send the replies
+            //(the operations on the same path are posted with the same key, so they are completed in order, while a
+            //directory removal waits for the operations of this connection received before it, and the following
+            //ones wait for it; the path locks order it with the operations of the other connections)
+            else if(connection->readable)
+                for(auto &operation : connection->pm.receive()) {
+                    if(operation.type == messages::ClientMessage_Type_RETR) {
+                        //the retrieve stage serves the connection until all the files are sent (it is the last
+                        //operation received), then it sends the replies and gives the connection back to the poller
+                        //(the connections are spread among the retrieve threads by their socket)
+                        connection->drain.add(retrieve, connection->socket.getSockfd(), Drain::Order::takeOver,
+                                [connection, &poller, &server_threads_stop, &main_stop,
+                                 operation = std::make_shared<ProtocolManager::Operation>(std::move(operation))](){
+                            serve(connection, poller, main_stop, [&connection, &poller, &server_threads_stop,
+                                                                  &operation](){
+                                connection->pm.flush();
+                                connection->pm.retrieve(*operation, server_threads_stop);
+                                connection->pm.flush();
+
+                                poller.rearm(connection);
+                            });
+                        });
+                        break;
+                    }
 
-        std::string address = pair.first;       //address of the client connected to the socket
-        Socket sock = std::move(pair.second);   //client socket
+                    unsigned int key = operation.key;   //key of the operation
+                    Drain::Order order = operation.type == messages::ClientMessage_Type_RMD ?
+                            Drain::Order::exclusive : Drain::Order::keyed;  //how the operation is ordered
 
-        //print ip address and port of the newly connected client
-        Message::print(std::cout, "EVENT", address, "New Connection");
+                    connection->drain.add(disk, key, order, [connection, &poller, &main_stop,
+                            operation = std::make_shared<ProtocolManager::Operation>(std::move(operation))](){
+                        serve(connection, poller, main_stop, [&connection, &operation](){
+                            connection->pm.complete(*operation);
+                        });
 
-        try{
-            auto config = Config::getInstance();    //config instance
+                        //wake the connection up to send the reply
+                        poller.wake(connection);
+                    });
+                }
 
-            ProtocolManager pm{sock, address, VERSION}; //protocol manager for this connection
+            //post the operations of the connection which can be started (without waiting)
+            Drain::State state = dispatch(connection, poller);
 
-            //authenticate the connected client
-            pm.authenticate();
+            //a retrieve was posted: the connection belongs to the retrieve stage now
+            if(state == Drain::State::takenOver)
+                return;
 
-            //if authentication is successful
+            //send the queued replies
+            connection->pm.flush();
 
-            fd_set read_fds;        //fd read set for select
-            unsigned int timeWaited = 0;     //total time waited without receiving messages from client
-            bool loop = true;       //loop condition
+            //give the connection back to the poller (if the stage is full the socket is not read until the stage
+            //wakes the connection up, so the client waits instead of the server thread)
+            if(state == Drain::State::parked)
+                poller.park(connection);
+            else
+                poller.rearm(connection);
+        });
 
-            //loop until we are told to stop or loop condition becomes false
-            while(loop && !server_threads_stop.load()) {
-                //build fd sets
-                FD_ZERO(&read_fds);
-                FD_SET(sock.getSockfd(), &read_fds);
+        //if a fatal error occurred return
+        if(!keep)
+            return;
+    }
+}
 
-                int maxfd = sock.getSockfd();   //select max fd
-                struct timeval tv{};    //timeval struct for select
-                tv.tv_sec = config->getSelectTimeoutSeconds();  //set timeval for the select function
+/**
+ * serve function.
+ *  function used to serve a client connection (executing an operation on it) handling all its errors:
+ *  in case of errors related to the connection the connection is closed, in case of fatal errors the server is
+ *  stopped
+ *
+ * @param connection client connection
+ * @param poller poller containing all the client connections
+ * @param main_stop atomic boolean to stop the main thread
+ * @param operation operation to execute
+ *
+ * @return false in case of fatal errors (the server is stopping), true otherwise
+ *
+ * @author Michele Crepaldi s269551
+ */
+bool serve(const std::shared_ptr<Connection> &connection, Poller &poller, std::atomic<bool> &main_stop,
+           const std::function<void()> &operation){
 
-                //select on read socket
+    const std::string &address = connection->address;  //address of the client connected to the socket
 
-                int activity = select(maxfd + 1, &read_fds, nullptr, nullptr, &tv);
+    try{
+        operation();
+        return true;
+    }
+    catch (ConfigException &e) {
+        //switch on the exception code
+        switch(e.getCode()){
+            case ConfigError::justCreated:
+            case ConfigError::serverBasePath:
+            case ConfigError::tempPath:
+                //prompt the user to check the configuration file
+                Message::print(std::cout, "ERROR", "Please check config file: ", CONFIG_FILE_PATH);
 
-                switch (activity) {
-                    case -1:
-                        //I should never get here
-                        Message::print(std::cerr, "ERROR", "Select error");
+            case ConfigError::path:
+            case ConfigError::open:
+            default:
+                //print message and exit
 
-                        //exit loop --> this will cause the current connection to be closed
-                        loop = false;
-                        break;
+                Message::print(std::cerr, "ERROR", "Config Exception", e.what());
 
-                    case 0:
-                        //update time waited
-                        timeWaited += config->getSelectTimeoutSeconds();
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-                        //if the time already waited is greater than TimeoutSeconds
-                        if (timeWaited >= config->getTimeoutSeconds()) {
-                            //then exit loop --> this will cause the current connection to be closed
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-                            loop = false;
-                            Message::print(std::cout, "INFO", "Disconnecting client ", address);
-                        }
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
 
-                        break;
+                return false;
+        }
+    }
+    catch (DatabaseException &e) {
+        //switch on the exception code
+        switch(e.getCode()){
+            case DatabaseError::path:
+            case DatabaseError::create:
+            case DatabaseError::open:
+            case DatabaseError::prepare:
+            case DatabaseError::finalize:
+            case DatabaseError::insert:
+            case DatabaseError::read:
+            case DatabaseError::update:
+            case DatabaseError::remove:
+            case DatabaseError::migrate:
+            default:
+                //print message and exit
 
-                    default:
-                        //reset timeout
-                        timeWaited = 0;
+                Message::print(std::cerr, "ERROR", "Database Exception", e.what());
 
-                        //if I have something to read
-                        if (FD_ISSET(sock.getSockfd(), &read_fds)) {
-                            //receive client message and process it
-                            pm.receive();
-                        }
-                }
-            }
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
+
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
+
+                return false;
         }
-        catch (ConfigException &e) {
-            //switch on the exception code
-            switch(e.getCode()){
-                case ConfigError::justCreated:
-                case ConfigError::serverBasePath:
-                case ConfigError::tempPath:
-                    //prompt the user to check the configuration file
-                    Message::print(std::cout, "ERROR", "Please check config file: ", CONFIG_FILE_PATH);
+    }
+    catch (DatabaseException_pwd &e) {
+        //switch on the exception code
+        switch(e.getCode()){
+            //these errors should not be triggered in the server threads
+            case DatabaseError_pwd::path:
+            case DatabaseError_pwd::create:
+            case DatabaseError_pwd::open:
+            case DatabaseError_pwd::prepare:
+            case DatabaseError_pwd::finalize:
+            case DatabaseError_pwd::insert:
+            case DatabaseError_pwd::update:
+            case DatabaseError_pwd::remove:
 
-                case ConfigError::path:
-                case ConfigError::open:
-                default:
-                    //print message and exit
+                //this is the only password database error that could happen in the server threads
+            case DatabaseError_pwd::read:
+            default:
+                //print message and exit
 
-                    Message::print(std::cerr, "ERROR", "Config Exception", e.what());
+                Message::print(std::cerr, "ERROR", "PWD_Database Exception", e.what());
 
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
 
-                    return;
-            }
-        }
-        catch (DatabaseException &e) {
-            //switch on the exception code
-            switch(e.getCode()){
-                case DatabaseError::path:
-                case DatabaseError::create:
-                case DatabaseError::open:
-                case DatabaseError::prepare:
-                case DatabaseError::finalize:
-                case DatabaseError::insert:
-                case DatabaseError::read:
-                case DatabaseError::update:
-                case DatabaseError::remove:
-                default:
-                    //print message and exit
-
-                    Message::print(std::cerr, "ERROR", "Database Exception", e.what());
-
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
-
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
-
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
-
-                    return;
-            }
+                return false;
         }
-        catch (DatabaseException_pwd &e) {
-            //switch on the exception code
-            switch(e.getCode()){
-                //these errors should not be triggered in the server threads
-                case DatabaseError_pwd::path:
-                case DatabaseError_pwd::create:
-                case DatabaseError_pwd::open:
-                case DatabaseError_pwd::prepare:
-                case DatabaseError_pwd::finalize:
-                case DatabaseError_pwd::insert:
-                case DatabaseError_pwd::update:
-                case DatabaseError_pwd::remove:
-
-                    //this is the only password database error that could happen in the server threads
-                case DatabaseError_pwd::read:
-                default:
-                    //print message and exit
-
-                    Message::print(std::cerr, "ERROR", "PWD_Database Exception", e.what());
-
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
-
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
-
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
-
-                    return;
-            }
-        }
-        catch (ProtocolManagerException &e) {
-            //switch on the exception code
-            switch(e.getCode()){
-                //these 2 cases are handled directly by the protocol manager -> keep connection and skip message;
-                case ProtocolManagerError::unexpected:
-                case ProtocolManagerError::client:
+    }
+    catch (ProtocolManagerException &e) {
+        //switch on the exception code
+        switch(e.getCode()){
+            //these 2 cases are handled directly by the protocol manager -> keep connection and skip message;
+            case ProtocolManagerError::unexpected:
+            case ProtocolManagerError::client:
 
-                //in these 2 cases connection with the client is not valid and needs to be closed
-                case ProtocolManagerError::auth:
-                case ProtocolManagerError::version:
-                    //print message and close connection, then proceed with next client connection (loop)
+            //in these 2 cases connection with the client is not valid and needs to be closed
+            case ProtocolManagerError::auth:
+            case ProtocolManagerError::version:
+                //print message and close connection, then proceed with next client connection
 
-                    Message::print(std::cerr, "WARNING", "ProtocolManager Exception", e.what());
+                Message::print(std::cerr, "WARNING", "ProtocolManager Exception", e.what());
 
-                    Message::print(std::cout, "INFO", "Closing connection with client",
-                                   "I will proceed with next connections");
+                Message::print(std::cout, "INFO", "Closing connection with client",
+                               "I will proceed with next connections");
 
-                    //the connection will be closed automatically by the destructor
-                    //(since sock is declared inside the loop)
+                //send the error reply (it is queued) before closing; these errors only come from the server threads
+                try {
+                    connection->pm.flush();
+                }
+                catch (SocketException &) {
+                    //the connection is being closed anyway
+                }
 
-                    continue;   //the error is in the current socket, continue with the next one
+                //unregister the connection, it will be closed automatically by the destructor
+                //(when the last reference to it is released, once its operations still waiting are completed)
+                poller.remove(connection);
+                dispatch(connection, poller);
 
-                //in this case (and default) the errors are so important that they require
-                //the closing of the whole program
-                case ProtocolManagerError::internal:
-                default:
-                    //print message and exit
+                return true;    //the error is in the current socket, continue with the next one
 
-                    Message::print(std::cerr, "ERROR", "ProtocolManager Exception", e.what());
+            //in this case (and default) the errors are so important that they require
+            //the closing of the whole program
+            case ProtocolManagerError::internal:
+            default:
+                //print message and exit
 
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
+                Message::print(std::cerr, "ERROR", "ProtocolManager Exception", e.what());
 
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-                    return;
-            }
-        }
-        catch (SocketException &e) {
-            //switch on the exception code
-            switch(e.getCode()){
-                case SocketError::read:
-                case SocketError::write:
-                case SocketError::closed:
-                    Message::print(std::cout, "EVENT", address, "disconnected.");
-                    continue;   //error in the current socket, continue with the next one
-
-                //these errors should not be triggered in the server threads
-                case SocketError::create:
-                case SocketError::accept:
-                case SocketError::bind:
-                case SocketError::connect:
-                case SocketError::getMac:
-                case SocketError::getIp:
-                default:
-                    //print message and exit
-
-                    Message::print(std::cerr, "ERROR", "Socket Exception", e.what());
-
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
-
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
-
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
-
-                    return;
-            }
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
+
+                return false;
         }
-        catch (HashException &e) {  //catch hash exceptions
-            //switch on the exception code
-            switch(e.getCode()){
-                case HashError::init:
-                case HashError::update:
-                case HashError::finalize:
-                case HashError::set:
-                default:
-                    //print message and exit
+    }
+    catch (SocketException &e) {
+        //switch on the exception code
+        switch(e.getCode()){
+            case SocketError::read:
+            case SocketError::write:
+            case SocketError::closed:
+                Message::print(std::cout, "EVENT", address, "disconnected.");
+                poller.remove(connection);
+                dispatch(connection, poller);
+                return true;    //error in the current socket, continue with the next one
+
+            //these errors should not be triggered in the server threads
+            case SocketError::create:
+            case SocketError::accept:
+            case SocketError::bind:
+            case SocketError::connect:
+            case SocketError::getMac:
+            case SocketError::getIp:
+            default:
+                //print message and exit
 
-                    Message::print(std::cerr, "ERROR", "Hash exception", e.what());
+                Message::print(std::cerr, "ERROR", "Socket Exception", e.what());
 
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
 
-                    return;
-            }
+                return false;
         }
-        catch (RngException &e) {   //catch random number generator exceptions
-            //switch on the exception code
-            switch(e.getCode()){
-                case RngError::init:
-                case RngError::generate:
-                default:
-                    //print message and exit
+    }
+    catch (HashException &e) {  //catch hash exceptions
+        //switch on the exception code
+        switch(e.getCode()){
+            case HashError::init:
+            case HashError::update:
+            case HashError::finalize:
+            case HashError::set:
+            default:
+                //print message and exit
 
-                    Message::print(std::cerr, "ERROR", "Rng exception", e.what());
+                Message::print(std::cerr, "ERROR", "Hash exception", e.what());
 
-                    //set the stop atomic boolean for the main (the main will stop all the other threads)
-                    main_stop.store(true);
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-                    Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-                    //connect to the local serverSocket in order to make it exit the accept
-                    tmp.connect("localhost",PORT);
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
 
-                    return;
-            }
+                return false;
         }
-        catch (std::exception &e) {
-            //print message and exit
+    }
+    catch (RngException &e) {   //catch random number generator exceptions
+        //switch on the exception code
+        switch(e.getCode()){
+            case RngError::init:
+            case RngError::generate:
+            default:
+                //print message and exit
 
-            Message::print(std::cerr, "ERROR", "generic exception", e.what());
+                Message::print(std::cerr, "ERROR", "Rng exception", e.what());
 
-            //set the stop atomic boolean for the main (the main will stop all the other threads)
-            main_stop.store(true);
+                //set the stop atomic boolean for the main (the main will stop all the other threads)
+                main_stop.store(true);
 
-            Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+                Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-            //connect to the local serverSocket in order to make it exit the accept
-            tmp.connect("localhost",PORT);
+                //connect to the local serverSocket in order to make it exit the accept
+                tmp.connect("localhost",PORT);
 
-            return;
+                return false;
         }
-        catch (...) {
-            //print message and exit
+    }
+    catch (std::exception &e) {
+        //print message and exit
 
-            Message::print(std::cerr, "ERROR", "uncaught exception");
+        Message::print(std::cerr, "ERROR", "generic exception", e.what());
 
-            //set the stop atomic boolean for the main (the main will stop all the other threads)
-            main_stop.store(true);
+        //set the stop atomic boolean for the main (the main will stop all the other threads)
+        main_stop.store(true);
 
-            Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+        Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
 
-            //connect to the local serverSocket in order to make it exit the accept
-            tmp.connect("localhost",PORT);
+        //connect to the local serverSocket in order to make it exit the accept
+        tmp.connect("localhost",PORT);
 
-            return;
-        }
+        return false;
+    }
+    catch (...) {
+        //print message and exit
+
+        Message::print(std::cerr, "ERROR", "uncaught exception");
+
+        //set the stop atomic boolean for the main (the main will stop all the other threads)
+        main_stop.store(true);
+
+        Socket tmp{SocketType::TCP};    //temporary socket to close wake the main
+
+        //connect to the local serverSocket in order to make it exit the accept
+        tmp.connect("localhost",PORT);
+
+        return false;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * dispatch function.
+ *  function used to post the operations of a client connection which can be started; it never waits: if the stage
+ *  is full (or too many operations are waiting) the connection is parked, and it is resumed once it can go on
+ *
+ * @param connection client connection
+ * @param poller poller containing all the client connections
+ *
+ * @return state of the connection (ready to be read again, parked or taken over by a retrieve)
+ */
+Drain::State dispatch(const std::shared_ptr<Connection> &connection, Poller &poller){
+    return connection->drain.dispatch([connection, &poller](){
+        resume(connection, poller);
+    });
+}
+
+/**
+ * resume function.
+ *  function used (by the stages) to resume a client connection parked: it is woken up, so that a server thread
+ *  posts its operations waiting; if it was closed in the meantime they are posted directly (they still have to
+ *  be completed, for example to keep the partial files of the transfers interrupted)
+ *
+ * @param connection client connection
+ * @param poller poller containing all the client connections
+ */
+void resume(const std::shared_ptr<Connection> &connection, Poller &poller){
+    if(!poller.wake(connection))
+        dispatch(connection, poller);
+}